@@ -0,0 +1,26 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include "../../include/common.h"
+
+#define MAX_ENTRIES    256
+#define NUM_FAST_PATHS 4
+
+typedef struct {
+    char rom[1024];
+    char movie[1024];               /* Empty: no input. */
+} Entry;
+
+/* Read a corpus file into entries after the first count; returns the new
+ * count (-1: error). A corpus file lists an entry per line,
+ * "<rom> [<movie>]", relative to the corpus file. */
+int crp_read(const char *path, Entry *entries, int count);
+const char *crp_base_name(const char *path);
+
+/* Fast paths that can be switched at runtime, by index. */
+int crp_find_fast_path(const char *name);       /* -1: unknown, reported. */
+const char *crp_get_fast_path_name(int fast_path);
+bool crp_get_fast_path_default(int fast_path);  /* As nes_emulator starts. */
+void crp_set_fast_paths(const bool *enabled);
+
+#endif /* CORPUS_H */
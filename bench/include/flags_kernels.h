@@ -0,0 +1,67 @@
+/* -----------------------------------------------------------------
+ * Flag benchmark kernels.
+ *
+ * Included once per flag engine. The includer defines KERNEL(name) and
+ * the flag operations below in terms of that engine, so both engines run
+ * the exact same instruction sequences.
+ * -------------------------------------------------------------- */
+
+/* ADC followed by SBC on each operand. */
+static unsigned KERNEL(adc_sbc)(const byte *operands, int count) {
+    byte A = 0x00;
+
+    for (int i = 0; i < count; i++) {
+        byte operand = operands[i];
+        int result = A + operand + IS_C();
+        UPDATE_ZN(result);
+        UPDATE_C_ADD(result);
+        UPDATE_V(result, A, operand);
+        A = result & 0xFF;
+
+        operand ^= 0xFF;
+        result = A + operand + IS_C();
+        UPDATE_ZN(result);
+        UPDATE_C_ADD(result);
+        UPDATE_V(result, A, operand);
+        A = result & 0xFF;
+    }
+
+    return (A << 8) | GET_STATUS(false);
+}
+
+/* CMP against each operand, followed by BEQ, BCS and BMI. */
+static unsigned KERNEL(cmp_branch)(const byte *operands, int count) {
+    byte A = 0x80;
+    unsigned taken = 0;
+
+    for (int i = 0; i < count; i++) {
+        byte operand = operands[i];
+        UPDATE_C_CMP(A, operand);
+        UPDATE_ZN(A - operand);
+
+        if (IS_Z()) taken += 1;
+        if (IS_C()) taken += 2;
+        if (IS_N()) taken += 4;
+        A ^= operand;
+    }
+
+    return taken;
+}
+
+/* DEX/BNE loops, with a PHP/PLP pair around every inner loop. */
+static unsigned KERNEL(loop_status)(const byte *operands, int count) {
+    unsigned checksum = 0;
+
+    for (int i = 0; i < count / 8; i++) {
+        byte X = 8;
+        do {
+            UPDATE_ZN(--X);
+        } while (!IS_Z());
+
+        byte status = GET_STATUS(true);
+        SET_STATUS(status ^ operands[i]);
+        checksum += GET_STATUS(false);
+    }
+
+    return checksum;
+}
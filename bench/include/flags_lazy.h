@@ -0,0 +1,41 @@
+#ifndef FLAGS_LAZY_H
+#define FLAGS_LAZY_H
+
+#include "../../include/common.h"
+
+typedef enum { LAZY_ADC, LAZY_BIT, LAZY_CMP, LAZY_ROL, LAZY_ROR, LAZY_SBC } LazyOperation;
+
+bool lazy_is_C(void);
+bool lazy_is_Z(void);
+bool lazy_is_I(void);
+bool lazy_is_D(void);
+bool lazy_is_V(void);
+bool lazy_is_N(void);
+
+void lazy_set_C(void);
+void lazy_set_Z(void);
+void lazy_set_I(void);
+void lazy_set_D(void);
+void lazy_set_V(void);
+void lazy_set_N(void);
+
+void lazy_clear_C(void);
+void lazy_clear_Z(void);
+void lazy_clear_I(void);
+void lazy_clear_D(void);
+void lazy_clear_V(void);
+void lazy_clear_N(void);
+
+void lazy_reset(void);
+
+void lazy_update_Z (byte value);
+void lazy_update_N (byte value);
+void lazy_update_ZN(byte value);
+void lazy_update_C (int result, LazyOperation type);
+void lazy_update_V (byte s, byte a, byte b);
+void lazy_update_V_bit(byte s);
+
+byte lazy_get_status(bool B);
+void lazy_set_status(byte status);
+
+#endif /* FLAGS_LAZY_H */
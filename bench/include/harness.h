@@ -0,0 +1,19 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include "../../include/common.h"
+
+/* Helpers the benchmarks and the tools share. */
+
+double hrn_now(void);                       /* Monotonic time in seconds. */
+
+/* Read a whole file into a buffer the caller frees (NULL: error). */
+byte *hrn_read_file(const char *path, long *length);
+
+/* Read a ROM file and insert it (false: it could not be read or loaded). */
+bool hrn_load_rom(const char *path);
+
+/* Run until as many more frames have started. */
+void hrn_run_frames(unsigned long long frames);
+
+#endif /* HARNESS_H */
@@ -0,0 +1,32 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "../../include/common.h"
+
+typedef enum {
+    PMC_CYCLES,
+    PMC_INSTRUCTIONS,
+    PMC_BRANCH_MISSES,
+    PMC_L1D_MISSES,
+    PMC_LLC_MISSES,
+    NUM_PMC_EVENTS
+} PmcEvent;
+
+typedef struct {
+    bool available[NUM_PMC_EVENTS];         /* False: the counter could not be read. */
+    unsigned long long values[NUM_PMC_EVENTS];
+} PmcValues;
+
+/* Hardware counters of the process and the threads it starts afterwards,
+ * through perf_event_open. Counters the kernel, the CPU or the container
+ * does not allow are left out; pmc_open returns false if none are left. */
+bool pmc_open(void);
+void pmc_close(void);
+bool pmc_is_available(PmcEvent event);
+
+void pmc_start(void);                       /* Reset and start counting. */
+void pmc_stop(PmcValues *values);           /* Stop counting and read the counters. */
+
+const char *pmc_get_name(PmcEvent event);
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,436 @@
+/* -----------------------------------------------------------------
+ * nes_bench: throughput of the core over a corpus of ROMs and movies.
+ *
+ * Every corpus entry runs headless in its own process: a number of warm-up
+ * frames, then the measured frames, repeated from the same warm machine.
+ * Entries with a movie play its input, and check the state hash of every
+ * frame the movie has one for. Reported are the frames, instructions and
+ * PPU dots per second of the median repetition, the speed relative to a
+ * real NES, and the median and 99th percentile time of a frame.
+ *
+ * Fast paths can be switched on and off for all runs, and --isolate runs
+ * every entry once more with each fast path switched the other way, to
+ * measure what each one gains on its own. A corpus file lists an entry per
+ * line, "<rom> [<movie>]", relative to the corpus file.
+ *
+ * With --counters, hardware counters are read around the measured frames
+ * and reported per frame and per million guest instructions. Counters that
+ * cannot be opened, as in most containers, are reported as missing.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/movie.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/ppu_internal.h"
+#include "../../include/render.h"
+#include "../include/corpus.h"
+#include "../include/harness.h"
+#include "../include/perf_counters.h"
+
+#define DEFAULT_FRAMES      600
+#define DEFAULT_WARMUP      60
+#define DEFAULT_REPETITIONS 5
+#define NES_FRAME_RATE      60.0988
+
+typedef struct {
+    bool success;
+    bool desync;                    /* A movie frame ran to another state. */
+    int desync_frame;
+    double seconds;                 /* Median repetition. */
+    double frame_us_median;
+    double frame_us_p99;
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long state_hash;  /* At the end of a repetition. */
+    PmcValues counters;             /* Summed over all repetitions. */
+    unsigned long long counted_instructions;
+} Result;
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Run a frame with the input of the movie; false if it has a hash for the
+ * frame and the machine ran to another state. */
+static bool run_frame(const Movie *movie) {
+    unsigned long long frame = machine.ppu.frame;
+    bool has_input = movie != NULL && frame < movie->frames;
+
+    if (has_input) {
+        for (int i = 0; i < 8; i++) {
+            nes_controller1_set(i, movie->inputs[frame][0] >> i & 1);
+            nes_controller2_set(i, movie->inputs[frame][1] >> i & 1);
+        }
+    }
+    while (machine.ppu.frame == frame) {
+        cpu_execute();
+        ppu_catch_up();
+    }
+    return !has_input || movie->hashes == NULL || nes_state_hash() == movie->hashes[frame];
+}
+
+static void run(const Entry *entry, const bool *enabled, int frames, int warmup,
+        int repetitions, bool counters, Result *result) {
+    memset(result, 0, sizeof(*result));
+    if (!hrn_load_rom(entry->rom)) {
+        fprintf(stderr, "Failed to load ROM %s.\n", entry->rom);
+        return;
+    }
+
+    Movie *movie = NULL;
+    if (entry->movie[0] != '\0' && (movie = mov_load(entry->movie)) == NULL) {
+        fprintf(stderr, "Failed to load movie %s.\n", entry->movie);
+        return;
+    }
+
+    cpu_init();
+    nes_init();
+
+    /* Before the fast paths, so that the render worker inherits them. */
+    if (counters) {
+        pmc_open();
+    }
+    crp_set_fast_paths(enabled);
+
+    for (int i = 0; i < warmup; i++) {
+        run_frame(movie);
+    }
+
+    /* Every repetition starts from the warm machine. */
+    struct Machine *warm = nes_alloc_machine();
+    nes_clone(warm, &machine);
+
+    double *seconds = malloc(repetitions * sizeof(double));
+    double *frame_us = malloc((size_t) repetitions * frames * sizeof(double));
+    for (int i = 0; i < repetitions; i++) {
+        nes_clone(&machine, warm);
+        unsigned long long instructions = cpu_get_instructions();
+        unsigned long long cycles = cpu_get_ticks();
+
+        pmc_start();
+        double start = hrn_now();
+        double last = start;
+        for (int j = 0; j < frames; j++) {
+            if (!run_frame(movie) && !result->desync) {
+                result->desync = true;
+                result->desync_frame = machine.ppu.frame - 1;
+            }
+            double end = hrn_now();
+            frame_us[i * frames + j] = 1e6 * (end - last);
+            last = end;
+        }
+        seconds[i] = last - start;
+
+        PmcValues values;
+        pmc_stop(&values);
+        for (int j = 0; j < NUM_PMC_EVENTS; j++) {
+            result->counters.available[j] = values.available[j] &&
+                (i == 0 || result->counters.available[j]);
+            result->counters.values[j] += values.values[j];
+        }
+
+        result->instructions = cpu_get_instructions() - instructions;
+        result->cycles = cpu_get_ticks() - cycles;
+        result->counted_instructions += result->instructions;
+    }
+    pmc_close();
+
+    /* Let the render worker finish before reading the state. */
+    rdr_disable();
+    result->state_hash = nes_state_hash();
+
+    qsort(seconds, repetitions, sizeof(double), compare_doubles);
+    qsort(frame_us, (size_t) repetitions * frames, sizeof(double), compare_doubles);
+    result->seconds = seconds[repetitions / 2];
+    result->frame_us_median = frame_us[(size_t) repetitions * frames / 2];
+    result->frame_us_p99 = frame_us[(size_t) repetitions * frames * 99 / 100];
+    result->success = true;
+
+    free(seconds);
+    free(frame_us);
+    nes_free_machine(warm);
+    mov_free(movie);
+}
+
+/* Run an entry in a child process, so that it starts from power on. */
+static bool run_child(const Entry *entry, const bool *enabled, int frames, int warmup,
+        int repetitions, bool counters, Result *result) {
+    int fd[2];
+    if (pipe(fd) != 0) {
+        return false;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        close(fd[0]);
+        run(entry, enabled, frames, warmup, repetitions, counters, result);
+        exit(write(fd[1], result, sizeof(Result)) == sizeof(Result) ? 0 : 1);
+    }
+
+    close(fd[1]);
+    bool success = read(fd[0], result, sizeof(Result)) == sizeof(Result);
+    close(fd[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return success && result->success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Name of a configuration: the fast path switched from the baseline. */
+static void config_name(char *name, size_t size, int flipped, const bool *enabled) {
+    if (flipped < 0) {
+        snprintf(name, size, "baseline");
+    }
+    else {
+        snprintf(name, size, "%c%s", enabled[flipped] ? '+' : '-', crp_get_fast_path_name(flipped));
+    }
+}
+
+static bool has_counters(const Result *result) {
+    for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+        if (result->counters.available[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static double per_frame(const Result *result, PmcEvent event, int frames, int repetitions) {
+    return (double) result->counters.values[event] / ((double) frames * repetitions);
+}
+
+static double per_million(const Result *result, PmcEvent event) {
+    return 1e6 * result->counters.values[event] / result->counted_instructions;
+}
+
+/* Host instructions per host cycle; 0 if either is missing. */
+static double ipc(const Result *result) {
+    const PmcValues *counters = &result->counters;
+    if (!counters->available[PMC_CYCLES] || !counters->available[PMC_INSTRUCTIONS] ||
+            counters->values[PMC_CYCLES] == 0) {
+        return 0.0;
+    }
+    return (double) counters->values[PMC_INSTRUCTIONS] / counters->values[PMC_CYCLES];
+}
+
+static void print_counters(const Result *result, int frames, int repetitions) {
+    printf("%-41s IPC ", "");
+    if (ipc(result) > 0.0) {
+        printf("%.2f", ipc(result));
+    }
+    else {
+        printf("-");
+    }
+
+    for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+        if (result->counters.available[i]) {
+            printf(", %s %.0f/frame %.0f/Minstr", pmc_get_name(i),
+                per_frame(result, i, frames, repetitions), per_million(result, i));
+        }
+        else {
+            printf(", %s -", pmc_get_name(i));
+        }
+    }
+    printf("\n");
+}
+
+static void print_json(FILE *file, const Entry *entry, const char *config,
+        const bool *enabled, const Result *result, int frames, int repetitions,
+        bool counters, bool first) {
+    double fps = frames / result->seconds;
+    fprintf(file, "%s    {\"rom\": \"%s\", \"movie\": \"%s\", \"config\": \"%s\", \"fast_paths\": {",
+        first ? "" : ",\n", entry->rom, entry->movie, config);
+    for (int i = 0; i < NUM_FAST_PATHS; i++) {
+        fprintf(file, "%s\"%s\": %s", i > 0 ? ", " : "", crp_get_fast_path_name(i),
+            enabled[i] ? "true" : "false");
+    }
+    fprintf(file, "}, \"frames_per_s\": %.2f, \"instructions_per_s\": %.0f, "
+        "\"dots_per_s\": %.0f, \"realtime\": %.3f, \"frame_us_median\": %.2f, "
+        "\"frame_us_p99\": %.2f, \"state_hash\": \"%016llx\", \"desync\": %s",
+        fps, result->instructions / result->seconds, 3.0 * result->cycles / result->seconds,
+        fps / NES_FRAME_RATE, result->frame_us_median, result->frame_us_p99,
+        result->state_hash, result->desync ? "true" : "false");
+
+    if (counters) {
+        /* Missing counters are null. */
+        fprintf(file, ", \"counters\": {");
+        for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+            fprintf(file, "%s\"%s\": ", i > 0 ? ", " : "", pmc_get_name(i));
+            if (result->counters.available[i]) {
+                fprintf(file, "{\"per_frame\": %.1f, \"per_million_instructions\": %.1f}",
+                    per_frame(result, i, frames, repetitions), per_million(result, i));
+            }
+            else {
+                fprintf(file, "null");
+            }
+        }
+        if (ipc(result) > 0.0) {
+            fprintf(file, ", \"ipc\": %.3f}", ipc(result));
+        }
+        else {
+            fprintf(file, ", \"ipc\": null}");
+        }
+    }
+    fprintf(file, "}");
+}
+
+int main(int argc, char *argv[]) {
+    int frames = DEFAULT_FRAMES;
+    int warmup = DEFAULT_WARMUP;
+    int repetitions = DEFAULT_REPETITIONS;
+    bool isolate = false;
+    bool counters = false;
+    char *json = NULL;
+
+    static Entry entries[MAX_ENTRIES];
+    int num_entries = 0;
+
+    bool enabled[NUM_FAST_PATHS];
+    for (int i = 0; i < NUM_FAST_PATHS; i++) {
+        enabled[i] = crp_get_fast_path_default(i);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && has_value) {
+            warmup = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--repetitions") == 0 && has_value) {
+            repetitions = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0 && has_value) {
+            json = argv[++i];
+        }
+        else if (strcmp(argv[i], "--corpus") == 0 && has_value) {
+            if ((num_entries = crp_read(argv[++i], entries, num_entries)) < 0) {
+                return 1;
+            }
+        }
+        else if ((strcmp(argv[i], "--enable") == 0 || strcmp(argv[i], "--disable") == 0) && has_value) {
+            int fast_path = crp_find_fast_path(argv[i + 1]);
+            if (fast_path < 0) {
+                return 1;
+            }
+            enabled[fast_path] = strcmp(argv[i], "--enable") == 0;
+            i++;
+        }
+        else if (strcmp(argv[i], "--isolate") == 0) {
+            isolate = true;
+        }
+        else if (strcmp(argv[i], "--counters") == 0) {
+            counters = true;
+        }
+        else if (num_entries < MAX_ENTRIES) {
+            snprintf(entries[num_entries].rom, sizeof(entries[num_entries].rom), "%s", argv[i]);
+            entries[num_entries++].movie[0] = '\0';
+        }
+    }
+
+    if (num_entries == 0 || frames <= 0 || warmup < 0 || repetitions <= 0) {
+        printf("Usage: ./nes_bench [--frames <n>] [--warmup <n>] [--repetitions <n>] [--json <path>]\n"
+               "                   [--enable <fast path>] [--disable <fast path>] [--isolate] [--counters]\n"
+               "                   [--corpus <file>] [<path-to-rom>...]\n");
+        printf("Fast paths:");
+        for (int i = 0; i < NUM_FAST_PATHS; i++) {
+            printf(" %s", crp_get_fast_path_name(i));
+        }
+        printf("\n");
+        return 1;
+    }
+
+    FILE *out = NULL;
+    if (json != NULL) {
+        if ((out = fopen(json, "w")) == NULL) {
+            printf("Failed to open %s for writing.\n", json);
+            return 1;
+        }
+        fprintf(out, "{\"frames\": %d, \"warmup\": %d, \"repetitions\": %d, \"results\": [\n",
+            frames, warmup, repetitions);
+    }
+
+    printf("%-20s %-20s %9s %13s %13s %8s %9s %9s %8s\n", "rom", "config", "frames/s",
+        "instr/s", "dots/s", "realtime", "median us", "p99 us", "gain");
+
+    bool success = true;
+    bool first = true;
+    bool warned = false;
+    for (int i = 0; i < num_entries; i++) {
+        double baseline = 0.0;
+        unsigned long long baseline_hash = 0;
+
+        /* The baseline, then every fast path switched on its own. */
+        for (int flipped = -1; flipped < (isolate ? NUM_FAST_PATHS : 0); flipped++) {
+            bool config[NUM_FAST_PATHS];
+            memcpy(config, enabled, sizeof(config));
+            if (flipped >= 0) {
+                config[flipped] = !config[flipped];
+            }
+
+            char name[64];
+            config_name(name, sizeof(name), flipped, config);
+
+            Result result;
+            if (!run_child(&entries[i], config, frames, warmup, repetitions, counters, &result)) {
+                printf("%-20s %-20s failed\n", crp_base_name(entries[i].rom), name);
+                success = false;
+                break;
+            }
+
+            /* Fast paths must not change what is emulated. */
+            double fps = frames / result.seconds;
+            if (flipped < 0) {
+                baseline = fps;
+                baseline_hash = result.state_hash;
+            }
+            if (result.desync || result.state_hash != baseline_hash) {
+                printf("%-20s %-20s ran to another state (frame %d)\n",
+                    crp_base_name(entries[i].rom), name,
+                    result.desync ? result.desync_frame : warmup + frames);
+                success = false;
+            }
+
+            /* The gain is the speed-up the fast path gives. */
+            double gain = flipped < 0 ? 1.0 : config[flipped] ? fps / baseline : baseline / fps;
+            printf("%-20s %-20s %9.1f %13.0f %13.0f %7.2fx %9.1f %9.1f %7.3fx\n",
+                crp_base_name(entries[i].rom), name, fps, result.instructions / result.seconds,
+                3.0 * result.cycles / result.seconds, fps / NES_FRAME_RATE,
+                result.frame_us_median, result.frame_us_p99, gain);
+
+            if (counters && !has_counters(&result) && !warned) {
+                printf("Hardware counters are unavailable (see /proc/sys/kernel/perf_event_paranoid).\n");
+                warned = true;
+            }
+            else if (counters && has_counters(&result)) {
+                print_counters(&result, frames, repetitions);
+            }
+
+            if (out != NULL) {
+                print_json(out, &entries[i], name, config, &result, frames, repetitions,
+                    counters, first);
+                first = false;
+            }
+        }
+    }
+
+    if (out != NULL) {
+        fprintf(out, "\n]}\n");
+        fclose(out);
+    }
+    return success ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+/* -----------------------------------------------------------------
+ * Clone benchmark: branches a running machine into a pool of clones and
+ * swaps them back in, as a tree search would, and reports clones per
+ * second. Also checks that clones run deterministically and do not affect
+ * each other.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/common.h"
+#include "../../include/controller.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../include/harness.h"
+
+#define DEFAULT_CLONES 1000000
+#define WARMUP_FRAMES  60
+#define POOL_SIZE      64
+#define BRANCH_FRAMES  10
+
+/* Run the current machine with a button held down. */
+static void run_branch(int button) {
+    nes_controller1_set(button, true);
+    hrn_run_frames(BRANCH_FRAMES);
+    nes_controller1_set(button, false);
+}
+
+/* Branch a root into two clones that take different inputs, then replay
+ * the first branch from the root: it must end in the same state, and the
+ * root must be untouched. */
+static bool check_clones(Machine *root, Machine *pool[]) {
+    nes_clone(pool[0], root);
+
+    nes_clone(&machine, root);
+    run_branch(BUTTON_A);
+    nes_clone(pool[1], &machine);
+
+    nes_clone(&machine, root);
+    run_branch(BUTTON_START);
+    nes_clone(pool[2], &machine);
+
+    nes_clone(&machine, root);
+    run_branch(BUTTON_A);
+
+    return memcmp(&machine, pool[1], sizeof(Machine)) == 0 &&
+        memcmp(root, pool[0], sizeof(Machine)) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int clones = DEFAULT_CLONES;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--clones") == 0) {
+        clones = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc) {
+        printf("Usage: ./nes_clone_bench [--clones <n>] <path-to-rom>\n");
+        return 1;
+    }
+    if (!hrn_load_rom(argv[first])) {
+        printf("Failed to load ROM %s.\n", argv[first]);
+        return 1;
+    }
+
+    cpu_init();
+    nes_init();
+    hrn_run_frames(WARMUP_FRAMES);
+
+    Machine *root = nes_alloc_machine();
+    Machine *pool[POOL_SIZE];
+    for (int i = 0; i < POOL_SIZE; i++) {
+        pool[i] = nes_alloc_machine();
+    }
+    nes_clone(root, &machine);
+
+    if (!check_clones(root, pool)) {
+        printf("Clones are not deterministic or not independent.\n");
+        return 1;
+    }
+    nes_clone(&machine, root);
+
+    /* Branch: copy the running machine into the pool. */
+    double start = hrn_now();
+    for (int i = 0; i < clones; i++) {
+        nes_clone(pool[i % POOL_SIZE], &machine);
+    }
+    double branch = hrn_now() - start;
+
+    /* Swap: make a clone the running machine. */
+    start = hrn_now();
+    for (int i = 0; i < clones; i++) {
+        nes_clone(&machine, pool[i % POOL_SIZE]);
+    }
+    double swap = hrn_now() - start;
+
+    printf("machine size %zu bytes\n", sizeof(Machine));
+    printf("%-8s %14s %10s\n", "", "clones/s", "ns/clone");
+    printf("%-8s %14.0f %10.1f\n", "branch", clones / branch, 1e9 * branch / clones);
+    printf("%-8s %14.0f %10.1f\n", "swap", clones / swap, 1e9 * swap / clones);
+
+    for (int i = 0; i < POOL_SIZE; i++) {
+        nes_free_machine(pool[i]);
+    }
+    nes_free_machine(root);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/* -----------------------------------------------------------------
+ * Corpus files and fast path switches of nes_bench and nes_lockstep.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <string.h>
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/cpu_blocks.h"
+#include "../../include/nes.h"
+#include "../../include/render.h"
+#include "../include/corpus.h"
+
+static void set_superinstructions(bool enabled) {
+    cpu_set_superinstructions(enabled);
+}
+
+static void set_blocks(bool enabled) {
+    if (enabled) {
+        blk_open(NULL, nes_get_rom_hash());
+    }
+    else {
+        blk_close();
+    }
+}
+
+static void set_aot(bool enabled) {
+    cpu_set_aot(enabled);
+}
+
+static void set_deferred(bool enabled) {
+    if (enabled) {
+        rdr_enable();
+    }
+    else {
+        rdr_disable();
+    }
+}
+
+typedef struct {
+    const char *name;
+    bool enabled;
+    void (*set)(bool enabled);
+} FastPath;
+
+static const FastPath fast_paths[NUM_FAST_PATHS] = {
+    { "superinstructions", false, set_superinstructions },
+    { "blocks",            false, set_blocks },
+    { "aot",               true,  set_aot },
+    { "deferred",          false, set_deferred },
+};
+
+int crp_read(const char *path, Entry *entries, int count) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open corpus %s.\n", path);
+        return -1;
+    }
+
+    const char *slash = strrchr(path, '/');
+    int directory = slash != NULL ? (int) (slash - path + 1) : 0;
+
+    char line[1024], rom[512], movie[512];
+    while (fgets(line, sizeof(line), file) != NULL && count < MAX_ENTRIES) {
+        int fields = sscanf(line, "%511s %511s", rom, movie);
+        if (fields < 1 || rom[0] == '#') {
+            continue;
+        }
+
+        Entry *entry = &entries[count++];
+        snprintf(entry->rom, sizeof(entry->rom), "%.*s%s", directory, path, rom);
+        entry->movie[0] = '\0';
+        if (fields > 1) {
+            snprintf(entry->movie, sizeof(entry->movie), "%.*s%s", directory, path, movie);
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+const char *crp_base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+int crp_find_fast_path(const char *name) {
+    for (int i = 0; i < NUM_FAST_PATHS; i++) {
+        if (strcmp(fast_paths[i].name, name) == 0) {
+            return i;
+        }
+    }
+    fprintf(stderr, "Unknown fast path %s.\n", name);
+    return -1;
+}
+
+const char *crp_get_fast_path_name(int fast_path) {
+    return fast_paths[fast_path].name;
+}
+
+bool crp_get_fast_path_default(int fast_path) {
+    return fast_paths[fast_path].enabled;
+}
+
+void crp_set_fast_paths(const bool *enabled) {
+    for (int i = 0; i < NUM_FAST_PATHS; i++) {
+        fast_paths[i].set(enabled[i]);
+    }
+}
@@ -0,0 +1,176 @@
+/* -----------------------------------------------------------------
+ * Flags benchmark: the lazy flag engine against the plain bit engine
+ * of cpu_flags.h, on ADC/SBC, CMP/branch and loop/status kernels. The
+ * plain bit engine is inlined into the kernels as into the CPU; the lazy
+ * engine is called out of line, as the CPU called it.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../include/common.h"
+#include "../../include/cpu_flags.h"
+#include "../include/flags_lazy.h"
+
+#define NUM_OPERANDS (1 << 22)
+#define REPETITIONS  5
+
+/* Lazy flag engine. */
+
+#define KERNEL(name)            lazy_##name
+#define IS_C()                  lazy_is_C()
+#define IS_Z()                  lazy_is_Z()
+#define IS_N()                  lazy_is_N()
+#define UPDATE_ZN(value)        lazy_update_ZN(value)
+#define UPDATE_C_ADD(result)    lazy_update_C(result, LAZY_ADC)
+#define UPDATE_C_CMP(a, b)      lazy_update_C((a) - (b), LAZY_CMP)
+#define UPDATE_V(s, a, b)       lazy_update_V(s, a, b)
+#define GET_STATUS(B)           lazy_get_status(B)
+#define SET_STATUS(status)      lazy_set_status(status)
+
+#include "../include/flags_kernels.h"
+
+#undef KERNEL
+#undef IS_C
+#undef IS_Z
+#undef IS_N
+#undef UPDATE_ZN
+#undef UPDATE_C_ADD
+#undef UPDATE_C_CMP
+#undef UPDATE_V
+#undef GET_STATUS
+#undef SET_STATUS
+
+/* Plain bit flag engine (cpu_flags.h). */
+
+#define KERNEL(name)            flg_##name
+#define IS_C()                  flg_is_C()
+#define IS_Z()                  flg_is_Z()
+#define IS_N()                  flg_is_N()
+#define UPDATE_ZN(value)        flg_update_ZN(value)
+#define UPDATE_C_ADD(result)    flg_update_C((result) > 0xFF)
+#define UPDATE_C_CMP(a, b)      flg_update_C((a) >= (b))
+#define UPDATE_V(s, a, b)       flg_update_V(s, a, b)
+#define GET_STATUS(B)           flg_get_status(B)
+#define SET_STATUS(status)      flg_set_status(status)
+
+#include "../include/flags_kernels.h"
+
+typedef unsigned (*Kernel)(const byte *, int);
+
+typedef struct {
+    const char *name;
+    Kernel lazy;
+    Kernel flg;
+} Benchmark;
+
+static const Benchmark BENCHMARKS[] = {
+    { "adc_sbc",     lazy_adc_sbc,     flg_adc_sbc     },
+    { "cmp_branch",  lazy_cmp_branch,  flg_cmp_branch  },
+    { "loop_status", lazy_loop_status, flg_loop_status },
+};
+
+static byte operands[NUM_OPERANDS];
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Best time per operand in nanoseconds. */
+static double measure(Kernel kernel, unsigned *checksum) {
+    double best = 1e30;
+
+    for (int i = 0; i < REPETITIONS; i++) {
+        double start = now();
+        *checksum = kernel(operands, NUM_OPERANDS);
+        double elapsed = now() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    return best * 1e9 / NUM_OPERANDS;
+}
+
+/* Check that both engines produce the same status for every ADC, SBC and
+ * CMP operand pair, with and without carry in. */
+static bool check_engines(void) {
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            for (int carry = 0; carry < 2; carry++) {
+                /* ADC (SBC is ADC with the operand inverted). */
+                for (int sbc = 0; sbc < 2; sbc++) {
+                    byte operand = sbc ? b ^ 0xFF : b;
+                    int result = a + operand + carry;
+
+                    lazy_set_status(carry);
+                    lazy_update_ZN(result);
+                    lazy_update_C (result, LAZY_ADC);
+                    lazy_update_V (result, a, operand);
+
+                    flg_set_status(carry);
+                    flg_update_ZN(result);
+                    flg_update_C (result > 0xFF);
+                    flg_update_V (result, a, operand);
+
+                    if (lazy_get_status(false) != flg_get_status(false)) {
+                        printf("Mismatch: %s A=%02X M=%02X C=%d\n",
+                            sbc ? "SBC" : "ADC", a, b, carry);
+                        return false;
+                    }
+                }
+
+                /* CMP. */
+                lazy_set_status(carry);
+                lazy_update_C (a - b, LAZY_CMP);
+                lazy_update_ZN(a - b);
+
+                flg_set_status(carry);
+                flg_update_C (a >= b);
+                flg_update_ZN(a - b);
+
+                if (lazy_get_status(false) != flg_get_status(false)) {
+                    printf("Mismatch: CMP A=%02X M=%02X\n", a, b);
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+int main(void) {
+    lazy_reset();
+    flg_reset();
+
+    if (!check_engines()) {
+        return 1;
+    }
+
+    /* Fixed operand stream (LCG), so runs are comparable. */
+    unsigned seed = 12345;
+    for (int i = 0; i < NUM_OPERANDS; i++) {
+        seed = seed * 1103515245 + 12345;
+        operands[i] = seed >> 16;
+    }
+
+    printf("%-12s %12s %12s %8s\n", "kernel", "lazy ns/op", "bits ns/op", "speedup");
+    for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+        unsigned lazy_checksum, flg_checksum;
+        double lazy = measure(BENCHMARKS[i].lazy, &lazy_checksum);
+        double flg  = measure(BENCHMARKS[i].flg,  &flg_checksum);
+
+        if (lazy_checksum != flg_checksum) {
+            printf("Mismatch: %s checksums differ (%08X, %08X)\n",
+                BENCHMARKS[i].name, lazy_checksum, flg_checksum);
+            return 1;
+        }
+
+        printf("%-12s %12.3f %12.3f %7.2fx\n", BENCHMARKS[i].name, lazy, flg, lazy / flg);
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/* -----------------------------------------------------------------
+ * Lazy flag engine (reference for the flags benchmark).
+ *
+ * The flag engine as it was before P was kept as plain bits: C and V are
+ * derived from the last operation that affected them, Z and N from the
+ * last result.
+ * -------------------------------------------------------------- */
+
+#include "../../include/common.h"
+#include "../include/flags_lazy.h"
+
+/* Carry flag (C). */
+
+static int C;                /* Last result that affected the C flag. */
+static LazyOperation C_type; /* Type of the last operation that affected the C flag. */
+
+inline bool lazy_is_C   (void) {
+    switch (C_type) {
+        case LAZY_ADC:   return C & 0xF00;
+        case LAZY_CMP:   return C >= 0;
+        case LAZY_ROL:   return C & 0x80;
+        case LAZY_ROR:   return C & 0x01;
+        default:       return false;
+    }
+}
+
+inline void lazy_set_C  (void) { C = 0x80; C_type = LAZY_ROL; }
+inline void lazy_clear_C(void) { C = 0x00; C_type = LAZY_ROL; }
+inline void lazy_update_C(int result, LazyOperation type) { C = result; C_type = type; }
+
+/* Zero flag (Z) and negative flag (N). */
+
+static byte Z;  /* Last result that affected the Z flag. */
+static byte N;  /* Last result that affected the N flag. */
+
+inline bool lazy_is_Z   (void) { return !Z; }
+inline bool lazy_is_N   (void) { return N & 0x80; }
+inline void lazy_set_Z  (void) { Z = 0x00; }
+inline void lazy_set_N  (void) { N = 0x80; }
+inline void lazy_clear_Z(void) { Z = 0x01; }
+inline void lazy_clear_N(void) { N = 0x00; }
+
+inline void lazy_update_Z (byte value) { Z = value; }
+inline void lazy_update_N (byte value) { N = value; }
+inline void lazy_update_ZN(byte value) {
+    lazy_update_Z(value);
+    lazy_update_N(value);
+}
+
+/* Interrupt disable (I) and decimal mode flag (D). */
+
+static bool I;  /* Interrupt disable. */
+static bool D;  /* Decimal mode flag. */
+
+inline bool lazy_is_I   (void) { return I;  }
+inline bool lazy_is_D   (void) { return D;  }
+inline void lazy_set_I  (void) { I = true;  }
+inline void lazy_set_D  (void) { D = true;  }
+inline void lazy_clear_I(void) { I = false; }
+inline void lazy_clear_D(void) { D = false; }
+
+/* Overflow flag (V). */
+
+static byte V1, V2, V;       /* Last result and operands that affected the V flag. */
+static LazyOperation V_type; /* Type of the last operation that affected the V flag. */
+
+inline bool lazy_is_V(void) {
+    return V_type == LAZY_BIT ? V & 0x40 : ((V ^ V1) & (V ^ V2)) & 0x80;
+}
+
+inline void lazy_set_V  (void) { V = 0x40; V_type = LAZY_BIT; }
+inline void lazy_clear_V(void) { V = 0x00; V_type = LAZY_BIT; }
+
+inline void lazy_update_V_bit(byte s) { V_type = LAZY_BIT; V = s; }
+
+inline void lazy_update_V(byte s, byte a, byte b) {
+    V_type = LAZY_ADC; V = s; V1 = a; V2 = b;
+}
+
+/* Get / set processor flag status (P). */
+
+inline byte lazy_get_status(bool B) {
+    byte P = 0x00;
+    P |= lazy_is_C();
+    P |= (lazy_is_Z() << 1);
+    P |= (lazy_is_I() << 2);
+    P |= (lazy_is_D() << 3);
+    P |= (B          << 4);
+    P |= (0x01       << 5);
+    P |= (lazy_is_V() << 6);
+    P |= (lazy_is_N() << 7);
+    return P;
+}
+
+inline void lazy_set_status(byte P) {
+    if (P & 0x01) lazy_set_C(); else lazy_clear_C();
+    if (P & 0x02) lazy_set_Z(); else lazy_clear_Z();
+    if (P & 0x04) lazy_set_I(); else lazy_clear_I();
+    if (P & 0x08) lazy_set_D(); else lazy_clear_D();
+    if (P & 0x40) lazy_set_V(); else lazy_clear_V();
+    if (P & 0x80) lazy_set_N(); else lazy_clear_N();
+}
+
+/* Reset flags. */
+
+inline void lazy_reset(void) {
+    lazy_clear_C();
+    lazy_clear_Z();
+    lazy_clear_I();
+    lazy_clear_D();
+    lazy_clear_V();
+    lazy_clear_N();
+}
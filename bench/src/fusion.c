@@ -0,0 +1,117 @@
+/* -----------------------------------------------------------------
+ * Superinstruction benchmark: runs each ROM for a number of frames with
+ * and without superinstructions, and reports the dispatches saved. Each
+ * run happens in its own process, so every ROM starts from power on.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/ppu_internal.h"
+#include "../include/harness.h"
+
+#define DEFAULT_FRAMES 600
+
+typedef struct {
+    unsigned long long cycles;
+    unsigned long long instructions;
+    unsigned long long dispatches;
+    double seconds;
+} Result;
+
+static void run(const char *path, int frames, bool superinstructions, Result *result) {
+    if (!hrn_load_rom(path)) {
+        fprintf(stderr, "Failed to load ROM %s.\n", path);
+        exit(1);
+    }
+
+    cpu_init();
+    nes_init();
+    cpu_set_superinstructions(superinstructions);
+
+    double start = hrn_now();
+    while (machine.ppu.frame < frames) {
+        cpu_execute();
+        ppu_catch_up();
+    }
+
+    result->seconds      = hrn_now() - start;
+    result->cycles       = cpu_get_ticks();
+    result->instructions = cpu_get_instructions();
+    result->dispatches   = cpu_get_dispatches();
+}
+
+/* Run a ROM in a child process. */
+static bool run_child(const char *path, int frames, bool superinstructions, Result *result) {
+    int fd[2];
+    if (pipe(fd) != 0) {
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        close(fd[0]);
+        run(path, frames, superinstructions, result);
+        exit(write(fd[1], result, sizeof(Result)) == sizeof(Result) ? 0 : 1);
+    }
+
+    close(fd[1]);
+    bool success = read(fd[0], result, sizeof(Result)) == sizeof(Result);
+    close(fd[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int frames = DEFAULT_FRAMES;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--frames") == 0) {
+        frames = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc) {
+        printf("Usage: ./nes_fusion_bench [--frames <n>] <path-to-rom>...\n");
+        return 1;
+    }
+
+    printf("%-24s %14s %14s %8s %9s %9s\n",
+        "rom", "instructions", "dispatches", "saved", "plain s", "fused s");
+
+    for (int i = first; i < argc; i++) {
+        Result plain, fused;
+        if (!run_child(argv[i], frames, false, &plain) ||
+                !run_child(argv[i], frames, true, &fused)) {
+            printf("%-24s failed\n", argv[i]);
+            return 1;
+        }
+
+        /* Superinstructions must not change what is emulated. */
+        if (plain.cycles != fused.cycles || plain.instructions != fused.instructions) {
+            printf("%-24s mismatch: %llu/%llu cycles, %llu/%llu instructions\n", argv[i],
+                plain.cycles, fused.cycles, plain.instructions, fused.instructions);
+            return 1;
+        }
+
+        unsigned long long saved = fused.instructions - fused.dispatches;
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        printf("%-24s %14llu %14llu %7.2f%% %9.3f %9.3f\n", name,
+            fused.instructions, fused.dispatches, 100.0 * saved / fused.instructions,
+            plain.seconds, fused.seconds);
+    }
+
+    return 0;
+}
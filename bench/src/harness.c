@@ -0,0 +1,59 @@
+/* -----------------------------------------------------------------
+ * Benchmark and tool harness: timing, loading ROMs and running frames.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../include/harness.h"
+
+double hrn_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+byte *hrn_read_file(const char *path, long *length) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    byte *data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && (*length = ftell(file)) >= 0 &&
+            fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc(*length > 0 ? *length : 1);
+        if (data != NULL && fread(data, 1, *length, file) != *length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+bool hrn_load_rom(const char *path) {
+    long length;
+    byte *data = hrn_read_file(path, &length);
+    if (data == NULL) {
+        return false;
+    }
+
+    /* The cartridge keeps copies of the PRG and CHR ROM. */
+    bool success = nes_insert_cartridge(data, length);
+    free(data);
+    return success;
+}
+
+void hrn_run_frames(unsigned long long frames) {
+    unsigned long long end = machine.ppu.frame + frames;
+    while (machine.ppu.frame < end) {
+        cpu_execute();
+        ppu_catch_up();
+    }
+}
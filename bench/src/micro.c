@@ -0,0 +1,363 @@
+/* -----------------------------------------------------------------
+ * Microbenchmarks of the hot paths of the core: the dispatch loop
+ * (cpu_execute and ppu_catch_up) per guest instruction, CPU memory reads
+ * per region, VRAM reads, PPU dots per kind of scanline, sprite
+ * evaluation, OAM DMA, rewind and the mapper read callbacks. They run on a
+ * synthetic cartridge: a loop of common instructions over RAM, patterned
+ * CHR ROM and sprites spread over the screen. Each reports the median time
+ * of a number of runs per operation, in ns and in TSC cycles.
+ *
+ * Each mapper runs in its own process, as a cartridge is inserted once.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "../../include/cartridge.h"
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/memory.h"
+#include "../../include/mmc.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/ppu_internal.h"
+#include "../../include/rewind.h"
+#include "../../include/vram.h"
+#include "../include/harness.h"
+
+#define DEFAULT_OPS  1000000
+#define RUNS         5
+#define PRG_SIZE     0x8000
+#define CHR_SIZE     0x2000
+#define REWIND_SIZE  (16 << 20)     /* Rewind budget: room for every snapshot. */
+#define REWIND_LIMIT 1e6            /* Rewind over a keyframe interval, in ns. */
+
+/* The CPU loop: copy 64 bytes from 0x0200 to 0x0300, over and over. */
+static const byte PROGRAM[] = {
+    0xA2, 0x00,             /* 8000: LDX #$00 */
+    0xBD, 0x00, 0x02,       /* 8002: LDA $0200,X */
+    0x9D, 0x00, 0x03,       /* 8005: STA $0300,X */
+    0xE8,                   /* 8008: INX */
+    0xE0, 0x40,             /* 8009: CPX #$40 */
+    0xD0, 0xF5,             /* 800B: BNE $8002 */
+    0x4C, 0x00, 0x80        /* 800D: JMP $8000 */
+};
+
+static volatile byte sink;
+static long ops = DEFAULT_OPS;
+
+static unsigned long long read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Run a benchmark of n operations a number of times, and report the
+ * median time per operation. */
+static void measure(const char *name, void (*run)(long n), long n) {
+    double ns[RUNS], cycles[RUNS];
+
+    run(n / 10);
+    for (int i = 0; i < RUNS; i++) {
+        double start = hrn_now();
+        unsigned long long start_cycles = read_cycles();
+        run(n);
+        cycles[i] = (double) (read_cycles() - start_cycles) / n;
+        ns[i] = 1e9 * (hrn_now() - start) / n;
+    }
+
+    qsort(ns, RUNS, sizeof(double), compare_doubles);
+    qsort(cycles, RUNS, sizeof(double), compare_doubles);
+    if (cycles[RUNS / 2] > 0.0) {
+        printf("%-40s %10.2f %10.1f\n", name, ns[RUNS / 2], cycles[RUNS / 2]);
+    }
+    else {
+        printf("%-40s %10.2f %10s\n", name, ns[RUNS / 2], "-");
+    }
+}
+
+/* An NROM or MMC1 cartridge with the program in both 16 KB banks. */
+static bool insert_cartridge(int mapper) {
+    static byte rom[INES_HEADER_SIZE + PRG_SIZE + CHR_SIZE];
+    memset(rom, 0, sizeof(rom));
+    memcpy(rom, "NES\x1A", 4);
+    rom[4] = PRG_SIZE / 0x4000;
+    rom[5] = CHR_SIZE / 0x2000;
+    rom[6] = (mapper & 0x0F) << 4 | 0x03;    /* Vertical mirroring, PRG RAM. */
+    rom[7] = mapper & 0xF0;
+
+    byte *prg = rom + INES_HEADER_SIZE;
+    for (int bank = 0; bank < PRG_SIZE; bank += 0x4000) {
+        memcpy(prg + bank, PROGRAM, sizeof(PROGRAM));
+        prg[bank + 0x3FFA] = 0x00; prg[bank + 0x3FFB] = 0x80;   /* NMI. */
+        prg[bank + 0x3FFC] = 0x00; prg[bank + 0x3FFD] = 0x80;   /* Reset. */
+        prg[bank + 0x3FFE] = 0x00; prg[bank + 0x3FFF] = 0x80;   /* IRQ. */
+    }
+
+    byte *chr = prg + PRG_SIZE;
+    for (int i = 0; i < CHR_SIZE; i++) {
+        chr[i] = i * 37;
+    }
+
+    if (!nes_insert_cartridge(rom, sizeof(rom))) {
+        return false;
+    }
+    cpu_init();
+    nes_init();
+
+    /* Background and sprites on, 64 sprites spread over the screen. */
+    ppu_register_write(0x2000, 0x00);
+    ppu_register_write(0x2001, 0x1E);
+    for (int i = 0; i < 64; i++) {
+        machine.ppu.oam[4 * i + 0] = (i * 37) % 232;
+        machine.ppu.oam[4 * i + 1] = i;
+        machine.ppu.oam[4 * i + 2] = i & 0xE3;
+        machine.ppu.oam[4 * i + 3] = (i * 53) % 256;
+    }
+    for (int i = 0; i < 0x800; i++) {
+        machine.ram[i] = i * 13;
+    }
+    return true;
+}
+
+/* -----------------------------------------------------------------
+ * CPU.
+ * -------------------------------------------------------------- */
+
+/* The driver loop over n guest instructions, however many dispatches run
+ * them. The PPU catches up after every dispatch, as a superinstruction
+ * catches it up between its two instructions. */
+static void run_dispatch(long n) {
+    unsigned long long end = cpu_get_instructions() + n;
+    while (cpu_get_instructions() < end) {
+        cpu_execute();
+        ppu_catch_up();
+    }
+}
+
+static void run_dispatch_fused(long n) {
+    cpu_set_superinstructions(true);
+    run_dispatch(n);
+    cpu_set_superinstructions(false);
+}
+
+static word region_start;
+static word region_mask;
+
+static void run_mem_read(long n) {
+    byte sum = 0;
+    for (long i = 0; i < n; i++) {
+        sum += mem_read(region_start + (i * 7 & region_mask));
+    }
+    sink = sum;
+}
+
+/* -----------------------------------------------------------------
+ * PPU.
+ * -------------------------------------------------------------- */
+
+static void run_vrm_read(long n) {
+    byte sum = 0;
+    for (long i = 0; i < n; i++) {
+        sum += vrm_read(region_start + (i * 7 & region_mask));
+    }
+    sink = sum;
+}
+
+static int line;
+
+/* Every op is a dot; the line starts over every 341 dots. */
+static void run_ppu_line(long n) {
+    for (long i = 0; i < n; i += 341) {
+        machine.ppu.scanline = line;
+        machine.ppu.dot = 0;
+        for (int dot = 0; dot < 341; dot++) {
+            ppu_step();
+        }
+    }
+    machine.nmi = false;
+}
+
+static void run_ppu_line_none(long n) {
+    render_mode = RENDER_NONE;
+    run_ppu_line(n);
+    render_mode = RENDER_INLINE;
+}
+
+/* Dot 257 of a visible line evaluates the sprites of the next line. */
+static void run_sprite_evaluation(long n) {
+    for (long i = 0; i < n; i++) {
+        machine.ppu.scanline = 100 + (i & 63);
+        machine.ppu.dot = 257;
+        ppu_step();
+    }
+}
+
+static byte dma_page;
+
+static void run_dma(long n) {
+    for (long i = 0; i < n; i++) {
+        /* Leave out catching up the cycles of the last transfer. */
+        machine.ppu_ticks = cpu_get_ticks();
+        ppu_dma_write(dma_page);
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Rewind.
+ * -------------------------------------------------------------- */
+
+/* Step back through a whole keyframe interval of snapshots, a frame apart:
+ * the keyframe and every delta against it are decoded once. Reports the
+ * median time per step and per interval, which must stay under
+ * REWIND_LIMIT. */
+static void measure_rewind(void) {
+    double ns[RUNS], cycles[RUNS];
+
+    for (int i = 0; i < RUNS; i++) {
+        rwd_init(REWIND_SIZE, 1);
+        for (int frame = 0; frame < REWIND_KEYFRAME_INTERVAL; frame++) {
+            hrn_run_frames(1);
+            rwd_push();
+        }
+
+        double start = hrn_now();
+        unsigned long long start_cycles = read_cycles();
+        while (rwd_step_back()) {
+        }
+        cycles[i] = (double) (read_cycles() - start_cycles);
+        ns[i] = 1e9 * (hrn_now() - start);
+        rwd_free();
+    }
+
+    qsort(ns, RUNS, sizeof(double), compare_doubles);
+    qsort(cycles, RUNS, sizeof(double), compare_doubles);
+    printf("%-40s %10.2f %10.1f\n", "rwd_step_back",
+        ns[RUNS / 2] / REWIND_KEYFRAME_INTERVAL, cycles[RUNS / 2] / REWIND_KEYFRAME_INTERVAL);
+    printf("%-40s %10.2f %10.1f%s\n", "rewind over a keyframe interval", ns[RUNS / 2],
+        cycles[RUNS / 2], ns[RUNS / 2] > REWIND_LIMIT ? "  over 1 ms" : "");
+}
+
+/* -----------------------------------------------------------------
+ * Mappers.
+ * -------------------------------------------------------------- */
+
+static void run_mmc_cpu_read(long n) {
+    byte sum = 0;
+    for (long i = 0; i < n; i++) {
+        sum += mmc_cpu_read(region_start + (i * 7 & region_mask));
+    }
+    sink = sum;
+}
+
+static void run_mmc_ppu_read(long n) {
+    byte sum = 0;
+    for (long i = 0; i < n; i++) {
+        sum += mmc_ppu_read(i * 7 & 0x1FFF);
+    }
+    sink = sum;
+}
+
+static void measure_region(const char *name, void (*run)(long n), word start, word mask) {
+    region_start = start;
+    region_mask = mask;
+    measure(name, run, ops);
+}
+
+static void measure_line(const char *name, void (*run)(long n), int scanline) {
+    line = scanline;
+    measure(name, run, ops);
+}
+
+static void run_benchmarks(int mapper, bool all) {
+    if (!insert_cartridge(mapper)) {
+        printf("Failed to insert a cartridge with mapper %d.\n", mapper);
+        exit(1);
+    }
+
+    char name[64];
+    if (all) {
+        measure("dispatch loop per instruction", run_dispatch, ops);
+        measure("dispatch loop (superinstructions)", run_dispatch_fused, ops);
+
+        measure_region("mem_read RAM", run_mem_read, 0x0000, 0x1FFF);
+        measure_region("mem_read PPU registers", run_mem_read, 0x2000, 0x1FFF);
+        measure_region("mem_read APU and I/O", run_mem_read, 0x4000, 0x001F);
+        measure_region("mem_read PRG RAM", run_mem_read, 0x6000, 0x1FFF);
+        measure_region("mem_read PRG ROM", run_mem_read, 0x8000, 0x7FFF);
+
+        measure_region("vrm_read pattern tables", run_vrm_read, 0x0000, 0x1FFF);
+        measure_region("vrm_read nametables", run_vrm_read, 0x2000, 0x0FFF);
+        measure_region("vrm_read palette", run_vrm_read, 0x3F00, 0x001F);
+
+        measure_line("ppu_step visible line", run_ppu_line, 100);
+        measure_line("ppu_step visible line (no pixels)", run_ppu_line_none, 100);
+        measure_line("ppu_step pre-render line", run_ppu_line, -1);
+        measure_line("ppu_step post-render line", run_ppu_line, 240);
+        measure_line("ppu_step vblank line", run_ppu_line, 250);
+        measure("ppu_step dot 257 (sprite evaluation)", run_sprite_evaluation, ops);
+
+        dma_page = 0x02;
+        measure("ppu_dma_write RAM page", run_dma, ops / 100);
+        dma_page = 0x80;
+        measure("ppu_dma_write PRG ROM page", run_dma, ops / 100);
+        dma_page = 0x60;
+        measure("ppu_dma_write PRG RAM page", run_dma, ops / 100);
+
+        measure_rewind();
+    }
+
+    snprintf(name, sizeof(name), "mapper %03d cpu_read PRG ROM", mapper);
+    measure_region(name, run_mmc_cpu_read, 0x8000, 0x7FFF);
+    snprintf(name, sizeof(name), "mapper %03d cpu_read PRG RAM", mapper);
+    measure_region(name, run_mmc_cpu_read, 0x6000, 0x1FFF);
+    snprintf(name, sizeof(name), "mapper %03d ppu_read", mapper);
+    measure(name, run_mmc_ppu_read, ops);
+}
+
+/* Run the benchmarks of a mapper in a child process. */
+static bool run_child(int mapper, bool all) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        run_benchmarks(mapper, all);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], "--ops") == 0) {
+        ops = atol(argv[2]);
+    }
+    else if (argc > 1) {
+        printf("Usage: ./nes_micro_bench [--ops <n>]\n");
+        return 1;
+    }
+    if (ops < 1000) {
+        ops = 1000;
+    }
+
+    printf("%-40s %10s %10s\n", "benchmark", "ns/op", "cycles/op");
+    return run_child(0, true) && run_child(1, false) ? 0 : 1;
+}
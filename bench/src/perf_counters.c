@@ -0,0 +1,130 @@
+/* -----------------------------------------------------------------
+ * Hardware performance counters.
+ *
+ * Every event is opened as a counter of its own rather than as a group,
+ * so that one the CPU lacks (e.g. LLC misses under a hypervisor) does not
+ * take the others down. When the kernel multiplexes counters, the values
+ * are scaled up by the time they were enabled over the time they ran.
+ * Outside Linux no counter is available.
+ * -------------------------------------------------------------- */
+
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "../../include/common.h"
+#include "../include/perf_counters.h"
+
+static const char *NAMES[NUM_PMC_EVENTS] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"
+};
+
+static int fds[NUM_PMC_EVENTS] = { -1, -1, -1, -1, -1 };
+
+#ifdef __linux__
+
+typedef struct {
+    __u32 type;
+    __u64 config;
+} EventConfig;
+
+#define CACHE_MISS(cache) \
+    ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static const EventConfig EVENTS[NUM_PMC_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+};
+
+static int open_event(PmcEvent event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = EVENTS[event].type;
+    attr.config = EVENTS[event].config;
+    attr.disabled = 1;
+    attr.inherit = 1;               /* Count the render worker as well. */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+bool pmc_open(void) {
+    bool any = false;
+    for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+        if (fds[i] < 0) {
+            fds[i] = open_event(i);
+        }
+        any |= fds[i] >= 0;
+    }
+    return any;
+}
+
+void pmc_start(void) {
+    for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void pmc_stop(PmcValues *values) {
+    for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+        /* The value, the time enabled and the time running. */
+        unsigned long long data[3];
+        values->available[i] = fds[i] >= 0 &&
+            read(fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0;
+        values->values[i] = 0;
+        if (values->available[i]) {
+            values->values[i] = data[2] < data[1] ?
+                (unsigned long long) ((double) data[0] * data[1] / data[2]) : data[0];
+        }
+    }
+}
+
+#else
+
+bool pmc_open(void) {
+    return false;
+}
+
+void pmc_start(void) {
+}
+
+void pmc_stop(PmcValues *values) {
+    memset(values, 0, sizeof(*values));
+}
+
+#endif
+
+void pmc_close(void) {
+    for (int i = 0; i < NUM_PMC_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+bool pmc_is_available(PmcEvent event) {
+    return fds[event] >= 0;
+}
+
+const char *pmc_get_name(PmcEvent event) {
+    return NAMES[event];
+}
@@ -0,0 +1,141 @@
+/* -----------------------------------------------------------------
+ * State store benchmark: explores a ROM with random input, storing a state
+ * every frame, and reports the footprint per state and the time to store
+ * and load one. Stored states are checked against the state hash, also
+ * after removing some, reopening the store file and storing more.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/common.h"
+#include "../../include/controller.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/state_store.h"
+#include "../include/harness.h"
+
+#define DEFAULT_STATES 10000
+
+/* Check that every stored state loads back to the state it was. */
+static bool check_states(int *ids, unsigned long long *hashes, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!sts_get(ids[i]) || nes_state_hash() != hashes[i]) {
+            printf("State %d does not load back.\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int count = DEFAULT_STATES;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--states") == 0) {
+        count = atoi(argv[2]);
+        first = 3;
+    }
+    if (first + 1 >= argc) {
+        printf("Usage: ./nes_store_bench [--states <n>] <path-to-store> <path-to-rom>\n");
+        return 1;
+    }
+    const char *path = argv[first];
+    remove(path);
+
+    if (!hrn_load_rom(argv[first + 1])) {
+        printf("Failed to load ROM %s.\n", argv[first + 1]);
+        return 1;
+    }
+    cpu_init();
+    nes_init();
+
+    if (!sts_open(path)) {
+        printf("Failed to open state store %s.\n", path);
+        return 1;
+    }
+
+    int *ids = malloc(count * sizeof(int));
+    unsigned long long *hashes = malloc(count * sizeof(unsigned long long));
+
+    /* Explore: hold a random button for each frame, and store the state. */
+    srand(1);
+    double put_time = 0.0;
+    for (int i = 0; i < count; i++) {
+        int button = rand() % NUM_BUTTONS;
+        nes_controller1_set(button, true);
+        hrn_run_frames(1);
+        nes_controller1_set(button, false);
+
+        hashes[i] = nes_state_hash();
+        double start = hrn_now();
+        ids[i] = sts_put();
+        put_time += hrn_now() - start;
+        if (ids[i] < 0) {
+            printf("Failed to store state %d.\n", i);
+            return 1;
+        }
+    }
+
+    double start = hrn_now();
+    if (!check_states(ids, hashes, count)) {
+        return 1;
+    }
+    double get_time = hrn_now() - start;
+
+    StoreStats stats = sts_get_stats();
+    printf("states %d, state size %zu bytes, unique chunks %d, file %zu bytes\n",
+        stats.states, nes_state_size(), stats.chunks, stats.file_size);
+    printf("footprint %.0f bytes/state (%.1fx smaller)\n",
+        stats.bytes_per_state, nes_state_size() / stats.bytes_per_state);
+    printf("put %.2f us, get %.2f us\n", 1e6 * put_time / count, 1e6 * get_time / count);
+
+    /* Drop every other state, and reopen the store. */
+    for (int i = 0; i < count; i += 2) {
+        sts_remove(ids[i]);
+    }
+    sts_close();
+    if (!sts_open(path)) {
+        printf("Failed to reopen state store %s.\n", path);
+        return 1;
+    }
+    for (int i = 1, j = 0; i < count; i += 2, j++) {
+        ids[j] = ids[i];
+        hashes[j] = hashes[i];
+    }
+    if (!check_states(ids, hashes, count / 2)) {
+        return 1;
+    }
+    stats = sts_get_stats();
+    if (stats.states != count / 2) {
+        printf("Reopened store has %d states instead of %d.\n", stats.states, count / 2);
+        return 1;
+    }
+    printf("after removing half: states %d, unique chunks %d\n", stats.states, stats.chunks);
+
+    /* Explore on, storing states into the freed slots. */
+    int kept = count / 2;
+    for (int i = kept; i < 2 * kept; i++) {
+        int button = rand() % NUM_BUTTONS;
+        nes_controller1_set(button, true);
+        hrn_run_frames(1);
+        nes_controller1_set(button, false);
+
+        hashes[i] = nes_state_hash();
+        ids[i] = sts_put();
+        if (ids[i] < 0) {
+            printf("Failed to store state %d.\n", i);
+            return 1;
+        }
+    }
+    if (!check_states(ids, hashes, 2 * kept)) {
+        return 1;
+    }
+    stats = sts_get_stats();
+    printf("after storing %d more: states %d, unique chunks %d\n", kept, stats.states, stats.chunks);
+
+    sts_close();
+    return 0;
+}
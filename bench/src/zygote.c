@@ -0,0 +1,120 @@
+/* -----------------------------------------------------------------
+ * Zygote benchmark: compares the cold start of a worker (loading the ROM,
+ * building the CPU tables and running the power-on frames) to spawning one
+ * from a zygote, and checks that every worker starts from the warm state.
+ * -------------------------------------------------------------- */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/zygote.h"
+#include "../include/harness.h"
+
+#define DEFAULT_WORKERS 1000
+#define WARMUP_FRAMES   60
+#define SOCKET_PATH     "/tmp/nes_zygote_bench.sock"
+
+/* Send the state hash, and wait for the client to hang up. */
+static int send_hash(int connection) {
+    unsigned long long hash = nes_state_hash();
+    if (write(connection, &hash, sizeof(hash)) != sizeof(hash)) {
+        return 1;
+    }
+
+    byte data;
+    while (read(connection, &data, 1) > 0);
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    int workers = DEFAULT_WORKERS;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "--workers") == 0) {
+        workers = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || workers <= 0) {
+        printf("Usage: ./nes_zygote_bench [--workers <n>] <path-to-rom>\n");
+        return 1;
+    }
+
+    /* Cold start, without the cost of starting the process itself. */
+    double start = hrn_now();
+    if (!hrn_load_rom(argv[first])) {
+        printf("Failed to load ROM %s.\n", argv[first]);
+        return 1;
+    }
+    cpu_init();
+    nes_init();
+    hrn_run_frames(WARMUP_FRAMES);
+    double cold = hrn_now() - start;
+    unsigned long long hash = nes_state_hash();
+
+    fflush(NULL);
+    pid_t zygote = fork();
+    if (zygote == 0) {
+        zyg_serve(SOCKET_PATH, send_hash);
+        _exit(1);
+    }
+
+    /* Wait for the zygote to listen. */
+    int connection = -1;
+    for (int i = 0; i < 1000 && connection < 0; i++) {
+        connection = zyg_spawn(SOCKET_PATH);
+        if (connection < 0) {
+            usleep(1000);
+        }
+    }
+    if (connection < 0) {
+        printf("Failed to connect to the zygote.\n");
+        kill(zygote, SIGTERM);
+        return 1;
+    }
+    close(connection);
+
+    double *latencies = malloc(workers * sizeof(double));
+    bool success = true;
+    for (int i = 0; i < workers && success; i++) {
+        start = hrn_now();
+        connection = zyg_spawn(SOCKET_PATH);
+        latencies[i] = hrn_now() - start;
+
+        unsigned long long worker_hash;
+        success = connection >= 0 &&
+            read(connection, &worker_hash, sizeof(worker_hash)) == sizeof(worker_hash) &&
+            worker_hash == hash;
+        close(connection);
+    }
+
+    kill(zygote, SIGTERM);
+    waitpid(zygote, NULL, 0);
+    unlink(SOCKET_PATH);
+
+    if (!success) {
+        printf("A worker did not start from the warm state.\n");
+        return 1;
+    }
+
+    qsort(latencies, workers, sizeof(double), compare_doubles);
+    printf("%-14s %10s\n", "", "ms/worker");
+    printf("%-14s %10.3f\n", "cold start", 1e3 * cold);
+    printf("%-14s %10.3f\n", "zygote median", 1e3 * latencies[workers / 2]);
+    printf("%-14s %10.3f\n", "zygote p99", 1e3 * latencies[workers * 99 / 100]);
+
+    free(latencies);
+    return 0;
+}
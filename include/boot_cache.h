@@ -0,0 +1,13 @@
+#ifndef BOOT_CACHE_H
+#define BOOT_CACHE_H
+
+#include "common.h"
+
+/* Bring a machine that was just powered on to the given frame, with the
+ * buttons of controller 1 held as in inputs[frame] (bit n: button n; NULL:
+ * no input). The state at that frame is cached in the directory, keyed by
+ * the ROM, the core version, the state format and the input, and loaded
+ * instead of emulated when it is there. Returns whether it was loaded. */
+bool btc_boot(const char *directory, int frames, const byte *inputs);
+
+#endif /* BOOT_CACHE_H */
@@ -10,10 +10,7 @@
 
 typedef struct Cartridge {
     byte *prg_rom;      /* PRG ROM data. */
-    byte *prg_ram;      /* PRG RAM data. */
-    byte *chr_rom;      /* CHR ROM data. */
-    byte *chr_ram;      /* CHR RAM data. */
-    byte *registers;    /* Registers. */
+    byte *chr_rom;      /* CHR ROM data (NULL: 8 KB CHR RAM). */
 
     byte mapper;        /* Mapper number. */
     byte prg_banks;     /* Number of PRG ROM banks. */
@@ -26,9 +23,11 @@ typedef struct Cartridge {
     /* Mapper functions. */
     byte (*cpu_read) (struct Cartridge*, word);
     byte (*cpu_get)  (struct Cartridge*, word);
+    byte*(*cpu_page) (struct Cartridge*, word);
     void (*cpu_write)(struct Cartridge*, word, byte);
     byte (*ppu_read) (struct Cartridge*, word);
     void (*ppu_write)(struct Cartridge*, word, byte);
+    bool (*is_valid) (struct Cartridge*);  /* Registers in range (NULL: none). */
 } Cartridge;
 
 bool cartridge_load(Cartridge *cartridge, byte *data, int length);
@@ -6,5 +6,6 @@
 
 typedef uint8_t  byte;
 typedef uint16_t word;
+typedef uint32_t dword;
 
 #endif /* COMMON_H */
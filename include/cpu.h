@@ -15,7 +15,35 @@ void cpu_execute(void);                 /* Execute the next CPU instruction. */
 void cpu_suspend(int num_cycles);       /* Suspend the cpu for some number of cycles. */     
 unsigned long long cpu_get_ticks(void); /* Get the total number of cycles run. */
 
+/* Superinstructions run common pairs of instructions by one dispatch (off
+ * until enabled). */
+void cpu_set_superinstructions(bool enabled);
+unsigned long long cpu_get_dispatches(void);   /* Instructions and interrupts dispatched. */
+unsigned long long cpu_get_instructions(void); /* Instructions and interrupts run. */
+
+/* Blocks translated by nes_aot run when they are built into the CPU. */
+void cpu_set_aot(bool enabled);
+
+/* Names of the operation and addressing mode functions of an opcode, as
+ * set in the instruction tables (e.g. "lda" and "absolute_x"). */
+const char *cpu_get_operation_name (byte opcode);
+const char *cpu_get_addressing_name(byte opcode);
+
+/* How an instruction ends a block of straight-line code, for the decoded
+ * blocks and nes_aot. */
+typedef enum {
+    BLOCK_NEXT,             /* The block goes on after the instruction. */
+    BLOCK_JUMP,             /* Branch, jump, call, return or break: the block ends. */
+    BLOCK_WRITE,            /* A write that may switch banks: the block ends. */
+    BLOCK_WRITE_ABSOLUTE,   /* The block ends if the absolute write may switch banks. */
+    BLOCK_EXCLUDE           /* The instruction is left to the interpreter. */
+} BlockKind;
+
+BlockKind cpu_get_block_kind(byte opcode);
+int cpu_get_length(byte opcode);        /* Length of an instruction in bytes. */
+
 byte cpu_ram_read (word address);
+byte *cpu_ram_page(word address);
 void cpu_ram_write(word address, byte data);
 
 #endif /* CPU_H */
@@ -0,0 +1,28 @@
+#ifndef CPU_BLOCKS_H
+#define CPU_BLOCKS_H
+
+#include "common.h"
+
+#define BLOCK_MAX_LENGTH 48         /* Maximum length of a block in bytes. */
+
+/* A decoded block: straight-line code in PRG ROM that the CPU runs without
+ * going back to the dispatcher. Blocks are stored as is in cache files. */
+typedef struct {
+    word address;                   /* CPU address of the first instruction. */
+    byte length;                    /* Length of the code in bytes. */
+    byte count;                     /* Number of instructions. */
+    dword checksum;                 /* Checksum of the other fields. */
+    byte code[BLOCK_MAX_LENGTH];    /* The code the block was decoded from. */
+} Block;
+
+/* Use decoded blocks on the calling thread, with the blocks of a cache file
+ * for the ROM with the given hash. The file is mapped read-only and may be
+ * shared by processes. */
+void blk_open(const char *path, unsigned long long rom_hash);
+void blk_close(void);               /* Write new blocks to the cache file. */
+bool blk_is_enabled(void);
+
+const Block *blk_lookup(word address);    /* Block for the code mapped at address. */
+const Block *blk_insert(Block *block);    /* Add a newly decoded block. */
+
+#endif /* CPU_BLOCKS_H */
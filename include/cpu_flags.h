@@ -2,40 +2,90 @@
 #define CPU_FLAGS_H
 
 #include "common.h"
+#include "machine.h"
 
-typedef enum { ADC, BIT, CMP, ROL, ROR, SBC } Operation;
-
-bool flg_is_C(void);
-bool flg_is_Z(void);
-bool flg_is_I(void);
-bool flg_is_D(void);
-bool flg_is_V(void);
-bool flg_is_N(void);
-
-void flg_set_C(void);
-void flg_set_Z(void);
-void flg_set_I(void);
-void flg_set_D(void);
-void flg_set_V(void);
-void flg_set_N(void);
-
-void flg_clear_C(void);
-void flg_clear_Z(void);
-void flg_clear_I(void);
-void flg_clear_D(void);
-void flg_clear_V(void);
-void flg_clear_N(void);
+/* Bits of the processor status (P). */
+#define FLAG_C 0x01
+#define FLAG_Z 0x02
+#define FLAG_I 0x04
+#define FLAG_D 0x08
+#define FLAG_B 0x10
+#define FLAG_5 0x20
+#define FLAG_V 0x40
+#define FLAG_N 0x80
+
+/* Every flag is kept as a plain bit in its own field of the machine, so
+ * updating a flag is a single store and reading a flag or the whole status
+ * register (P) never has to branch. The operations are defined here so the
+ * CPU inlines them: a call cost more than the update itself. */
 
 void flg_reset(void);
 
-void flg_update_Z (byte value);
-void flg_update_N (byte value);
-void flg_update_ZN(byte value);
-void flg_update_C (int result, Operation type);
-void flg_update_V (byte s, byte a, byte b);
-void flg_update_V_bit(byte s);
+/* Carry flag (C). */
+
+static inline bool flg_is_C   (void) { return machine.flags.C;  }
+static inline void flg_set_C  (void) { machine.flags.C = true;  }
+static inline void flg_clear_C(void) { machine.flags.C = false; }
+
+static inline void flg_update_C(bool carry) { machine.flags.C = carry; }
+
+/* Zero flag (Z) and negative flag (N). */
+
+static inline bool flg_is_Z   (void) { return machine.flags.ZN & FLAG_Z; }
+static inline bool flg_is_N   (void) { return machine.flags.ZN & FLAG_N; }
+static inline void flg_set_Z  (void) { machine.flags.ZN |=  FLAG_Z; }
+static inline void flg_set_N  (void) { machine.flags.ZN |=  FLAG_N; }
+static inline void flg_clear_Z(void) { machine.flags.ZN &= ~FLAG_Z; }
+static inline void flg_clear_N(void) { machine.flags.ZN &= ~FLAG_N; }
+
+static inline void flg_update_Z(byte value) {
+    machine.flags.ZN = (machine.flags.ZN & FLAG_N) | (value == 0 ? FLAG_Z : 0x00);
+}
+
+static inline void flg_update_N(byte value) {
+    machine.flags.ZN = (machine.flags.ZN & FLAG_Z) | (value & FLAG_N);
+}
+
+static inline void flg_update_ZN(byte value) {
+    machine.flags.ZN = (value == 0 ? FLAG_Z : 0x00) | (value & FLAG_N);
+}
+
+/* Interrupt disable (I) and decimal mode flag (D). */
+
+static inline bool flg_is_I   (void) { return machine.flags.I;  }
+static inline bool flg_is_D   (void) { return machine.flags.D;  }
+static inline void flg_set_I  (void) { machine.flags.I = true;  }
+static inline void flg_set_D  (void) { machine.flags.D = true;  }
+static inline void flg_clear_I(void) { machine.flags.I = false; }
+static inline void flg_clear_D(void) { machine.flags.D = false; }
+
+/* Overflow flag (V). */
+
+static inline bool flg_is_V   (void) { return machine.flags.V;  }
+static inline void flg_set_V  (void) { machine.flags.V = true;  }
+static inline void flg_clear_V(void) { machine.flags.V = false; }
+
+/* BIT: V is bit 6 of the operand. */
+static inline void flg_update_V_bit(byte s) { machine.flags.V = s & 0x40; }
+
+/* Overflow of s = a + b: both operands have a different sign than the result. */
+static inline void flg_update_V(byte s, byte a, byte b) {
+    machine.flags.V = (s ^ a) & (s ^ b) & 0x80;
+}
+
+/* Get / set processor flag status (P). */
+
+static inline byte flg_get_status(bool B) {
+    return machine.flags.C | machine.flags.ZN | (machine.flags.I << 2) |
+        (machine.flags.D << 3) | (B << 4) | FLAG_5 | (machine.flags.V << 6);
+}
 
-byte flg_get_status(bool B);
-void flg_set_status(byte status);
+static inline void flg_set_status(byte status) {
+    machine.flags.C  = status & FLAG_C;
+    machine.flags.ZN = status & (FLAG_Z | FLAG_N);
+    machine.flags.I  = status & FLAG_I;
+    machine.flags.D  = status & FLAG_D;
+    machine.flags.V  = status & FLAG_V;
+}
 
 #endif /* CPU_FLAGS_H */
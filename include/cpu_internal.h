@@ -6,12 +6,13 @@
 
 #define RAM_SIZE 0x800
 
-/* Micro operations. */
+/* Micro operations (on the machine of machine.h). */
 
-#define cpu_fetch() mem_read(cpu.PC++); cycles++;
-#define cpu_fetch_dummy() mem_read(cpu.PC); cycles++;
-#define cpu_read(a) mem_read(a); cycles++;
-#define cpu_write(a, d) mem_write(a, d); cycles++;
+#define cpu_fetch() mem_read(machine.cpu.PC++); machine.cycles++;
+#define cpu_fetch_dummy() cpu_read_dummy(machine.cpu.PC);
+#define cpu_read(a) mem_read(a); machine.cycles++;
+#define cpu_read_dummy(a) if (mem_has_side_effects(a)) mem_read(a); machine.cycles++;
+#define cpu_write(a, d) mem_write(a, d); machine.cycles++;
 
 word cpu_fetch_16(void);
 word cpu_read_16(word address);
@@ -31,10 +32,6 @@ typedef struct {
     byte S;              /* Stack pointer. */
     byte A;              /* Accumulator. */
     byte X, Y;           /* Index registers. */
-    byte ram[RAM_SIZE];  /* The CPU's RAM. */
 } CPU;
 
-extern CPU cpu;
-extern unsigned long long cycles;
-
 #endif /* CPU_INTERNAL_H */
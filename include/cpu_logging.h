@@ -6,6 +6,7 @@
 #define cpu_log_absolute_x_write  cpu_log_absolute_x
 #define cpu_log_absolute_y_write  cpu_log_absolute_y
 #define cpu_log_indirect_x_write  cpu_log_indirect_x
+#define cpu_log_indirect_y_write  cpu_log_indirect_y
 #define cpu_log_zero_page_write   cpu_log_zero_page
 #define cpu_log_zero_page_x_write cpu_log_zero_page_x
 #define cpu_log_zero_page_y_write cpu_log_zero_page_y
@@ -0,0 +1,120 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stddef.h>
+#include "common.h"
+#include "controller.h"
+#include "cpu_internal.h"
+#include "ppu_internal.h"
+#include "vram.h"
+
+#define CACHE_LINE_SIZE      64
+#define PRG_RAM_SIZE         0x2000
+#define CHR_RAM_SIZE         0x2000
+#define MAX_MAPPER_REGISTERS 16
+
+/* Flags of the processor status, each kept as a plain bit. */
+typedef struct {
+    bool C;                         /* Carry flag. */
+    byte ZN;                        /* Z and N flags, in their positions in P. */
+    bool I;                         /* Interrupt disable. */
+    bool D;                         /* Decimal mode flag. */
+    bool V;                         /* Overflow flag. */
+} Flags;
+
+/* All mutable state of the emulated machine, in one contiguous block. The
+ * fields the CPU touches on every instruction share the first cache line,
+ * the PPU starts on its own line with its per-dot fields first, and bulk
+ * memory follows. Cartridge ROM is not part of it, so copying the machine
+ * is enough to save or clone it. */
+typedef struct Machine {
+    /* CPU. */
+    _Alignas(CACHE_LINE_SIZE)
+    CPU cpu;                        /* CPU registers. */
+    Flags flags;                    /* Processor status flags. */
+    bool nmi;                       /* NMI interrupt pending. */
+    unsigned long long cycles;      /* Total number of CPU cycles run so far. */
+    unsigned long long ppu_ticks;   /* CPU cycles the PPU has caught up with. */
+    unsigned long long memory_hash; /* Hash of the memory (see WRITE_MEMORY). */
+
+    /* PPU. */
+    _Alignas(CACHE_LINE_SIZE)
+    PPU ppu;
+
+    /* Memory. */
+    _Alignas(CACHE_LINE_SIZE)
+    byte ram[RAM_SIZE];             /* The CPU's RAM. */
+    byte prg_ram[PRG_RAM_SIZE];     /* Cartridge PRG RAM. */
+    byte chr_ram[CHR_RAM_SIZE];     /* Cartridge CHR RAM (no CHR ROM). */
+
+    /* Cartridge and I/O. */
+    _Alignas(CACHE_LINE_SIZE)
+    byte mapper_registers[MAX_MAPPER_REGISTERS];
+    MirrorMode mirror_mode;         /* Nametable mirroring mode. */
+    Controller controller1;
+    Controller controller2;
+} Machine;
+
+/* The machine run by the current thread. */
+extern _Thread_local Machine machine;
+
+/* Dirty tracking. Every write to the machine's memory (RAM, PRG RAM, CHR
+ * RAM, nametables, palette and OAM) marks the page of DIRTY_PAGE_SIZE bytes
+ * it lands in, so incremental snapshots copy only the pages written since
+ * the last one. Registers are not tracked: the pages holding them are
+ * copied every time. */
+#define DIRTY_PAGE_SIZE 64
+#define NUM_DIRTY_PAGES ((sizeof(Machine) + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE)
+#define NUM_DIRTY_WORDS ((NUM_DIRTY_PAGES + 63) / 64)
+
+extern _Thread_local unsigned long long dirty_pages[NUM_DIRTY_WORDS];
+
+#define DIRTY_PAGE(pointer) \
+    ((size_t) ((const byte *) (pointer) - (const byte *) &machine) / DIRTY_PAGE_SIZE)
+
+/* Mark the page of a byte of the machine as written. */
+#define MARK_DIRTY(pointer) \
+    (dirty_pages[DIRTY_PAGE(pointer) / 64] |= 1ull << (DIRTY_PAGE(pointer) % 64))
+
+void mch_mark_dirty(const void *pointer, size_t size);  /* Mark a range. */
+void mch_mark_all_dirty(void);
+
+/* Memory hash. memory_hash is the XOR of a hash of every byte of memory
+ * together with its position, so a write updates it in O(1) by taking out
+ * the old byte and putting in the new one. The colors are left out: they
+ * follow from the palette. */
+static inline unsigned long long mch_byte_hash(const byte *pointer, byte value) {
+    unsigned long long hash = (pointer - (const byte *) &machine) * 0x9E3779B97F4A7C15ull ^
+        (value + 1) * 0xC2B2AE3D27D4EB4Full;
+    hash = (hash ^ (hash >> 29)) * 0xBF58476D1CE4E5B9ull;
+    return hash ^ (hash >> 32);
+}
+
+/* Write a byte of memory, updating the hash and the dirty pages. */
+#define WRITE_MEMORY(location, data) do {                               \
+        byte *location_ = &(location);                                  \
+        byte data_ = (data);                                            \
+        machine.memory_hash ^= mch_byte_hash(location_, *location_) ^   \
+            mch_byte_hash(location_, data_);                            \
+        *location_ = data_;                                             \
+        MARK_DIRTY(location_);                                          \
+    } while (0)
+
+/* Bulk writes to a range of memory go between these two calls. */
+void mch_begin_write(const void *pointer, size_t size);
+void mch_end_write(const void *pointer, size_t size);
+void mch_rehash(void);              /* Recompute the hash of all memory. */
+
+/* Copy into memory, hashing only the bytes that change. */
+void mch_write(void *destination, const void *source, size_t size);
+
+/* Update the hash after a bulk change, given the machine as it was before. */
+void mch_update_hash(const Machine *previous);
+
+/* Copy the dirty and untracked pages of the machine to a snapshot, or back
+ * from it, and clear the dirty pages. The snapshot must hold the machine
+ * as it was at the last copy. */
+void mch_copy_dirty_to  (Machine *snapshot);
+void mch_copy_dirty_from(const Machine *snapshot);
+
+#endif /* MACHINE_H */
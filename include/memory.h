@@ -5,11 +5,18 @@
 
 #define MEM_SIZE 65536
 
+/* Reads with side effects: PPUSTATUS and PPUDATA (0x2002/0x2007, mirrored
+ * up to 0x3FFF) and the controller ports (0x4016/0x4017). */
+#define mem_has_side_effects(a) \
+    ((((a) & 0xE000) == 0x2000 && (((a) & 0x7) == 2 || ((a) & 0x7) == 7)) || \
+     ((a) & 0xFFFE) == 0x4016)
+
 void mem_init(void);
 byte mem_get(word address);
 word mem_get_16(word address);
 byte mem_read(word address);
 word mem_read_16(word address);
+byte *mem_page(word address);
 void mem_write(word address, byte data);
 
 #endif /* MEMORY_H */
@@ -5,10 +5,16 @@
 #include "common.h"
 #include "nes.h"
 
+bool mmc_is_supported(byte mapper);    /* Whether mmc_init can run the mapper. */
 void mmc_init(Cartridge *cartridge_);
+void mmc_attach(Cartridge *cartridge_);
+Cartridge *mmc_clone(void);
+void mmc_free_clone(Cartridge *clone);
+bool mmc_is_valid_state(void);  /* Whether the mapper registers fit the cartridge. */
 
 byte mmc_cpu_get  (word address);
 byte mmc_cpu_read (word address);
+byte *mmc_cpu_page(word address);
 void mmc_cpu_write(word address, byte data);
 
 byte mmc_ppu_read (word address);
@@ -0,0 +1,46 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "common.h"
+
+#define KEYFRAME_INTERVAL 600     /* Frames between keyframes: 10 seconds. */
+
+/* The input of both controllers on every frame from power-on (bit n: button
+ * n), and the state hash at the end of every frame. Keyframes hold the save
+ * state at the start of every keyframe_interval-th frame, from frame 0 on. */
+typedef struct {
+    unsigned long long rom_hash;
+    int frames;
+    byte (*inputs)[2];
+    unsigned long long *hashes;     /* NULL until the movie has been played. */
+    int keyframe_interval;          /* 0: no keyframes. */
+    int keyframes;                  /* Number of keyframes taken so far. */
+    byte *states;                   /* Keyframe states of nes_state_size() bytes. */
+} Movie;
+
+/* Movies are kept in a binary format, and FM2 movies (*.fm2) can be loaded
+ * as well. */
+Movie *mov_load(const char *path);
+bool mov_save(const Movie *movie, const char *path);
+void mov_free(Movie *movie);
+
+/* Play a movie on a machine at power-on; returns the number of frames that
+ * played back to the state hash they were recorded with. A movie without
+ * hashes gets the hashes of this playback. Keyframes missing from the movie
+ * are taken along the way, to be saved with it. */
+int mov_play(Movie *movie);
+
+/* Bring the machine to the start of a frame of the movie from the last
+ * keyframe before it. Without keyframes, the machine must be at power-on. */
+bool mov_seek(Movie *movie, int frame);
+
+/* Record the machine from power-on. While recording, input set through
+ * nes_controller1_set and nes_controller2_set takes effect from the next
+ * frame on, so that it can be played back exactly. */
+bool mov_record(const char *path);
+void mov_record_frame(void);        /* Called when the frame counter changes. */
+bool mov_is_recording(void);
+void mov_set_input(int controller, int keycode, bool value);
+void mov_stop(void);                /* Write the recording. */
+
+#endif /* MOVIE_H */
@@ -1,11 +1,47 @@
 #ifndef NES_H
 #define NES_H
 
+#include <stddef.h>
 #include "../include/common.h"
 
+/* Version of the emulator core. Raise it whenever emulation changes, so that
+ * results cached from an older core are not used. */
+#define NES_VERSION 1
+
+/* Every thread runs a machine of its own, with its own cartridge. Deferred
+ * rendering, decoded blocks, rewind, run-ahead and movie recording are
+ * shared by the process, for one thread at a time. */
 void nes_init(void);
 void nes_reset(void);
 bool nes_insert_cartridge(byte *data, int length);
+void nes_eject_cartridge(void);     /* Before inserting another one on the thread. */
+unsigned long long nes_get_rom_hash(void);
+
+/* Hash of the state of the machine (memory and registers, not the time),
+ * maintained on every write and read in O(1). */
+unsigned long long nes_state_hash(void);
+
+/* Save the whole machine to a versioned binary state of nes_state_size()
+ * bytes; returns the number of bytes written (0: buffer too small). */
+dword  nes_state_version(void);
+size_t nes_state_size(void);
+size_t nes_save_state(byte *data, size_t size);
+bool nes_load_state(const byte *data, size_t size);
+
+/* Machines other than the one the current thread runs, to branch off the
+ * running machine with nes_clone and swap back in the same way. Clones share
+ * the cartridge ROM, and run independently once swapped in. */
+struct Machine;
+struct Machine *nes_alloc_machine(void);
+void nes_free_machine(struct Machine *machine);
+void nes_clone(struct Machine *dst, const struct Machine *src);
+
+/* Incremental snapshots: bring a snapshot up to date with the running
+ * machine, or the machine back to the snapshot, copying only the memory
+ * written since the last call. The first call for a snapshot copies all of
+ * it, and a snapshot must not be changed between calls. */
+void nes_snapshot(struct Machine *snapshot);
+void nes_restore(const struct Machine *snapshot);
 
 void nes_controller1_set(int keycode, bool value);
 void nes_controller2_set(int keycode, bool value);
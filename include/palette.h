@@ -1,69 +1,12 @@
-const SDL_Color PALETTE[64] = {
-    (SDL_Color) {0x75, 0x75, 0x75, 0xFF},   // 00
-    (SDL_Color) {0x27, 0x1B, 0x8F, 0xFF},   // 01
-    (SDL_Color) {0x00, 0x00, 0xAB, 0xFF},   // 02
-    (SDL_Color) {0x47, 0x00, 0x9F, 0xFF},   // 03
-    (SDL_Color) {0x8F, 0x00, 0x77, 0xFF},   // 04
-    (SDL_Color) {0xAB, 0x00, 0x13, 0xFF},   // 05
-    (SDL_Color) {0xA7, 0x00, 0x00, 0xFF},   // 06
-    (SDL_Color) {0x7F, 0x0B, 0x00, 0xFF},   // 07
-    (SDL_Color) {0x43, 0x2F, 0x00, 0xFF},   // 08
-    (SDL_Color) {0x00, 0x47, 0x00, 0xFF},   // 09
-    (SDL_Color) {0x00, 0x51, 0x00, 0xFF},   // 0A
-    (SDL_Color) {0x00, 0x3F, 0x17, 0xFF},   // 0B
-    (SDL_Color) {0x1B, 0x3F, 0x5F, 0xFF},   // 0C
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 0D
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 0E
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 0F
-    
-    (SDL_Color) {0xBC, 0xBC, 0xBC, 0xFF},   // 10
-    (SDL_Color) {0x00, 0x73, 0xEF, 0xFF},   // 11
-    (SDL_Color) {0x23, 0x3B, 0xEF, 0xFF},   // 12
-    (SDL_Color) {0x83, 0x00, 0xF3, 0xFF},   // 13
-    (SDL_Color) {0xBF, 0x00, 0xBF, 0xFF},   // 14
-    (SDL_Color) {0xE7, 0x00, 0x5B, 0xFF},   // 15
-    (SDL_Color) {0xDB, 0x2B, 0x00, 0xFF},   // 16
-    (SDL_Color) {0xCB, 0x4F, 0x0F, 0xFF},   // 17
-    (SDL_Color) {0x8B, 0x73, 0x00, 0xFF},   // 18
-    (SDL_Color) {0x00, 0x97, 0x00, 0xFF},   // 19
-    (SDL_Color) {0x00, 0xAB, 0x00, 0xFF},   // 1A
-    (SDL_Color) {0x00, 0x93, 0x3B, 0xFF},   // 1B
-    (SDL_Color) {0x00, 0x83, 0x8B, 0xFF},   // 1C
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 1D
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 1E
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 1F
+#ifndef PALETTE_H
+#define PALETTE_H
 
-    (SDL_Color) {0xFF, 0xFF, 0xFF, 0xFF},   // 20
-    (SDL_Color) {0x3F, 0xBF, 0xFF, 0xFF},   // 21
-    (SDL_Color) {0x5F, 0x97, 0xFF, 0xFF},   // 22
-    (SDL_Color) {0xA7, 0x8B, 0xFD, 0xFF},   // 23
-    (SDL_Color) {0xF7, 0x7B, 0xFF, 0xFF},   // 24
-    (SDL_Color) {0xFF, 0x77, 0xB7, 0xFF},   // 25
-    (SDL_Color) {0xFF, 0x77, 0x63, 0xFF},   // 26
-    (SDL_Color) {0xFF, 0x9B, 0x3B, 0xFF},   // 27
-    (SDL_Color) {0xF3, 0xBF, 0x3F, 0xFF},   // 28
-    (SDL_Color) {0x83, 0xD3, 0x13, 0xFF},   // 29
-    (SDL_Color) {0x4F, 0xDF, 0x4B, 0xFF},   // 2A
-    (SDL_Color) {0x58, 0xF8, 0x98, 0xFF},   // 2B
-    (SDL_Color) {0x00, 0xEB, 0xDB, 0xFF},   // 2C
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 2D
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 2E
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 2F
+#include "common.h"
 
-    (SDL_Color) {0xFF, 0xFF, 0xFF, 0xFF},   // 30
-    (SDL_Color) {0xAB, 0xE7, 0xFF, 0xFF},   // 31
-    (SDL_Color) {0xC7, 0xD7, 0xFF, 0xFF},   // 32
-    (SDL_Color) {0xD7, 0xCB, 0xFF, 0xFF},   // 33
-    (SDL_Color) {0xFF, 0xC7, 0xFF, 0xFF},   // 34
-    (SDL_Color) {0xFF, 0xC7, 0xDB, 0xFF},   // 35
-    (SDL_Color) {0xFF, 0xBF, 0xB3, 0xFF},   // 36
-    (SDL_Color) {0xFF, 0xDB, 0xAB, 0xFF},   // 37
-    (SDL_Color) {0xFF, 0xE7, 0xA3, 0xFF},   // 38
-    (SDL_Color) {0xE3, 0xFF, 0xA3, 0xFF},   // 39
-    (SDL_Color) {0xAB, 0xF3, 0xBF, 0xFF},   // 3A
-    (SDL_Color) {0xB3, 0xFF, 0xCF, 0xFF},   // 3B
-    (SDL_Color) {0x9F, 0xFF, 0xF3, 0xFF},   // 3C
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 3D
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 3E
-    (SDL_Color) {0x00, 0x00, 0x00, 0xFF},   // 3F
-};
+#define NUM_COLORS   64
+#define NUM_EMPHASIS 8
+
+void  pal_init(void);                       /* Build the color table. */
+dword pal_get_color(byte emphasis, byte color);
+
+#endif /* PALETTE_H */
@@ -21,6 +21,7 @@ void ppu_nametable_write(word address, byte data);
 
 void ppu_catch_up(void);
 
-byte ppu_get_pixel(int x, int y);
+dword ppu_get_pixel(int x, int y);
+void ppu_free_display(void);     /* Free the current thread's display. */
 
 #endif /* PPU_H */
@@ -5,9 +5,19 @@
 #define PALETTE_SIZE   32
 #define OAM_SIZE       256
 #define MAX_SPRITES    8
+#define FRAME_WIDTH    256
+#define FRAME_HEIGHT   240
 
 #include "common.h"
 
+/* Which part of the PPU work is done on the current thread. */
+typedef enum {
+    RENDER_INLINE,                  /* Step the PPU and render pixels. */
+    RENDER_DEFERRED,                /* Step the PPU and log pixel state changes. */
+    RENDER_WORKER,                  /* Replay the log and render pixels. */
+    RENDER_NONE                     /* Step the PPU only (frames nobody sees). */
+} RenderMode;
+
 typedef struct {
     byte x, y;                      /* Top-left location of the sprite. */
     byte tile;                      /* Sprite byte 1: Tile index number. */
@@ -27,11 +37,13 @@ typedef struct {
     bool priority;                  /* Priority (0: front, 1: back). */
 } Pixel;
 
+/* Fields are ordered by use: those the PPU touches on every dot come first
+ * and share a cache line, the registers follow, and memory comes last. */
 typedef struct {
-    /* PPU storage. */
-    byte nametable[NAMETABLE_SIZE]; /* PPU nametables. */
-    byte palette[PALETTE_SIZE];     /* PPU palettes */
-    byte oam[OAM_SIZE];             /* Object attribute memory. */
+    /* PPU Rendering. */
+    int scanline;                   /* [-1, 260]: 262 scanlines per frame, -1 pre-render. */
+    int dot;                        /* [0, 340]: 341 cycles per scanline. */
+    unsigned long long frame;       /* The current frame number. */
 
     /* PPU internal registers. */
     word v;                         /* Current VRAM address (15 bit). */
@@ -39,22 +51,35 @@ typedef struct {
     byte x;                         /* Fine X scroll (3 bits). */
     bool w;                         /* First or second write toggle. */
 
+    /* Background rendering. */
+    word low_tile_register;         /* Low tile shift register (16 bit). */
+    word high_tile_register;        /* High tile shift register (16 bit). */
+    byte attribute_register;        /* Attribute shift register (4 bits). */
+    byte nametable_byte;            /* The current nametable byte being fetched. */
+    byte attribute_byte;            /* The current attribute byte being fetched. */
+    byte low_tile;                  /* The current tile low pattern being fetched. */
+    byte high_tile;                 /* The current tile high pattern being fetched. */
+
+    /* Rendering switches of 0x2001 that are checked on every dot. */
+    bool mask_sprites;              /* Render sprites. */
+    bool mask_background;           /* Render background. */
+    bool mask_sprites_L;            /* Render sprites in leftmost column. */
+    bool mask_background_L;         /* Render background in leftmost column. */
+    bool odd_frame;                 /* The current frame is an odd frame. */
+    byte sprite_count;              /* Current sprite. */
+
     /* 0x2000: PPU control register 1. */
-    bool ctrl_nmi;                  /* Generate an NMI at start of VBI */
-    bool ctrl_master_slave;         /* PPU master/slave select. */
-    byte ctrl_sprite_size;          /* Sprite height (8 or 16 pixels). */
     word ctrl_background_addr;      /* Background pattern table address. */
     word ctrl_sprite_addr;          /* Sprite pattern table address. */
+    byte ctrl_sprite_size;          /* Sprite height (8 or 16 pixels). */
     byte ctrl_increment;            /* VRAM address increment. */
+    bool ctrl_nmi;                  /* Generate an NMI at start of VBI */
+    bool ctrl_master_slave;         /* PPU master/slave select. */
 
     /* 0x2001: PPU control register 2. */
     bool mask_red;                  /* Emphasize red (NTSC) or green (PAL). */
     bool mask_green;                /* Emphasize green (NTSC) or red (PAL). */
     bool mask_blue;                 /* Emphasize blue. */
-    bool mask_sprites;              /* Render sprites. */
-    bool mask_background;           /* Render background. */
-    bool mask_sprites_L;            /* Render sprites in leftmost column. */
-    bool mask_background_L;         /* Render background in leftmost column. */
     bool mask_grayscale;            /* Produce a grayscale display. */
 
     /* 0x2002: PPU status register. */
@@ -67,27 +92,23 @@ typedef struct {
     byte read_buffer;               /* Internal read buffer. */
     byte latch;                     /* PPUGenLatch. */
 
-    /* PPU Rendering. */
-    int scanline;                   /* [0, 261]: 262 scanlines per frame. */
-    int dot;                        /* [0, 340]: 341 cycles per scanline. */
-    unsigned long long frame;       /* The current frame number. */
-    bool odd_frame;                 /* The current frame is an odd frame. */
-
-    /* Background rendering. */
-    byte nametable_byte;            /* The current nametable byte being fetched. */
-    byte attribute_byte;            /* The current attribute byte being fetched. */
-    byte low_tile;                  /* The current tile low pattern being fetched. */
-    byte high_tile;                 /* The current tile high pattern being fetched. */
-
-    word low_tile_register;         /* Low tile shift register (16 bit). */
-    word high_tile_register;        /* High tile shift register (16 bit). */
-    byte attribute_register;        /* Attribute shift register (4 bits). */
-
     /* Sprite rendering. */
     Sprite sprites[8];              /* Sprites data of the current scanline. */
-    byte sprite_count;              /* Current sprite. */
+
+    /* PPU storage. */
+    byte palette[PALETTE_SIZE];     /* PPU palettes */
+    dword colors[PALETTE_SIZE];     /* RGBA color of each palette entry. */
+    byte oam[OAM_SIZE];             /* Object attribute memory. */
+    byte nametable[NAMETABLE_SIZE]; /* PPU nametables. */
 } PPU;
 
-extern PPU ppu;
+extern _Thread_local RenderMode render_mode;
+
+void ppu_step(void);
+byte ppu_register_read (word address);
+void ppu_register_write(word address, byte data);
+
+void ppu_render_to(dword (*frame)[FRAME_HEIGHT]);
+void ppu_show_frame(dword (*frame)[FRAME_HEIGHT]);
 
 #endif /* PPU_INTERNAL_H */
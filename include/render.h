@@ -0,0 +1,18 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "common.h"
+
+void rdr_enable(void);          /* Render frames on a worker thread. */
+void rdr_disable(void);         /* Render frames on the emulation thread. */
+bool rdr_is_enabled(void);
+
+/* Pixel state changes, logged by the emulation thread while deferred. */
+void rdr_log_register_read (word address);
+void rdr_log_register_write(word address, byte data);
+void rdr_log_cartridge_write(word address, byte data);
+void rdr_log_oam(const byte *oam);
+
+void rdr_submit_frame(void);    /* Hand the logged frame to the worker. */
+
+#endif /* RENDER_H */
@@ -0,0 +1,20 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include "common.h"
+
+/* Snapshots per keyframe, the keyframe included: stepping back through
+ * them decodes the keyframe once. */
+#define REWIND_KEYFRAME_INTERVAL 64
+
+/* Keep snapshots of the machine in a ring buffer of the given size in
+ * bytes, taking one every interval frames. */
+void rwd_init(size_t budget, int interval);
+void rwd_free(void);
+
+void rwd_push(void);        /* Called once per frame. */
+bool rwd_step_back(void);   /* Load the last snapshot and drop it. */
+int  rwd_count(void);       /* Number of snapshots kept. */
+
+#endif /* REWIND_H */
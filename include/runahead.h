@@ -0,0 +1,25 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include "common.h"
+
+/* Time spent on run-ahead, averaged over the last window of host frames. */
+typedef struct {
+    int frames;                     /* Frames currently run ahead (0: disabled). */
+    int late_frames;                /* Host frames that took longer than a frame. */
+    double save_us;                 /* Saving the state. */
+    double ahead_us;                /* Running the frames ahead. */
+    double load_us;                 /* Restoring the state. */
+    double frame_us;                /* The whole host frame, run-ahead included. */
+} RunAheadStats;
+
+/* Show each frame as it will be the given number of frames later, hiding
+ * that many frames of input latency. Needs inline rendering. */
+void rah_init(int frames);
+void rah_free(void);
+bool rah_is_enabled(void);
+
+void rah_frame(void);               /* Called once per frame, at the start of vblank. */
+RunAheadStats rah_get_stats(void);
+
+#endif /* RUNAHEAD_H */
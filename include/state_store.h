@@ -0,0 +1,26 @@
+#ifndef STATE_STORE_H
+#define STATE_STORE_H
+
+#include <stddef.h>
+#include "common.h"
+
+typedef struct {
+    int states;                     /* Number of states in the store. */
+    int chunks;                     /* Number of unique chunks. */
+    size_t file_size;               /* Size of the store file in bytes. */
+    double bytes_per_state;         /* Bytes in use per state, chunks shared. */
+} StoreStats;
+
+/* Keep save states of the current ROM in a store file, which is created if
+ * it does not exist. States are split into chunks, and each unique chunk is
+ * stored once. */
+bool sts_open(const char *path);
+void sts_close(void);
+
+int  sts_put(void);                 /* Store the machine; returns the state id (-1: error). */
+bool sts_get(int id);               /* Load a stored state into the machine. */
+void sts_remove(int id);
+
+StoreStats sts_get_stats(void);
+
+#endif /* STATE_STORE_H */
@@ -7,6 +7,7 @@ typedef enum { HORIZONTAL = 0, VERTICAL, SINGLE_0, SINGLE_1, MMC } MirrorMode;
 
 void vrm_init(void);
 void vrm_set_mode(MirrorMode mode_);
+MirrorMode vrm_get_mode(void);
 byte vrm_read(word address);
 void vrm_write(word address, byte data);
 
@@ -0,0 +1,18 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include "common.h"
+
+/* Runs in a forked worker on a copy-on-write copy of the machine, and talks
+ * to its client over the connection; returns the exit status. */
+typedef int (*ZygoteWorker)(int connection);
+
+/* Serve workers on a Unix socket: every connection forks the current
+ * machine into a worker. Returns only on error. */
+bool zyg_serve(const char *path, ZygoteWorker worker);
+
+/* Connect to a zygote; returns the connection to a new worker once it is
+ * running (-1: error). */
+int zyg_spawn(const char *path);
+
+#endif /* ZYGOTE_H */
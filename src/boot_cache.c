@@ -0,0 +1,117 @@
+/* -----------------------------------------------------------------
+ * Boot snapshot cache.
+ *
+ * Games spend seconds on logos and intros before they get anywhere. The
+ * state they reach is the same on every run with the same input, so it is
+ * saved to a file named after a hash of everything it depends on: the
+ * ROM, the core and state format versions, the number of frames and the
+ * input. A change to any of them gives another name, so stale entries are
+ * never loaded; entries that fail to load are removed.
+ * -------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/boot_cache.h"
+#include "../include/controller.h"
+#include "../include/cpu.h"
+#include "../include/log.h"
+#include "../include/machine.h"
+#include "../include/nes.h"
+#include "../include/ppu.h"
+
+/* FNV-1a hash of a block of data. */
+static unsigned long long hash_data(unsigned long long hash, const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ ((const byte *) data)[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static unsigned long long boot_key(int frames, const byte *inputs) {
+    unsigned long long rom_hash = nes_get_rom_hash();
+    dword versions[2] = { NES_VERSION, nes_state_version() };
+
+    unsigned long long key = 14695981039346656037ull;
+    key = hash_data(key, &rom_hash, sizeof(rom_hash));
+    key = hash_data(key, versions, sizeof(versions));
+    key = hash_data(key, &frames, sizeof(frames));
+    if (inputs != NULL) {
+        key = hash_data(key, inputs, frames);
+    }
+    return key;
+}
+
+static bool load_entry(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    size_t size = nes_state_size();
+    byte *data = malloc(size + 1);
+    bool success = data != NULL && fread(data, 1, size + 1, file) == size &&
+        nes_load_state(data, size);
+    fclose(file);
+    free(data);
+
+    if (!success) {
+        LOG_WARNING("Removing boot snapshot %s, which does not load.", path);
+        remove(path);
+    }
+    return success;
+}
+
+static void save_entry(const char *directory, const char *path) {
+    size_t size = nes_state_size();
+    byte *data = malloc(size);
+    if (data == NULL || nes_save_state(data, size) != size) {
+        free(data);
+        return;
+    }
+
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        LOG_WARNING("Unable to create boot cache directory %s.", directory);
+        free(data);
+        return;
+    }
+
+    /* Write to a temporary file first, so that no run sees half an entry. */
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", path, (int) getpid());
+
+    FILE *file = fopen(temp_path, "wb");
+    bool success = file != NULL && fwrite(data, size, 1, file) == 1;
+    success = file != NULL && fclose(file) == 0 && success;
+    if (!success || rename(temp_path, path) != 0) {
+        LOG_WARNING("Unable to write boot snapshot %s.", path);
+        remove(temp_path);
+    }
+    free(data);
+}
+
+bool btc_boot(const char *directory, int frames, const byte *inputs) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%016llx.state", directory, boot_key(frames, inputs));
+
+    if (load_entry(path)) {
+        LOG_INFO("Loaded boot snapshot of frame %d.", frames);
+        return true;
+    }
+
+    while (machine.ppu.frame < frames) {
+        unsigned long long frame = machine.ppu.frame;
+        for (int i = 0; i < NUM_BUTTONS; i++) {
+            nes_controller1_set(i, inputs != NULL && (inputs[frame] >> i & 1));
+        }
+        while (machine.ppu.frame == frame) {
+            cpu_execute();
+            ppu_catch_up();
+        }
+    }
+
+    save_entry(directory, path);
+    return false;
+}
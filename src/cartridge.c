@@ -34,11 +34,9 @@ bool cartridge_load(Cartridge *cartridge, byte *data, int length) {
     cartridge->mapper       = (data[7] & 0xF0) | ((data[6] & 0xF0) >> 4);
 
     cartridge->prg_rom      = NULL;
-    cartridge->prg_ram      = NULL;
     cartridge->chr_rom      = NULL;
-    cartridge->chr_ram      = NULL;
-    cartridge->registers    = NULL;
     cartridge->cpu_read     = NULL;
+    cartridge->cpu_page     = NULL;
     cartridge->cpu_write    = NULL;
     cartridge->ppu_read     = NULL;
     cartridge->ppu_write    = NULL;
@@ -1,13 +1,18 @@
 #define CPU_LOGGING
 
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include "../include/common.h"
 #include "../include/cpu.h"
+#include "../include/cpu_blocks.h"
 #include "../include/cpu_flags.h"
 #include "../include/cpu_internal.h"
 #include "../include/cpu_logging.h"
 #include "../include/log.h"
+#include "../include/machine.h"
 #include "../include/memory.h"
+#include "../include/ppu.h"
 
 /* -----------------------------------------------------------------
  * CPU variables.
@@ -16,19 +21,26 @@
 typedef void (*Function)(void);
 static Function cpu_instruction_table[256];
 static Function cpu_addressing_table[256];
-
-CPU cpu;                    /* CPU status. */
-
-static bool nmi = false;    /* NMI interrupt. */
-
-static byte opcode;         /* Current opcode being executed. */
-static byte operand;        /* Operand (8 bit) of the instruction. */
-static word address;        /* Operand (16 bit) of the instruction. */
-static byte lo, hi;         /* Temporary variables low/high byte. */
-
-unsigned long long cycles;  /* Total number of cycles run so far. */
-
-static bool initialized_table = false;
+static Function cpu_superinstruction_table[256];
+static const char *cpu_operation_names[256];
+static const char *cpu_addressing_names[256];
+static byte cpu_length_table[256];
+static byte cpu_block_table[256];
+
+/* The tables are shared; everything else belongs to the machine of the
+ * current thread. */
+static _Thread_local byte opcode;         /* Current opcode being executed. */
+static _Thread_local byte operand;        /* Operand (8 bit) of the instruction. */
+static _Thread_local word address;        /* Operand (16 bit) of the instruction. */
+static _Thread_local byte lo, hi;         /* Temporary variables low/high byte. */
+
+static _Thread_local bool superinstructions = false;  /* Run common pairs by one dispatch. */
+static _Thread_local bool aot = true;                 /* Run blocks translated by nes_aot. */
+static _Thread_local unsigned long long dispatches;   /* Number of dispatches so far. */
+static _Thread_local unsigned long long dispatch_frame; /* PPU frame when the dispatch started. */
+static _Thread_local unsigned long long fused;        /* Instructions run without a dispatch of their own. */
+
+static pthread_once_t initialized_table = PTHREAD_ONCE_INIT;
 
 /* -----------------------------------------------------------------
  * CPU addressing modes.
@@ -51,48 +63,50 @@ static inline void absolute_jump(void) {
     lo = cpu_fetch();
 }
 
+/* Indexed modes first read from the address before its high byte is fixed.
+ * That dummy read is only done when it has side effects, but its cycle is
+ * always counted. */
+
 static inline void absolute_x(void) {
     lo = cpu_fetch(); hi = cpu_fetch();
-    address = (hi << 8) | ((lo + cpu.X) & 0xFF);
-    operand = cpu_read(address);
-
-    address = ((hi << 8) | lo) + cpu.X;
-    if (is_diff_page(address, address - cpu.X)) {
-        operand = cpu_read(address);
+    address = ((hi << 8) | lo) + machine.cpu.X;
+    if (is_diff_page(address, address - machine.cpu.X)) {
+        word dummy = (hi << 8) | (address & 0xFF);
+        cpu_read_dummy(dummy);
     }
+    operand = cpu_read(address);
 }
 
 static inline void absolute_x_modify(void) {
     lo = cpu_fetch(); hi = cpu_fetch();
-    address = (hi << 8) | ((lo + cpu.X) & 0xFF);
-    operand = cpu_read(address);
-    address = ((hi << 8) | lo) + cpu.X;
+    address = ((hi << 8) | lo) + machine.cpu.X;
+    word dummy = (hi << 8) | (address & 0xFF);
+    cpu_read_dummy(dummy);
     operand = cpu_read(address);
 }
 
 static inline void absolute_x_write(void) {
     lo = cpu_fetch(); hi = cpu_fetch();
-    address = (hi << 8) | ((lo + cpu.X) & 0xFF);
-    operand = cpu_read(address);
-    address = ((hi << 8) | lo) + cpu.X;
+    address = ((hi << 8) | lo) + machine.cpu.X;
+    word dummy = (hi << 8) | (address & 0xFF);
+    cpu_read_dummy(dummy);
 }
 
 static inline void absolute_y(void) {
     lo = cpu_fetch(); hi = cpu_fetch();
-    address = (hi << 8) | ((lo + cpu.Y) & 0xFF);
-    operand = cpu_read(address);
-
-    address = ((hi << 8) | lo) + cpu.Y;
-    if (is_diff_page(address, address - cpu.Y)) {
-        operand = cpu_read(address);
+    address = ((hi << 8) | lo) + machine.cpu.Y;
+    if (is_diff_page(address, address - machine.cpu.Y)) {
+        word dummy = (hi << 8) | (address & 0xFF);
+        cpu_read_dummy(dummy);
     }
+    operand = cpu_read(address);
 }
 
 static inline void absolute_y_write(void) {
     lo = cpu_fetch(); hi = cpu_fetch();
-    address = (hi << 8) | ((lo + cpu.Y) & 0xFF);
-    operand = cpu_read(address);
-    address = ((hi << 8) | lo) + cpu.Y;
+    address = ((hi << 8) | lo) + machine.cpu.Y;
+    word dummy = (hi << 8) | (address & 0xFF);
+    cpu_read_dummy(dummy);
 }
 
 static inline void accumulator(void) {
@@ -110,7 +124,7 @@ static inline void implied(void) {
 static inline void indirect(void) {
     address = cpu_fetch_16();
 
-    if (lo == 0xFF) {
+    if ((address & 0xFF) == 0xFF) {
         lo = cpu_read(address);
         hi = cpu_read(address - 0xFF);
         address = (hi << 8) | lo;
@@ -122,45 +136,46 @@ static inline void indirect(void) {
 
 static inline void indirect_x(void) {
     address = cpu_fetch();
-    cpu_read(address);
-    lo = cpu.ram[(address + cpu.X) & 0xFF];
-    hi = cpu.ram[(address + cpu.X + 1) & 0xFF];
+    cpu_read_dummy(address);
+    lo = machine.ram[(address + machine.cpu.X) & 0xFF];
+    hi = machine.ram[(address + machine.cpu.X + 1) & 0xFF];
     address = (hi << 8) | lo;
-    cycles += 2;
+    machine.cycles += 2;
     operand = cpu_read(address);
 }
 
 static inline void indirect_x_write(void) {
     address = cpu_fetch();
-    cpu_read(address);
-    lo = cpu.ram[(address + cpu.X) & 0xFF];
-    hi = cpu.ram[(address + cpu.X + 1) & 0xFF];
+    cpu_read_dummy(address);
+    lo = machine.ram[(address + machine.cpu.X) & 0xFF];
+    hi = machine.ram[(address + machine.cpu.X + 1) & 0xFF];
     address = (hi << 8) | lo;
-    cycles += 2;
+    machine.cycles += 2;
 }
 
 static inline void indirect_y(void) {
     address = cpu_fetch();
-    lo = cpu.ram[address];
-    hi = cpu.ram[(address + 1) & 0xFF];
-    address = (hi << 8) | ((lo + cpu.Y) & 0xFF);
-    cycles += 2;
-    operand = cpu_read(address);
-
-    address = ((hi << 8) | lo) + cpu.Y;
-    if (is_diff_page(address, address - cpu.Y)) {
-        operand = cpu_read(address);
+    lo = machine.ram[address];
+    hi = machine.ram[(address + 1) & 0xFF];
+    machine.cycles += 2;
+
+    address = ((hi << 8) | lo) + machine.cpu.Y;
+    if (is_diff_page(address, address - machine.cpu.Y)) {
+        word dummy = (hi << 8) | (address & 0xFF);
+        cpu_read_dummy(dummy);
     }
+    operand = cpu_read(address);
 }
 
 static inline void indirect_y_write(void) {
     address = cpu_fetch();
-    lo = cpu.ram[address];
-    hi = cpu.ram[(address + 1) & 0xFF];
-    address = (hi << 8) | ((lo + cpu.Y) & 0xFF);
-    cycles += 2;
-    operand = cpu_read(address);
-    address = ((hi << 8) | lo) + cpu.Y;
+    lo = machine.ram[address];
+    hi = machine.ram[(address + 1) & 0xFF];
+    machine.cycles += 2;
+
+    address = ((hi << 8) | lo) + machine.cpu.Y;
+    word dummy = (hi << 8) | (address & 0xFF);
+    cpu_read_dummy(dummy);
 }
 
 static inline void relative(void) {
@@ -178,28 +193,28 @@ static inline void zero_page_write(void) {
 
 static inline void zero_page_x(void) {
     address = cpu_fetch();
-    cpu_read(address);
-    address = (address + cpu.X) & 0xFF;
+    cpu_read_dummy(address);
+    address = (address + machine.cpu.X) & 0xFF;
     operand = cpu_read(address);
 }
 
 static inline void zero_page_x_write(void) {
     address = cpu_fetch();
-    cpu_read(address);
-    address = (address + cpu.X) & 0xFF;
+    cpu_read_dummy(address);
+    address = (address + machine.cpu.X) & 0xFF;
 }
 
 static inline void zero_page_y(void) {
     address = cpu_fetch();
-    cpu_read(address);
-    address = (address + cpu.Y) & 0xFF;
+    cpu_read_dummy(address);
+    address = (address + machine.cpu.Y) & 0xFF;
     operand = cpu_read(address);
 }
 
 static inline void zero_page_y_write(void) {
     address = cpu_fetch();
-    cpu_read(address);
-    address = (address + cpu.Y) & 0xFF;
+    cpu_read_dummy(address);
+    address = (address + machine.cpu.Y) & 0xFF;
 }
 
 /* -----------------------------------------------------------------
@@ -208,45 +223,45 @@ static inline void zero_page_y_write(void) {
 
 /* Invalid / unimplemented instruction. */
 static inline void invalid(void) {
-    LOG_ERROR("Invalid opcode %02X at %04X.", opcode, cpu.PC - 1);
+    LOG_ERROR("Invalid opcode %02X at %04X.", opcode, machine.cpu.PC - 1);
 }
 
 /* Branching instructions. */
 static inline void branch(bool condition) {
     if (condition) {
-        address = cpu.PC;
-        cpu.PC += (int8_t) operand;
+        address = machine.cpu.PC;
+        machine.cpu.PC += (int8_t) operand;
 
-        cycles++;
-        if (is_diff_page(address, cpu.PC)) {
-            cycles++;  /* Page crossed. */
+        machine.cycles++;
+        if (is_diff_page(address, machine.cpu.PC)) {
+            machine.cycles++;  /* Page crossed. */
         }
     }
 }
 
 /* ADC - Add with Carry. */
 static inline void adc(void) {
-    int result = cpu.A + operand + flg_is_C();
+    int result = machine.cpu.A + operand + flg_is_C();
     flg_update_ZN(result);
-    flg_update_C (result, ADC);
-    flg_update_V (result, cpu.A, operand);
-    cpu.A = result & 0xFF;
+    flg_update_C (result > 0xFF);
+    flg_update_V (result, machine.cpu.A, operand);
+    machine.cpu.A = result & 0xFF;
 }
 
 /* AND - Logical AND. */
 static inline void and(void) {
-    flg_update_ZN(cpu.A &= operand);
+    flg_update_ZN(machine.cpu.A &= operand);
 }
 
 /* ASL - Arithmetic Shift Left (Accumulator). */
 static inline void asl_a(void) {
-    flg_update_C (cpu.A, ROL);
-    flg_update_ZN(cpu.A <<= 1);
+    flg_update_C (machine.cpu.A & 0x80);
+    flg_update_ZN(machine.cpu.A <<= 1);
 }
 
 /* ASL - Arithmetic Shift Left (Memory). */
 static inline void asl_m(void) {
-    flg_update_C (operand, ROL);
+    flg_update_C (operand & 0x80);
     cpu_write(address, operand);
     cpu_write(address, operand <<= 1);
     flg_update_ZN(operand);
@@ -269,7 +284,7 @@ static inline void beq(void) {
 
 /* BIT - Bit Test. */
 static inline void bit(void) {
-    flg_update_Z(cpu.A & operand);
+    flg_update_Z(machine.cpu.A & operand);
     flg_update_N(operand);
     flg_update_V_bit(operand);
 }
@@ -291,9 +306,9 @@ static inline void bpl(void) {
 
 /* BRK - Force Interrupt. */
 static inline void brk(void) {
-    cpu_push_address(cpu.PC);
+    cpu_push_address(machine.cpu.PC);
     cpu_push(flg_get_status(true));
-    cpu.PC = cpu_read_16(IRQ_VECTOR);
+    machine.cpu.PC = cpu_read_16(IRQ_VECTOR);
     flg_set_I();
 }
 
@@ -329,20 +344,20 @@ static inline void clv(void) {
 
 /* CMP - Compare. */
 static inline void cmp(void) {
-    flg_update_C (cpu.A - operand, CMP);
-    flg_update_ZN(cpu.A - operand);
+    flg_update_C (machine.cpu.A >= operand);
+    flg_update_ZN(machine.cpu.A - operand);
 }
 
 /* CPX - Compare X Register. */
 static inline void cpx(void) {
-    flg_update_C (cpu.X - operand, CMP);
-    flg_update_ZN(cpu.X - operand);
+    flg_update_C (machine.cpu.X >= operand);
+    flg_update_ZN(machine.cpu.X - operand);
 }
 
 /* CPY - Compare Y Register. */
 static inline void cpy(void) {
-    flg_update_C (cpu.Y - operand, CMP);
-    flg_update_ZN(cpu.Y - operand);
+    flg_update_C (machine.cpu.Y >= operand);
+    flg_update_ZN(machine.cpu.Y - operand);
 }
 
 /* DEC - Decrement Memory. */
@@ -354,17 +369,17 @@ static inline void dec(void) {
 
 /* DEX - Decrement X Register. */
 static inline void dex(void) {
-    flg_update_ZN(--cpu.X);
+    flg_update_ZN(--machine.cpu.X);
 }
 
 /* DEY - Decrement Y Register. */
 static inline void dey(void) {
-    flg_update_ZN(--cpu.Y);
+    flg_update_ZN(--machine.cpu.Y);
 }
 
 /* EOR - Exclusive OR. */
 static inline void eor(void) {
-    flg_update_ZN(cpu.A ^= operand);
+    flg_update_ZN(machine.cpu.A ^= operand);
 }
 
 /* INC - Increment Memory. */
@@ -376,57 +391,57 @@ static inline void inc(void) {
 
 /* INX - Increment X Register. */
 static inline void inx(void) {
-    flg_update_ZN(++cpu.X);
+    flg_update_ZN(++machine.cpu.X);
 }
 
 /* INY - Increment Y Register. */
 static inline void iny(void) {
-    flg_update_ZN(++cpu.Y);
+    flg_update_ZN(++machine.cpu.Y);
 }
 
 /* JMP - Jump, Absolute. */
 static inline void jmp_absolute(void) {
     hi = cpu_fetch();
-    cpu.PC = (hi << 8) | lo;
+    machine.cpu.PC = (hi << 8) | lo;
 }
 
 /* JMP - Jump, Indirect. */
 static inline void jmp_indirect(void) {
-    cpu.PC = address;
+    machine.cpu.PC = address;
 }
 
 /* JSR - Jump to Subroutine. */
 static inline void jsr(void) {
-    cycles++;
-    cpu_push_address(cpu.PC);
+    machine.cycles++;
+    cpu_push_address(machine.cpu.PC);
     hi = cpu_fetch();
-    cpu.PC = (hi << 8) | lo;
+    machine.cpu.PC = (hi << 8) | lo;
 }
 
 /* LDA - Load Accumulator. */
 static inline void lda(void) {
-    flg_update_ZN(cpu.A = operand);
+    flg_update_ZN(machine.cpu.A = operand);
 }
 
 /* LDX - Load X Register. */
 static inline void ldx(void) {
-    flg_update_ZN(cpu.X = operand);
+    flg_update_ZN(machine.cpu.X = operand);
 }
 
 /* LDY - Load Y Register. */
 static inline void ldy(void) {
-    flg_update_ZN(cpu.Y = operand);
+    flg_update_ZN(machine.cpu.Y = operand);
 }
 
 /* LSR - Logical Shift Right (Accumulator). */
 static inline void lsr_a(void) {
-    flg_update_C (cpu.A, ROR);
-    flg_update_ZN(cpu.A >>= 1);
+    flg_update_C (machine.cpu.A & 0x01);
+    flg_update_ZN(machine.cpu.A >>= 1);
 }
 
 /* LSR - Logical Shift Right (Memory). */
 static inline void lsr_m(void) {
-    flg_update_C (operand, ROR);
+    flg_update_C (operand & 0x01);
     cpu_write(address, operand);
     cpu_write(address, operand >>= 1);
     flg_update_ZN(operand);
@@ -437,12 +452,12 @@ static inline void nop(void) {}
 
 /* ORA - Logical Inclusive OR. */
 static inline void ora(void) {
-    flg_update_ZN(cpu.A |= operand);
+    flg_update_ZN(machine.cpu.A |= operand);
 }
 
 /* PHA - Push Accumulator. */
 static inline void pha(void) {
-    cpu_push(cpu.A);
+    cpu_push(machine.cpu.A);
 }
 
 /* PHP - Push Processor Status. */
@@ -452,26 +467,26 @@ static inline void php(void) {
 
 /* PLA - Pull Accumulator. */
 static inline void pla(void) {
-    cycles++; /* Increment S cycle. */
-    flg_update_ZN(cpu.A = cpu_pop());
+    machine.cycles++; /* Increment S cycle. */
+    flg_update_ZN(machine.cpu.A = cpu_pop());
 }
 
 /* PLP - Pull Processor Status. */
 static inline void plp(void) {
-    cycles++; /* Increment S cycle. */
+    machine.cycles++; /* Increment S cycle. */
     flg_set_status(cpu_pop());
 }
 
 /* ROL - Rotate Left (Accumulator). */
 static inline void rol_a(void) {
-    flg_update_C (cpu.A, ROL);
-    cpu.A = (cpu.A << 1) | flg_is_C();
-    flg_update_ZN(cpu.A);
+    flg_update_C (machine.cpu.A & 0x80);
+    machine.cpu.A = (machine.cpu.A << 1) | flg_is_C();
+    flg_update_ZN(machine.cpu.A);
 }
 
 /* ROL - Rotate Left (Memory). */
 static inline void rol_m(void) {
-    flg_update_C (operand, ROL);
+    flg_update_C (operand & 0x80);
     cpu_write(address, operand);
     operand = (operand << 1) | flg_is_C();
     cpu_write(address, operand);
@@ -481,15 +496,15 @@ static inline void rol_m(void) {
 /* ROR - Rotate Right (Accumulator). */
 static inline void ror_a(void) {
     bool carry = flg_is_C();
-    flg_update_C (cpu.A, ROR);
-    cpu.A = (cpu.A >> 1) | (carry << 7);
-    flg_update_ZN(cpu.A);
+    flg_update_C (machine.cpu.A & 0x01);
+    machine.cpu.A = (machine.cpu.A >> 1) | (carry << 7);
+    flg_update_ZN(machine.cpu.A);
 }
 
 /* ROR - Rotate Right (Memory). */
 static inline void ror_m(void) {
     bool carry = flg_is_C();
-    flg_update_C (operand, ROR);
+    flg_update_C (operand & 0x01);
     cpu_write(address, operand);
     operand = (operand >> 1) | (carry << 7);
     cpu_write(address, operand);
@@ -498,26 +513,26 @@ static inline void ror_m(void) {
 
 /* RTI - Return from Interrupt. */
 static inline void rti(void) {
-    cycles++; /* Increment S cycle. */
+    machine.cycles++; /* Increment S cycle. */
     flg_set_status(cpu_pop());
-    cpu.PC = cpu_pop_address();
+    machine.cpu.PC = cpu_pop_address();
 }
 
 /* RTS - Return from Subroutine. */
 static inline void rts(void) {
-    cycles++; /* Increment S cycle. */
-    cpu.PC = cpu_pop_address() + 1;
-    cycles++; /* Increment PC cycle. */
+    machine.cycles++; /* Increment S cycle. */
+    machine.cpu.PC = cpu_pop_address() + 1;
+    machine.cycles++; /* Increment PC cycle. */
 }
 
 /* SBC - Subtract with Carry. */
 static inline void sbc(void) {
     operand ^= 0xFF;
-    int result = cpu.A + operand + flg_is_C();
+    int result = machine.cpu.A + operand + flg_is_C();
     flg_update_ZN(result);
-    flg_update_C (result, ADC);
-    flg_update_V (result, cpu.A, operand);
-    cpu.A = result & 0xFF;
+    flg_update_C (result > 0xFF);
+    flg_update_V (result, machine.cpu.A, operand);
+    machine.cpu.A = result & 0xFF;
 }
 
 /* SEC - Set Carry Flag. */
@@ -537,47 +552,47 @@ static inline void sei(void) {
 
 /* STA - Store Accumulator. */
 static inline void sta(void) {
-    cpu_write(address, cpu.A);
+    cpu_write(address, machine.cpu.A);
 }
 
 /* STX - Store X Register. */
 static inline void stx(void) {
-    cpu_write(address, cpu.X);
+    cpu_write(address, machine.cpu.X);
 }
 
 /* STY - Store Y Register. */
 static inline void sty(void) {
-    cpu_write(address, cpu.Y);
+    cpu_write(address, machine.cpu.Y);
 }
 
 /* TAX - Transfer Accumulator to X. */
 static inline void tax(void) {
-    flg_update_ZN(cpu.X = cpu.A);
+    flg_update_ZN(machine.cpu.X = machine.cpu.A);
 }
 
 /* TAY - Transfer Accumulator to Y. */
 static inline void tay(void) {
-    flg_update_ZN(cpu.Y = cpu.A);
+    flg_update_ZN(machine.cpu.Y = machine.cpu.A);
 }
 
 /* TSX - Transfer Stack Pointer to X. */
 static inline void tsx(void) {
-    flg_update_ZN(cpu.X = cpu.S);
+    flg_update_ZN(machine.cpu.X = machine.cpu.S);
 }
 
 /* Transfer X to Accumulator. */
 static inline void txa(void) {
-    flg_update_ZN(cpu.A = cpu.X);
+    flg_update_ZN(machine.cpu.A = machine.cpu.X);
 }
 
 /* TXS - Transfer X to Stack Pointer. */
 static inline void txs(void) {
-    cpu.S = cpu.X;
+    machine.cpu.S = machine.cpu.X;
 }
 
 /* TYA - Transfer Y to Accumulator. */
 static inline void tya(void) {
-    flg_update_ZN(cpu.A = cpu.Y);
+    flg_update_ZN(machine.cpu.A = machine.cpu.Y);
 }
 
 /* -----------------------------------------------------------------
@@ -586,54 +601,54 @@ static inline void tya(void) {
 
 /* ALR - AND and Shift Right. */
 static inline void alr(void) {
-    cpu.A &= operand;
-    flg_update_C (cpu.A, ROR);
-    flg_update_ZN(cpu.A >>= 1);
+    machine.cpu.A &= operand;
+    flg_update_C (machine.cpu.A & 0x01);
+    flg_update_ZN(machine.cpu.A >>= 1);
 }
 
 /* ANC - AND with Carry */
 static inline void anc(void) {
-    flg_update_C (cpu.A, ROL);
-    flg_update_ZN(cpu.A &= operand);
+    flg_update_ZN(machine.cpu.A &= operand);
+    flg_update_C (machine.cpu.A & 0x80);
 }
 
 /* ARR - AND and Rotate Right. */
 static inline void arr(void) {
-    cpu.A &= operand;
+    machine.cpu.A &= operand;
 
     /* Set the V-flag according to (A and #{imm}) + #{imm}. */
-    flg_update_V (cpu.A + operand, cpu.A, operand);
+    flg_update_V (machine.cpu.A + operand, machine.cpu.A, operand);
 
     bool carry = flg_is_C();
-    flg_update_C (cpu.A, ROL);
-    cpu.A = (cpu.A >> 1) | (carry << 7);
-    flg_update_ZN(cpu.A);
+    flg_update_C (machine.cpu.A & 0x80);
+    machine.cpu.A = (machine.cpu.A >> 1) | (carry << 7);
+    flg_update_ZN(machine.cpu.A);
 }
 
 /* AXS - AND X with Accumulator and Subtract. */
 static inline void axs(void) {
-    cpu.X &= cpu.A;
-    cpu.X -= operand;
-    flg_update_C (cpu.X, CMP);
-    flg_update_ZN(cpu.X);
+    machine.cpu.X &= machine.cpu.A;
+    flg_update_C (machine.cpu.X >= operand);
+    machine.cpu.X -= operand;
+    flg_update_ZN(machine.cpu.X);
 }
 
 /* DCP - Decrement and compare. */
 static inline void dcp(void) {
     cpu_write(address, operand);
     cpu_write(address, --operand);
-    flg_update_C (cpu.A - operand, CMP);
-    flg_update_ZN(cpu.A - operand);
+    flg_update_C (machine.cpu.A >= operand);
+    flg_update_ZN(machine.cpu.A - operand);
 }
 
 /* LAX - Load Accumulator and X. */
 static inline void lax(void) {
-    flg_update_ZN(cpu.A = cpu.X = operand);
+    flg_update_ZN(machine.cpu.A = machine.cpu.X = operand);
 }
 
 /* HLT - Halt. */
 static inline void hlt(void) {
-    LOG_ERROR("CPU halted, opcode %02X at %04X.", opcode, cpu.PC);
+    LOG_ERROR("CPU halted, opcode %02X at %04X.", opcode, machine.cpu.PC);
 }
 
 /* ISB - Increment and Subtract. */
@@ -642,470 +657,780 @@ static inline void isb(void) {
     cpu_write(address, ++operand);
 
     operand ^= 0xFF;
-    int result = cpu.A + operand + flg_is_C();
+    int result = machine.cpu.A + operand + flg_is_C();
     flg_update_ZN(result);
-    flg_update_C (result, ADC);
-    flg_update_V (result, cpu.A, operand);
-    cpu.A = result & 0xFF;
+    flg_update_C (result > 0xFF);
+    flg_update_V (result, machine.cpu.A, operand);
+    machine.cpu.A = result & 0xFF;
 }
 
 /* RLA - Rotate Left and AND. */
 static inline void rla(void) {
     bool carry = flg_is_C();
-    flg_update_C (operand, ROL);
+    flg_update_C (operand & 0x80);
     cpu_write(address, operand);
     operand = (operand << 1) | carry;
     cpu_write(address, operand);
-    flg_update_ZN(cpu.A &= operand);
+    flg_update_ZN(machine.cpu.A &= operand);
 }
 
 /* RRA - Rotate Right and Add. */
 static inline void rra(void) {
     bool carry = flg_is_C();
-    flg_update_C (operand, ROR);
+    flg_update_C (operand & 0x01);
     cpu_write(address, operand);
     operand = (operand >> 1) | (carry << 7);
     cpu_write(address, operand);
 
-    int result = cpu.A + operand + flg_is_C();
+    int result = machine.cpu.A + operand + flg_is_C();
     flg_update_ZN(result);
-    flg_update_C (result, ADC);
-    flg_update_V (result, cpu.A, operand);
-    cpu.A = result & 0xFF;
+    flg_update_C (result > 0xFF);
+    flg_update_V (result, machine.cpu.A, operand);
+    machine.cpu.A = result & 0xFF;
 }
 
 /* SAX - Store Accumulator AND X. */
 static inline void sax(void) {
-    cpu_write(address, cpu.A & cpu.X);
+    cpu_write(address, machine.cpu.A & machine.cpu.X);
 }
 
 /* SLO - Shift Left and Inclusive OR. */
 static inline void slo(void) {
-    flg_update_C (operand, ROL);
+    flg_update_C (operand & 0x80);
     cpu_write(address, operand);
     cpu_write(address, operand <<= 1);
-    flg_update_ZN(cpu.A |= operand);
+    flg_update_ZN(machine.cpu.A |= operand);
 }
 
 /* SRE - Shift Right and Exclusive OR. */
 static inline void sre(void) {
-    flg_update_C (operand, ROR);
+    flg_update_C (operand & 0x01);
     cpu_write(address, operand);
     cpu_write(address, operand >>= 1);
-    flg_update_ZN(cpu.A ^= operand);
+    flg_update_ZN(machine.cpu.A ^= operand);
 }
 
 /* XAA - Transfer X to Accumulator and AND. */
 static inline void xaa(void) {
-    cpu.A = cpu.X & operand;
-    flg_update_ZN(cpu.A);
+    machine.cpu.A = machine.cpu.X & operand;
+    flg_update_ZN(machine.cpu.A);
+}
+
+/* -----------------------------------------------------------------
+ * CPU dispatches of more than one instruction.
+ *
+ * Between two instructions of a dispatch the PPU is caught up, and the
+ * dispatch ends when an NMI is pending or a new frame has started. Callers
+ * check for both between dispatches, so they see them after the same
+ * instruction whichever way the instructions are dispatched.
+ * -------------------------------------------------------------- */
+
+static inline bool dispatch_interrupted(void) {
+    ppu_catch_up();
+    return machine.nmi || machine.ppu.frame != dispatch_frame;
+}
+
+/* -----------------------------------------------------------------
+ * CPU superinstructions.
+ *
+ * Common pairs of instructions are run by a single dispatch. After the
+ * first instruction the PPU is caught up, as it would be between two
+ * dispatches, and the second instruction only follows directly when the
+ * dispatch is not interrupted and the next opcode matches. Both use the same addressing
+ * modes and operations as when dispatched apart, so cycles are counted
+ * exactly the same.
+ * -------------------------------------------------------------- */
+
+static inline bool fuse(byte next) {
+    if (dispatch_interrupted() || mem_get(machine.cpu.PC) != next) {
+        return false;
+    }
+
+    #ifdef CPU_LOGGING
+    cpu_log_operation();
+    #endif
+
+    opcode = cpu_fetch();
+    fused++;
+    return true;
+}
+
+#define SUPERINSTRUCTION(name, mode1, oper1, next, mode2, oper2) \
+    static void name(void) {                                     \
+        mode1(); oper1();                                        \
+        if (fuse(next)) {                                        \
+            mode2(); oper2();                                    \
+        }                                                        \
+    }
+
+SUPERINSTRUCTION(dex_bne,       implied,    dex, 0xD0, relative,         bne)
+SUPERINSTRUCTION(dey_bne,       implied,    dey, 0xD0, relative,         bne)
+SUPERINSTRUCTION(lda_sta_zp,    zero_page,  lda, 0x8D, absolute_write,   sta)
+SUPERINSTRUCTION(lda_sta_abs_x, absolute_x, lda, 0x9D, absolute_x_write, sta)
+SUPERINSTRUCTION(cmp_beq,       immediate,  cmp, 0xF0, relative,         beq)
+SUPERINSTRUCTION(inc_lda_zp,    zero_page,  inc, 0xA5, zero_page,        lda)
+
+/* -----------------------------------------------------------------
+ * CPU ahead-of-time translated code.
+ *
+ * A module generated by nes_aot is built into this file when
+ * NES_AOT_MODULE names it. Its blocks are straight-line code translated
+ * from PRG ROM: opcode and operand fetches are counted up front, and every
+ * operation is the interpreter's own. Between two instructions the PPU is
+ * caught up and the block is left when the dispatch is interrupted. A
+ * block only runs while the ROM mapped at its address still
+ * holds the code it was translated from; each thread remembers the mapped
+ * code it last checked a block against until its next cpu_init.
+ * -------------------------------------------------------------- */
+
+#ifdef NES_AOT_MODULE
+
+typedef struct {
+    word address;               /* CPU address of the first instruction. */
+    word length;                /* Length of the translated code in bytes. */
+    const byte *code;           /* The code the block was translated from. */
+    Function run;               /* The translated block. */
+} AotBlock;
+
+#ifdef CPU_LOGGING
+#define AOT_LOG(pc) machine.cpu.PC = pc; cpu_log_operation();
+#else
+#define AOT_LOG(pc)
+#endif
+
+/* Implied and accumulator: opcode fetch and a dummy read of the next byte. */
+#define AOT_IMPLIED(pc, op, oper)                                   \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 1; machine.cycles += 2; oper();
+
+#define AOT_IMMEDIATE(pc, op, value, oper)                          \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 2; machine.cycles += 2;                      \
+    operand = value; oper();
+
+#define AOT_RELATIVE(pc, op, offset, oper)                          \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 2; machine.cycles += 2;                      \
+    operand = offset; oper();
+
+#define AOT_ZERO_PAGE(pc, op, zp, oper)                             \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 2; machine.cycles += 2;                      \
+    address = zp; operand = cpu_read(address); oper();
+
+#define AOT_ZERO_PAGE_WRITE(pc, op, zp, oper)                       \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 2; machine.cycles += 2;                      \
+    address = zp; oper();
+
+#define AOT_ABSOLUTE(pc, op, abs, oper)                             \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 3; machine.cycles += 3;                      \
+    address = abs; operand = cpu_read(address); oper();
+
+#define AOT_ABSOLUTE_WRITE(pc, op, abs, oper)                       \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 3; machine.cycles += 3;                      \
+    address = abs; oper();
+
+/* Any other addressing mode fetches its operands itself. */
+#define AOT_GENERIC(pc, op, mode, oper)                             \
+    AOT_LOG(pc)                                                     \
+    opcode = op; machine.cpu.PC = pc + 1; machine.cycles++;                         \
+    mode(); oper();
+
+/* Check point between two instructions of a block. */
+#define AOT_CHECK() if (aot_interrupted()) return;
+
+static inline bool aot_interrupted(void) {
+    if (dispatch_interrupted()) {
+        return true;
+    }
+    fused++;
+    return false;
+}
+
+#include NES_AOT_MODULE
+
+#define NUM_AOT_BLOCKS (sizeof(aot_blocks) / sizeof(aot_blocks[0]))
+
+/* Blocks indexed by their address in 0x8000-0xFFFF. */
+static const AotBlock *aot_index[0x8000];
+
+/* Mapped code each block was last checked against. A new cartridge can be
+ * mapped at the same address, so cpu_init forgets them. */
+static _Thread_local const byte *aot_pages[NUM_AOT_BLOCKS];
+
+static inline void init_aot_index(void) {
+    for (int i = 0; i < NUM_AOT_BLOCKS; i++) {
+        aot_index[aot_blocks[i].address - 0x8000] = &aot_blocks[i];
+    }
+}
+
+/* Run the translated block at PC, if there is one for the mapped code. */
+static inline bool aot_execute(void) {
+    if (machine.cpu.PC < 0x8000) {
+        return false;
+    }
+
+    const AotBlock *block = aot_index[machine.cpu.PC - 0x8000];
+    if (block == NULL) {
+        return false;
+    }
+
+    /* The code must be mapped contiguously, and be the translated code. */
+    const byte *page = mem_page(block->address);
+    if (page == NULL || mem_page(block->address + block->length - 1) !=
+            page + block->length - 1) {
+        return false;
+    }
+    const byte **checked = &aot_pages[block - aot_blocks];
+    if (page != *checked) {
+        if (memcmp(page, block->code, block->length) != 0) {
+            return false;
+        }
+        *checked = page;
+    }
+
+    (*block->run)();
+    return true;
+}
+
+#endif /* NES_AOT_MODULE */
+
+/* -----------------------------------------------------------------
+ * CPU decoded blocks.
+ *
+ * Straight-line code in PRG ROM is decoded once into a block, which is
+ * then run without going back to the dispatcher. Blocks are kept by the
+ * block cache, which can save them to disk for the next start. Between two
+ * instructions the PPU is caught up and the block is left when the dispatch
+ * is interrupted. Blocks end at branches, jumps, returns and at
+ * writes that may switch banks.
+ * -------------------------------------------------------------- */
+
+/* Decode the block at the given address from the mapped code. */
+static inline const Block *decode_block(word start) {
+    const byte *page = mem_page(start);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    Block block = { start, 0, 0 };
+    while (block.count < 255) {
+        word pc = start + block.length;
+        byte op = page[block.length];
+        int length = cpu_length_table[op];
+
+        /* The instruction must fit in the block, mapped contiguously. */
+        if (cpu_block_table[op] == BLOCK_EXCLUDE || pc + length > 0x10000 ||
+                block.length + length > BLOCK_MAX_LENGTH ||
+                mem_page(pc + length - 1) != page + block.length + length - 1) {
+            break;
+        }
+
+        memcpy(&block.code[block.length], &page[block.length], length);
+        block.length += length;
+        block.count++;
+
+        if (cpu_block_table[op] == BLOCK_JUMP || cpu_block_table[op] == BLOCK_WRITE) {
+            break;
+        }
+        if (cpu_block_table[op] == BLOCK_WRITE_ABSOLUTE &&
+                ((page[block.length - 1] << 8) | page[block.length - 2]) >= 0x4020) {
+            break;
+        }
+    }
+
+    return block.count > 0 ? blk_insert(&block) : NULL;
+}
+
+/* Run a block, one instruction at a time. */
+static inline void run_block(const Block *block) {
+    int offset = 0;
+
+    for (int i = 0; i < block->count; i++) {
+        if (i > 0) {
+            if (dispatch_interrupted()) {
+                return;
+            }
+            fused++;
+        }
+
+        #ifdef CPU_LOGGING
+        machine.cpu.PC = block->address + offset;
+        cpu_log_operation();
+        #endif
+
+        opcode = block->code[offset];
+        machine.cpu.PC = block->address + offset + 1;
+        machine.cycles++;
+        (*cpu_addressing_table[opcode])();  /* Fetch arguments. */
+        (*cpu_instruction_table[opcode])(); /* Execute operation. */
+        offset += cpu_length_table[opcode];
+    }
+}
+
+/* Run the block at PC, decoding it first if needed. */
+static inline bool block_execute(void) {
+    if (machine.cpu.PC < 0x8000) {
+        return false;
+    }
+
+    const Block *block = blk_lookup(machine.cpu.PC);
+    if (block == NULL && (block = decode_block(machine.cpu.PC)) == NULL) {
+        return false;
+    }
+
+    run_block(block);
+    return true;
 }
 
 /* --------------------------------------------------------------------
  * CPU operation tables.
  * ----------------------------------------------------------------- */
 
-#define SET_INSTRUCTION(opcode, name, oper, mode)   \
-    cpu_instruction_table [opcode] = oper;          \
-    cpu_addressing_table  [opcode] = mode;          \
-    cpu_log_set_function  (opcode, cpu_log_##mode); \
-    cpu_log_set_name      (opcode, name)
+/* Instruction length of each addressing mode, in bytes. */
+#define LENGTH_implied           1
+#define LENGTH_accumulator       1
+#define LENGTH_immediate         2
+#define LENGTH_relative          2
+#define LENGTH_zero_page         2
+#define LENGTH_zero_page_write   2
+#define LENGTH_zero_page_x       2
+#define LENGTH_zero_page_x_write 2
+#define LENGTH_zero_page_y       2
+#define LENGTH_zero_page_y_write 2
+#define LENGTH_indirect_x        2
+#define LENGTH_indirect_x_write  2
+#define LENGTH_indirect_y        2
+#define LENGTH_indirect_y_write  2
+#define LENGTH_absolute          3
+#define LENGTH_absolute_jump     3
+#define LENGTH_absolute_write    3
+#define LENGTH_absolute_x        3
+#define LENGTH_absolute_x_modify 3
+#define LENGTH_absolute_x_write  3
+#define LENGTH_absolute_y        3
+#define LENGTH_absolute_y_write  3
+#define LENGTH_indirect          3
+
+/* The kind says how the instruction ends a decoded block (BlockKind). */
+#define SET_INSTRUCTION(opcode, name, oper, mode, kind) \
+    cpu_instruction_table [opcode] = oper;              \
+    cpu_addressing_table  [opcode] = mode;              \
+    cpu_length_table      [opcode] = LENGTH_##mode;     \
+    cpu_block_table       [opcode] = kind;              \
+    cpu_log_set_function  (opcode, cpu_log_##mode);     \
+    cpu_log_set_name      (opcode, name);               \
+    cpu_operation_names   [opcode] = #oper;             \
+    cpu_addressing_names  [opcode] = #mode
 
 static inline void init_instruction_table(void) {
     /* Reset CPU tables. */
     for (int opcode = 0; opcode < 256; opcode++) {
-        SET_INSTRUCTION(opcode, "****", invalid, implied);
+        SET_INSTRUCTION(opcode, "****", invalid, implied, BLOCK_EXCLUDE);
     }
 
     /* ADC - Add with Carry. */
-    SET_INSTRUCTION(0x69, " ADC", adc, immediate);
-    SET_INSTRUCTION(0x65, " ADC", adc, zero_page);
-    SET_INSTRUCTION(0x75, " ADC", adc, zero_page_x);
-    SET_INSTRUCTION(0x6D, " ADC", adc, absolute);
-    SET_INSTRUCTION(0x7D, " ADC", adc, absolute_x);
-    SET_INSTRUCTION(0x79, " ADC", adc, absolute_y);
-    SET_INSTRUCTION(0x61, " ADC", adc, indirect_x);
-    SET_INSTRUCTION(0x71, " ADC", adc, indirect_y);
+    SET_INSTRUCTION(0x69, " ADC", adc, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x65, " ADC", adc, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x75, " ADC", adc, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x6D, " ADC", adc, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0x7D, " ADC", adc, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x79, " ADC", adc, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0x61, " ADC", adc, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x71, " ADC", adc, indirect_y, BLOCK_NEXT);
 
     /* ALR - AND and Shift Right. */
-    SET_INSTRUCTION(0x4B, "*ALR", alr, immediate);
+    SET_INSTRUCTION(0x4B, "*ALR", alr, immediate, BLOCK_NEXT);
 
     /* ANC - AND with Carry. */
-    SET_INSTRUCTION(0x0B, "*ANC", anc, immediate);
-    SET_INSTRUCTION(0x2B, "*ANC", anc, immediate);
+    SET_INSTRUCTION(0x0B, "*ANC", anc, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x2B, "*ANC", anc, immediate, BLOCK_NEXT);
 
     /* AND - Logical AND. */
-    SET_INSTRUCTION(0x29, " AND", and, immediate);
-    SET_INSTRUCTION(0x25, " AND", and, zero_page);
-    SET_INSTRUCTION(0x35, " AND", and, zero_page_x);
-    SET_INSTRUCTION(0x2D, " AND", and, absolute);
-    SET_INSTRUCTION(0x3D, " AND", and, absolute_x);
-    SET_INSTRUCTION(0x39, " AND", and, absolute_y);
-    SET_INSTRUCTION(0x21, " AND", and, indirect_x);
-    SET_INSTRUCTION(0x31, " AND", and, indirect_y);
+    SET_INSTRUCTION(0x29, " AND", and, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x25, " AND", and, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x35, " AND", and, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x2D, " AND", and, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0x3D, " AND", and, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x39, " AND", and, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0x21, " AND", and, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x31, " AND", and, indirect_y, BLOCK_NEXT);
 
     /* ARR - AND and Rotate Right. */
-    SET_INSTRUCTION(0x6B, "*ARR", arr, immediate);
+    SET_INSTRUCTION(0x6B, "*ARR", arr, immediate, BLOCK_NEXT);
 
     /* ASL - Arithmetic Shift Left. */
-    SET_INSTRUCTION(0x0A, " ASL", asl_a, accumulator);
-    SET_INSTRUCTION(0x06, " ASL", asl_m, zero_page);
-    SET_INSTRUCTION(0x16, " ASL", asl_m, zero_page_x);
-    SET_INSTRUCTION(0x0E, " ASL", asl_m, absolute);
-    SET_INSTRUCTION(0x1E, " ASL", asl_m, absolute_x_modify);
+    SET_INSTRUCTION(0x0A, " ASL", asl_a, accumulator, BLOCK_NEXT);
+    SET_INSTRUCTION(0x06, " ASL", asl_m, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x16, " ASL", asl_m, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x0E, " ASL", asl_m, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x1E, " ASL", asl_m, absolute_x_modify, BLOCK_WRITE);
 
     /* AXS - AND X with Accumulator and Subtract. */
-    SET_INSTRUCTION(0xCB, "*AXS", axs, immediate);
+    SET_INSTRUCTION(0xCB, "*AXS", axs, immediate, BLOCK_NEXT);
 
     /* BCC - Branch if Carry Clear. */
-    SET_INSTRUCTION(0x90, " BCC", bcc, relative);
+    SET_INSTRUCTION(0x90, " BCC", bcc, relative, BLOCK_JUMP);
 
     /* BCS - Branch if Carry Set. */
-    SET_INSTRUCTION(0xB0, " BCS", bcs, relative);
+    SET_INSTRUCTION(0xB0, " BCS", bcs, relative, BLOCK_JUMP);
 
     /* BEQ - Branch if Equal. */
-    SET_INSTRUCTION(0xF0, " BEQ", beq, relative);
+    SET_INSTRUCTION(0xF0, " BEQ", beq, relative, BLOCK_JUMP);
 
     /* BIT - Bit Test. */
-    SET_INSTRUCTION(0x24, " BIT", bit, zero_page);
-    SET_INSTRUCTION(0x2C, " BIT", bit, absolute);
+    SET_INSTRUCTION(0x24, " BIT", bit, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x2C, " BIT", bit, absolute, BLOCK_NEXT);
 
     /* BMI - Branch if Minus. */
-    SET_INSTRUCTION(0x30, " BMI", bmi, relative);
+    SET_INSTRUCTION(0x30, " BMI", bmi, relative, BLOCK_JUMP);
 
     /* BNE - Branch if Not Equal. */
-    SET_INSTRUCTION(0xD0, " BNE", bne, relative);
+    SET_INSTRUCTION(0xD0, " BNE", bne, relative, BLOCK_JUMP);
 
     /* BPL - Branch if Positive. */
-    SET_INSTRUCTION(0x10, " BPL", bpl, relative);
+    SET_INSTRUCTION(0x10, " BPL", bpl, relative, BLOCK_JUMP);
 
     /* BRK - Force Interrupt. */
-    SET_INSTRUCTION(0x00, " BRK", brk, implied);
+    SET_INSTRUCTION(0x00, " BRK", brk, implied, BLOCK_JUMP);
 
     /* BVC - Branch if Overflow Clear. */
-    SET_INSTRUCTION(0x50, " BVC", bvc, relative);
+    SET_INSTRUCTION(0x50, " BVC", bvc, relative, BLOCK_JUMP);
 
     /* BVS - Branch if Overflow Set. */
-    SET_INSTRUCTION(0x70, " BVS", bvs, relative);
+    SET_INSTRUCTION(0x70, " BVS", bvs, relative, BLOCK_JUMP);
 
     /* CLC - Clear Carry Flag. */
-    SET_INSTRUCTION(0x18, " CLC", clc, implied);
+    SET_INSTRUCTION(0x18, " CLC", clc, implied, BLOCK_NEXT);
 
     /* CLD - Clear Decimal Mode. */
-    SET_INSTRUCTION(0xD8, " CLD", cld, implied);
+    SET_INSTRUCTION(0xD8, " CLD", cld, implied, BLOCK_NEXT);
 
     /* CLI - Clear Interrupt Disable. */
-    SET_INSTRUCTION(0x58, " CLI", cli, implied);
+    SET_INSTRUCTION(0x58, " CLI", cli, implied, BLOCK_NEXT);
 
     /* CLV - Clear Overflow Flag. */
-    SET_INSTRUCTION(0xB8, " CLV", clv, implied);
+    SET_INSTRUCTION(0xB8, " CLV", clv, implied, BLOCK_NEXT);
 
     /* CMP - Compare. */
-    SET_INSTRUCTION(0xC9, " CMP", cmp, immediate);
-    SET_INSTRUCTION(0xC5, " CMP", cmp, zero_page);
-    SET_INSTRUCTION(0xD5, " CMP", cmp, zero_page_x);
-    SET_INSTRUCTION(0xCD, " CMP", cmp, absolute);
-    SET_INSTRUCTION(0xDD, " CMP", cmp, absolute_x);
-    SET_INSTRUCTION(0xD9, " CMP", cmp, absolute_y);
-    SET_INSTRUCTION(0xC1, " CMP", cmp, indirect_x);
-    SET_INSTRUCTION(0xD1, " CMP", cmp, indirect_y);
+    SET_INSTRUCTION(0xC9, " CMP", cmp, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xC5, " CMP", cmp, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xD5, " CMP", cmp, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xCD, " CMP", cmp, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0xDD, " CMP", cmp, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xD9, " CMP", cmp, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0xC1, " CMP", cmp, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xD1, " CMP", cmp, indirect_y, BLOCK_NEXT);
 
     /* CPX - Compare X Register. */
-    SET_INSTRUCTION(0xE0, " CPX", cpx, immediate);
-    SET_INSTRUCTION(0xE4, " CPX", cpx, zero_page);
-    SET_INSTRUCTION(0xEC, " CPX", cpx, absolute);
+    SET_INSTRUCTION(0xE0, " CPX", cpx, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xE4, " CPX", cpx, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xEC, " CPX", cpx, absolute, BLOCK_NEXT);
 
     /* CPY - Compare Y Register. */
-    SET_INSTRUCTION(0xC0, " CPY", cpy, immediate);
-    SET_INSTRUCTION(0xC4, " CPY", cpy, zero_page);
-    SET_INSTRUCTION(0xCC, " CPY", cpy, absolute);
+    SET_INSTRUCTION(0xC0, " CPY", cpy, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xC4, " CPY", cpy, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xCC, " CPY", cpy, absolute, BLOCK_NEXT);
 
     /* DEC - Decrement Memory. */
-    SET_INSTRUCTION(0xC6, " DEC", dec, zero_page);
-    SET_INSTRUCTION(0xD6, " DEC", dec, zero_page_x);
-    SET_INSTRUCTION(0xCE, " DEC", dec, absolute);
-    SET_INSTRUCTION(0xDE, " DEC", dec, absolute_x_modify);
+    SET_INSTRUCTION(0xC6, " DEC", dec, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xD6, " DEC", dec, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xCE, " DEC", dec, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0xDE, " DEC", dec, absolute_x_modify, BLOCK_WRITE);
 
     /* DEX - Decrement X Register. */
-    SET_INSTRUCTION(0xCA, " DEX", dex, implied);
+    SET_INSTRUCTION(0xCA, " DEX", dex, implied, BLOCK_NEXT);
 
     /* DEY - Decrement Y Register. */
-    SET_INSTRUCTION(0x88, " DEY", dey, implied);
+    SET_INSTRUCTION(0x88, " DEY", dey, implied, BLOCK_NEXT);
 
     /* DCP - Decrement and Compare. */
-    SET_INSTRUCTION(0xC7, "*DCP", dcp, zero_page);
-    SET_INSTRUCTION(0xD7, "*DCP", dcp, zero_page_x);
-    SET_INSTRUCTION(0xCF, "*DCP", dcp, absolute);
-    SET_INSTRUCTION(0xDF, "*DCP", dcp, absolute_x_modify);
-    SET_INSTRUCTION(0xDB, "*DCP", dcp, absolute_y);
-    SET_INSTRUCTION(0xC3, "*DCP", dcp, indirect_x);
-    SET_INSTRUCTION(0xD3, "*DCP", dcp, indirect_y);
+    SET_INSTRUCTION(0xC7, "*DCP", dcp, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xD7, "*DCP", dcp, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xCF, "*DCP", dcp, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0xDF, "*DCP", dcp, absolute_x_modify, BLOCK_WRITE);
+    SET_INSTRUCTION(0xDB, "*DCP", dcp, absolute_y, BLOCK_WRITE);
+    SET_INSTRUCTION(0xC3, "*DCP", dcp, indirect_x, BLOCK_WRITE);
+    SET_INSTRUCTION(0xD3, "*DCP", dcp, indirect_y, BLOCK_WRITE);
 
     /* EOR - Exclusive OR. */
-    SET_INSTRUCTION(0x49, " EOR", eor, immediate);
-    SET_INSTRUCTION(0x45, " EOR", eor, zero_page);
-    SET_INSTRUCTION(0x55, " EOR", eor, zero_page_x);
-    SET_INSTRUCTION(0x4D, " EOR", eor, absolute);
-    SET_INSTRUCTION(0x5D, " EOR", eor, absolute_x);
-    SET_INSTRUCTION(0x59, " EOR", eor, absolute_y);
-    SET_INSTRUCTION(0x41, " EOR", eor, indirect_x);
-    SET_INSTRUCTION(0x51, " EOR", eor, indirect_y);
+    SET_INSTRUCTION(0x49, " EOR", eor, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x45, " EOR", eor, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x55, " EOR", eor, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x4D, " EOR", eor, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0x5D, " EOR", eor, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x59, " EOR", eor, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0x41, " EOR", eor, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x51, " EOR", eor, indirect_y, BLOCK_NEXT);
 
     /* HLT - Halt. */
-    SET_INSTRUCTION(0x02, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x12, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x22, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x32, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x42, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x52, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x62, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x72, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0x92, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0xB2, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0xD2, "*HLT", hlt, immediate);
-    SET_INSTRUCTION(0xF2, "*HLT", hlt, immediate);
+    SET_INSTRUCTION(0x02, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x12, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x22, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x32, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x42, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x52, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x62, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x72, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0x92, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0xB2, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0xD2, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
+    SET_INSTRUCTION(0xF2, "*HLT", hlt, immediate, BLOCK_EXCLUDE);
 
     /* INC - Increment Memory. */
-    SET_INSTRUCTION(0xE6, " INC", inc, zero_page);
-    SET_INSTRUCTION(0xF6, " INC", inc, zero_page_x);
-    SET_INSTRUCTION(0xEE, " INC", inc, absolute);
-    SET_INSTRUCTION(0xFE, " INC", inc, absolute_x_modify);
+    SET_INSTRUCTION(0xE6, " INC", inc, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xF6, " INC", inc, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xEE, " INC", inc, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0xFE, " INC", inc, absolute_x_modify, BLOCK_WRITE);
 
     /* INX - Increment X Register. */
-    SET_INSTRUCTION(0xE8, " INX", inx, implied);
+    SET_INSTRUCTION(0xE8, " INX", inx, implied, BLOCK_NEXT);
 
     /* INY - Increment Y Register. */
-    SET_INSTRUCTION(0xC8, " INY", iny, implied);
+    SET_INSTRUCTION(0xC8, " INY", iny, implied, BLOCK_NEXT);
 
     /* ISB - Increment and subtract. */
-    SET_INSTRUCTION(0xE7, "*ISB", isb, zero_page);
-    SET_INSTRUCTION(0xF7, "*ISB", isb, zero_page_x);
-    SET_INSTRUCTION(0xEF, "*ISB", isb, absolute);
-    SET_INSTRUCTION(0xFF, "*ISB", isb, absolute_x_modify);
-    SET_INSTRUCTION(0xFB, "*ISB", isb, absolute_y);
-    SET_INSTRUCTION(0xE3, "*ISB", isb, indirect_x);
-    SET_INSTRUCTION(0xF3, "*ISB", isb, indirect_y);
+    SET_INSTRUCTION(0xE7, "*ISB", isb, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xF7, "*ISB", isb, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xEF, "*ISB", isb, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0xFF, "*ISB", isb, absolute_x_modify, BLOCK_WRITE);
+    SET_INSTRUCTION(0xFB, "*ISB", isb, absolute_y, BLOCK_WRITE);
+    SET_INSTRUCTION(0xE3, "*ISB", isb, indirect_x, BLOCK_WRITE);
+    SET_INSTRUCTION(0xF3, "*ISB", isb, indirect_y, BLOCK_WRITE);
 
     /* JMP - Jump. */
-    SET_INSTRUCTION(0x4C, " JMP", jmp_absolute, absolute_jump);
-    SET_INSTRUCTION(0x6C, " JMP", jmp_indirect, indirect);
+    SET_INSTRUCTION(0x4C, " JMP", jmp_absolute, absolute_jump, BLOCK_JUMP);
+    SET_INSTRUCTION(0x6C, " JMP", jmp_indirect, indirect, BLOCK_JUMP);
 
     /* JSR - Jump to Subroutine. */
-    SET_INSTRUCTION(0x20, " JSR", jsr, absolute_jump);
+    SET_INSTRUCTION(0x20, " JSR", jsr, absolute_jump, BLOCK_JUMP);
 
     /* LAX - Load Accumulator and X. */
-    SET_INSTRUCTION(0xAB, "*LAX", lax, immediate);
-    SET_INSTRUCTION(0xA7, "*LAX", lax, zero_page);
-    SET_INSTRUCTION(0xB7, "*LAX", lax, zero_page_y);
-    SET_INSTRUCTION(0xAF, "*LAX", lax, absolute);
-    SET_INSTRUCTION(0xBF, "*LAX", lax, absolute_y);
-    SET_INSTRUCTION(0xA3, "*LAX", lax, indirect_x);
-    SET_INSTRUCTION(0xB3, "*LAX", lax, indirect_y);
+    SET_INSTRUCTION(0xAB, "*LAX", lax, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xA7, "*LAX", lax, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xB7, "*LAX", lax, zero_page_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0xAF, "*LAX", lax, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0xBF, "*LAX", lax, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0xA3, "*LAX", lax, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xB3, "*LAX", lax, indirect_y, BLOCK_NEXT);
 
     /* LDA - Load Accumulator. */
-    SET_INSTRUCTION(0xA9, " LDA", lda, immediate);
-    SET_INSTRUCTION(0xA5, " LDA", lda, zero_page);
-    SET_INSTRUCTION(0xB5, " LDA", lda, zero_page_x);
-    SET_INSTRUCTION(0xAD, " LDA", lda, absolute);
-    SET_INSTRUCTION(0xBD, " LDA", lda, absolute_x);
-    SET_INSTRUCTION(0xB9, " LDA", lda, absolute_y);
-    SET_INSTRUCTION(0xA1, " LDA", lda, indirect_x);
-    SET_INSTRUCTION(0xB1, " LDA", lda, indirect_y);
+    SET_INSTRUCTION(0xA9, " LDA", lda, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xA5, " LDA", lda, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xB5, " LDA", lda, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xAD, " LDA", lda, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0xBD, " LDA", lda, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xB9, " LDA", lda, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0xA1, " LDA", lda, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xB1, " LDA", lda, indirect_y, BLOCK_NEXT);
 
     /* LDX - Load X Register. */
-    SET_INSTRUCTION(0xA2, " LDX", ldx, immediate);
-    SET_INSTRUCTION(0xA6, " LDX", ldx, zero_page);
-    SET_INSTRUCTION(0xB6, " LDX", ldx, zero_page_y);
-    SET_INSTRUCTION(0xAE, " LDX", ldx, absolute);
-    SET_INSTRUCTION(0xBE, " LDX", ldx, absolute_y);
+    SET_INSTRUCTION(0xA2, " LDX", ldx, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xA6, " LDX", ldx, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xB6, " LDX", ldx, zero_page_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0xAE, " LDX", ldx, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0xBE, " LDX", ldx, absolute_y, BLOCK_NEXT);
 
     /* LDY - Load Y Register. */
-    SET_INSTRUCTION(0xA0, " LDY", ldy, immediate);
-    SET_INSTRUCTION(0xA4, " LDY", ldy, zero_page);
-    SET_INSTRUCTION(0xB4, " LDY", ldy, zero_page_x);
-    SET_INSTRUCTION(0xAC, " LDY", ldy, absolute);
-    SET_INSTRUCTION(0xBC, " LDY", ldy, absolute_x);
+    SET_INSTRUCTION(0xA0, " LDY", ldy, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xA4, " LDY", ldy, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xB4, " LDY", ldy, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xAC, " LDY", ldy, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0xBC, " LDY", ldy, absolute_x, BLOCK_NEXT);
 
     /* LSR - Logical Shift Right. */
-    SET_INSTRUCTION(0x4A, " LSR", lsr_a, accumulator);
-    SET_INSTRUCTION(0x46, " LSR", lsr_m, zero_page);
-    SET_INSTRUCTION(0x56, " LSR", lsr_m, zero_page_x);
-    SET_INSTRUCTION(0x4E, " LSR", lsr_m, absolute);
-    SET_INSTRUCTION(0x5E, " LSR", lsr_m, absolute_x_modify);
+    SET_INSTRUCTION(0x4A, " LSR", lsr_a, accumulator, BLOCK_NEXT);
+    SET_INSTRUCTION(0x46, " LSR", lsr_m, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x56, " LSR", lsr_m, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x4E, " LSR", lsr_m, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x5E, " LSR", lsr_m, absolute_x_modify, BLOCK_WRITE);
 
     /* NOP - No Operation. */
-    SET_INSTRUCTION(0xEA, " NOP", nop, implied);
-    SET_INSTRUCTION(0x1A, "*NOP", nop, implied);
-    SET_INSTRUCTION(0x3A, "*NOP", nop, implied);
-    SET_INSTRUCTION(0x5A, "*NOP", nop, implied);
-    SET_INSTRUCTION(0x7A, "*NOP", nop, implied);
-    SET_INSTRUCTION(0xDA, "*NOP", nop, implied);
-    SET_INSTRUCTION(0xFA, "*NOP", nop, implied);
-    SET_INSTRUCTION(0x80, "*NOP", nop, immediate);
-    SET_INSTRUCTION(0x82, "*NOP", nop, immediate);
-    SET_INSTRUCTION(0xC2, "*NOP", nop, immediate);
-    SET_INSTRUCTION(0xE2, "*NOP", nop, immediate);
-    SET_INSTRUCTION(0x89, "*NOP", nop, immediate);
-    SET_INSTRUCTION(0x04, "*NOP", nop, zero_page);
-    SET_INSTRUCTION(0x44, "*NOP", nop, zero_page);
-    SET_INSTRUCTION(0x64, "*NOP", nop, zero_page);
-    SET_INSTRUCTION(0x14, "*NOP", nop, zero_page_x);
-    SET_INSTRUCTION(0x34, "*NOP", nop, zero_page_x);
-    SET_INSTRUCTION(0x54, "*NOP", nop, zero_page_x);
-    SET_INSTRUCTION(0x74, "*NOP", nop, zero_page_x);
-    SET_INSTRUCTION(0xD4, "*NOP", nop, zero_page_x);
-    SET_INSTRUCTION(0xF4, "*NOP", nop, zero_page_x);
-    SET_INSTRUCTION(0x0C, "*NOP", nop, absolute);
-    SET_INSTRUCTION(0x1C, "*NOP", nop, absolute_x);
-    SET_INSTRUCTION(0x3C, "*NOP", nop, absolute_x);
-    SET_INSTRUCTION(0x5C, "*NOP", nop, absolute_x);
-    SET_INSTRUCTION(0x7C, "*NOP", nop, absolute_x);
-    SET_INSTRUCTION(0xDC, "*NOP", nop, absolute_x);
-    SET_INSTRUCTION(0xFC, "*NOP", nop, absolute_x);
+    SET_INSTRUCTION(0xEA, " NOP", nop, implied, BLOCK_NEXT);
+    SET_INSTRUCTION(0x1A, "*NOP", nop, implied, BLOCK_NEXT);
+    SET_INSTRUCTION(0x3A, "*NOP", nop, implied, BLOCK_NEXT);
+    SET_INSTRUCTION(0x5A, "*NOP", nop, implied, BLOCK_NEXT);
+    SET_INSTRUCTION(0x7A, "*NOP", nop, implied, BLOCK_NEXT);
+    SET_INSTRUCTION(0xDA, "*NOP", nop, implied, BLOCK_NEXT);
+    SET_INSTRUCTION(0xFA, "*NOP", nop, implied, BLOCK_NEXT);
+    SET_INSTRUCTION(0x80, "*NOP", nop, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x82, "*NOP", nop, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xC2, "*NOP", nop, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xE2, "*NOP", nop, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x89, "*NOP", nop, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x04, "*NOP", nop, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x44, "*NOP", nop, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x64, "*NOP", nop, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x14, "*NOP", nop, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x34, "*NOP", nop, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x54, "*NOP", nop, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x74, "*NOP", nop, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xD4, "*NOP", nop, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xF4, "*NOP", nop, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x0C, "*NOP", nop, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0x1C, "*NOP", nop, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x3C, "*NOP", nop, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x5C, "*NOP", nop, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x7C, "*NOP", nop, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xDC, "*NOP", nop, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xFC, "*NOP", nop, absolute_x, BLOCK_NEXT);
 
     /* ORA - Logical Inclusive OR. */
-    SET_INSTRUCTION(0x09, " ORA", ora, immediate);
-    SET_INSTRUCTION(0x05, " ORA", ora, zero_page);
-    SET_INSTRUCTION(0x15, " ORA", ora, zero_page_x);
-    SET_INSTRUCTION(0x0D, " ORA", ora, absolute);
-    SET_INSTRUCTION(0x1D, " ORA", ora, absolute_x);
-    SET_INSTRUCTION(0x19, " ORA", ora, absolute_y);
-    SET_INSTRUCTION(0x01, " ORA", ora, indirect_x);
-    SET_INSTRUCTION(0x11, " ORA", ora, indirect_y);
+    SET_INSTRUCTION(0x09, " ORA", ora, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0x05, " ORA", ora, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x15, " ORA", ora, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x0D, " ORA", ora, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0x1D, " ORA", ora, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x19, " ORA", ora, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0x01, " ORA", ora, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x11, " ORA", ora, indirect_y, BLOCK_NEXT);
 
     /* PHA - Push Accumulator. */
-    SET_INSTRUCTION(0x48, " PHA", pha, implied);
+    SET_INSTRUCTION(0x48, " PHA", pha, implied, BLOCK_NEXT);
 
     /* PHP - Push Processor Status. */
-    SET_INSTRUCTION(0x08, " PHP", php, implied);
+    SET_INSTRUCTION(0x08, " PHP", php, implied, BLOCK_NEXT);
 
     /* PLA - Pull Accumulator. */
-    SET_INSTRUCTION(0x68, " PLA", pla, implied);
+    SET_INSTRUCTION(0x68, " PLA", pla, implied, BLOCK_NEXT);
 
     /* PLP - Pull Processor Status. */
-    SET_INSTRUCTION(0x28, " PLP", plp, implied);
+    SET_INSTRUCTION(0x28, " PLP", plp, implied, BLOCK_NEXT);
 
     /* RLA - Rotate Left and AND. */
-    SET_INSTRUCTION(0x27, "*RLA", rla, zero_page);
-    SET_INSTRUCTION(0x37, "*RLA", rla, zero_page_x);
-    SET_INSTRUCTION(0x2F, "*RLA", rla, absolute);
-    SET_INSTRUCTION(0x3F, "*RLA", rla, absolute_x_modify);
-    SET_INSTRUCTION(0x3B, "*RLA", rla, absolute_y);
-    SET_INSTRUCTION(0x23, "*RLA", rla, indirect_x);
-    SET_INSTRUCTION(0x33, "*RLA", rla, indirect_y);
+    SET_INSTRUCTION(0x27, "*RLA", rla, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x37, "*RLA", rla, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x2F, "*RLA", rla, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x3F, "*RLA", rla, absolute_x_modify, BLOCK_WRITE);
+    SET_INSTRUCTION(0x3B, "*RLA", rla, absolute_y, BLOCK_WRITE);
+    SET_INSTRUCTION(0x23, "*RLA", rla, indirect_x, BLOCK_WRITE);
+    SET_INSTRUCTION(0x33, "*RLA", rla, indirect_y, BLOCK_WRITE);
 
     /* ROL - Rotate Left. */
-    SET_INSTRUCTION(0x2A, " ROL", rol_a, accumulator);
-    SET_INSTRUCTION(0x26, " ROL", rol_m, zero_page);
-    SET_INSTRUCTION(0x36, " ROL", rol_m, zero_page_x);
-    SET_INSTRUCTION(0x2E, " ROL", rol_m, absolute);
-    SET_INSTRUCTION(0x3E, " ROL", rol_m, absolute_x_modify);
+    SET_INSTRUCTION(0x2A, " ROL", rol_a, accumulator, BLOCK_NEXT);
+    SET_INSTRUCTION(0x26, " ROL", rol_m, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x36, " ROL", rol_m, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x2E, " ROL", rol_m, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x3E, " ROL", rol_m, absolute_x_modify, BLOCK_WRITE);
 
     /* ROR - Rotate Right. */
-    SET_INSTRUCTION(0x6A, " ROR", ror_a, accumulator);
-    SET_INSTRUCTION(0x66, " ROR", ror_m, zero_page);
-    SET_INSTRUCTION(0x76, " ROR", ror_m, zero_page_x);
-    SET_INSTRUCTION(0x6E, " ROR", ror_m, absolute);
-    SET_INSTRUCTION(0x7E, " ROR", ror_m, absolute_x_modify);
+    SET_INSTRUCTION(0x6A, " ROR", ror_a, accumulator, BLOCK_NEXT);
+    SET_INSTRUCTION(0x66, " ROR", ror_m, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x76, " ROR", ror_m, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x6E, " ROR", ror_m, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x7E, " ROR", ror_m, absolute_x_modify, BLOCK_WRITE);
 
     /* RRA - Rotate Right and Add. */
-    SET_INSTRUCTION(0x67, "*RRA", rra, zero_page);
-    SET_INSTRUCTION(0x77, "*RRA", rra, zero_page_x);
-    SET_INSTRUCTION(0x6F, "*RRA", rra, absolute);
-    SET_INSTRUCTION(0x7F, "*RRA", rra, absolute_x_modify);
-    SET_INSTRUCTION(0x7B, "*RRA", rra, absolute_y);
-    SET_INSTRUCTION(0x63, "*RRA", rra, indirect_x);
-    SET_INSTRUCTION(0x73, "*RRA", rra, indirect_y);
+    SET_INSTRUCTION(0x67, "*RRA", rra, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x77, "*RRA", rra, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x6F, "*RRA", rra, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x7F, "*RRA", rra, absolute_x_modify, BLOCK_WRITE);
+    SET_INSTRUCTION(0x7B, "*RRA", rra, absolute_y, BLOCK_WRITE);
+    SET_INSTRUCTION(0x63, "*RRA", rra, indirect_x, BLOCK_WRITE);
+    SET_INSTRUCTION(0x73, "*RRA", rra, indirect_y, BLOCK_WRITE);
 
     /* RTI - Return from Interrupt. */
-    SET_INSTRUCTION(0x40, " RTI", rti, implied);
+    SET_INSTRUCTION(0x40, " RTI", rti, implied, BLOCK_JUMP);
 
     /* RTS - Return from Subroutine. */
-    SET_INSTRUCTION(0x60, " RTS", rts, implied);
+    SET_INSTRUCTION(0x60, " RTS", rts, implied, BLOCK_JUMP);
 
     /* SAX - Store Accumulator AND X. */
-    SET_INSTRUCTION(0x87, "*SAX", sax, zero_page_write);
-    SET_INSTRUCTION(0x97, "*SAX", sax, zero_page_y_write);
-    SET_INSTRUCTION(0x8F, "*SAX", sax, absolute_write);
-    SET_INSTRUCTION(0x83, "*SAX", sax, indirect_x_write); 
+    SET_INSTRUCTION(0x87, "*SAX", sax, zero_page_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x97, "*SAX", sax, zero_page_y_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x8F, "*SAX", sax, absolute_write, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x83, "*SAX", sax, indirect_x_write, BLOCK_WRITE); 
 
     /* SBC - Subtract with Carry. */
-    SET_INSTRUCTION(0xE9, " SBC", sbc, immediate);
-    SET_INSTRUCTION(0xEB, "*SBC", sbc, immediate);
-    SET_INSTRUCTION(0xE5, " SBC", sbc, zero_page);
-    SET_INSTRUCTION(0xF5, " SBC", sbc, zero_page_x);
-    SET_INSTRUCTION(0xED, " SBC", sbc, absolute);
-    SET_INSTRUCTION(0xFD, " SBC", sbc, absolute_x);
-    SET_INSTRUCTION(0xF9, " SBC", sbc, absolute_y);
-    SET_INSTRUCTION(0xE1, " SBC", sbc, indirect_x);
-    SET_INSTRUCTION(0xF1, " SBC", sbc, indirect_y);
+    SET_INSTRUCTION(0xE9, " SBC", sbc, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xEB, "*SBC", sbc, immediate, BLOCK_NEXT);
+    SET_INSTRUCTION(0xE5, " SBC", sbc, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0xF5, " SBC", sbc, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xED, " SBC", sbc, absolute, BLOCK_NEXT);
+    SET_INSTRUCTION(0xFD, " SBC", sbc, absolute_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xF9, " SBC", sbc, absolute_y, BLOCK_NEXT);
+    SET_INSTRUCTION(0xE1, " SBC", sbc, indirect_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0xF1, " SBC", sbc, indirect_y, BLOCK_NEXT);
 
     /* SEC - Set Carry Flag. */
-    SET_INSTRUCTION(0x38, " SEC", sec, implied);
+    SET_INSTRUCTION(0x38, " SEC", sec, implied, BLOCK_NEXT);
 
     /* SEC - Set Decimal Flag. */
-    SET_INSTRUCTION(0xF8, " SED", sed, implied);
+    SET_INSTRUCTION(0xF8, " SED", sed, implied, BLOCK_NEXT);
 
     /* SEI - Set Interrupt Disable. */
-    SET_INSTRUCTION(0x78, " SEI", sei, implied);
+    SET_INSTRUCTION(0x78, " SEI", sei, implied, BLOCK_NEXT);
 
     /* SLO - Shift Left and Inclusive OR. */
-    SET_INSTRUCTION(0x07, "*SLO", slo, zero_page);
-    SET_INSTRUCTION(0x17, "*SLO", slo, zero_page_x);
-    SET_INSTRUCTION(0x0F, "*SLO", slo, absolute);
-    SET_INSTRUCTION(0x1F, "*SLO", slo, absolute_x_modify);
-    SET_INSTRUCTION(0x1B, "*SLO", slo, absolute_y);
-    SET_INSTRUCTION(0x03, "*SLO", slo, indirect_x);
-    SET_INSTRUCTION(0x13, "*SLO", slo, indirect_y);
+    SET_INSTRUCTION(0x07, "*SLO", slo, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x17, "*SLO", slo, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x0F, "*SLO", slo, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x1F, "*SLO", slo, absolute_x_modify, BLOCK_WRITE);
+    SET_INSTRUCTION(0x1B, "*SLO", slo, absolute_y, BLOCK_WRITE);
+    SET_INSTRUCTION(0x03, "*SLO", slo, indirect_x, BLOCK_WRITE);
+    SET_INSTRUCTION(0x13, "*SLO", slo, indirect_y, BLOCK_WRITE);
 
     /* SRE - Shift Right and Exclusive OR. */
-    SET_INSTRUCTION(0x47, "*SRE", sre, zero_page);
-    SET_INSTRUCTION(0x57, "*SRE", sre, zero_page_x);
-    SET_INSTRUCTION(0x4F, "*SRE", sre, absolute);
-    SET_INSTRUCTION(0x5F, "*SRE", sre, absolute_x_modify);
-    SET_INSTRUCTION(0x5B, "*SRE", sre, absolute_y);
-    SET_INSTRUCTION(0x43, "*SRE", sre, indirect_x);
-    SET_INSTRUCTION(0x53, "*SRE", sre, indirect_y);
+    SET_INSTRUCTION(0x47, "*SRE", sre, zero_page, BLOCK_NEXT);
+    SET_INSTRUCTION(0x57, "*SRE", sre, zero_page_x, BLOCK_NEXT);
+    SET_INSTRUCTION(0x4F, "*SRE", sre, absolute, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x5F, "*SRE", sre, absolute_x_modify, BLOCK_WRITE);
+    SET_INSTRUCTION(0x5B, "*SRE", sre, absolute_y, BLOCK_WRITE);
+    SET_INSTRUCTION(0x43, "*SRE", sre, indirect_x, BLOCK_WRITE);
+    SET_INSTRUCTION(0x53, "*SRE", sre, indirect_y, BLOCK_WRITE);
 
     /* STA - Store Accumulator. */
-    SET_INSTRUCTION(0x85, " STA", sta, zero_page_write);
-    SET_INSTRUCTION(0x95, " STA", sta, zero_page_x_write);
-    SET_INSTRUCTION(0x8D, " STA", sta, absolute_write);
-    SET_INSTRUCTION(0x9D, " STA", sta, absolute_x_write);
-    SET_INSTRUCTION(0x99, " STA", sta, absolute_y_write);
-    SET_INSTRUCTION(0x81, " STA", sta, indirect_x_write);
-    SET_INSTRUCTION(0x91, " STA", sta, indirect_y);
+    SET_INSTRUCTION(0x85, " STA", sta, zero_page_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x95, " STA", sta, zero_page_x_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x8D, " STA", sta, absolute_write, BLOCK_WRITE_ABSOLUTE);
+    SET_INSTRUCTION(0x9D, " STA", sta, absolute_x_write, BLOCK_WRITE);
+    SET_INSTRUCTION(0x99, " STA", sta, absolute_y_write, BLOCK_WRITE);
+    SET_INSTRUCTION(0x81, " STA", sta, indirect_x_write, BLOCK_WRITE);
+    SET_INSTRUCTION(0x91, " STA", sta, indirect_y_write, BLOCK_WRITE);
 
     /* STX - Store X Register. */
-    SET_INSTRUCTION(0x86, " STX", stx, zero_page_write);
-    SET_INSTRUCTION(0x96, " STX", stx, zero_page_y_write);
-    SET_INSTRUCTION(0x8E, " STX", stx, absolute_write);
+    SET_INSTRUCTION(0x86, " STX", stx, zero_page_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x96, " STX", stx, zero_page_y_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x8E, " STX", stx, absolute_write, BLOCK_WRITE_ABSOLUTE);
 
     /* STY - Store Y Register. */
-    SET_INSTRUCTION(0x84, " STY", sty, zero_page_write);
-    SET_INSTRUCTION(0x94, " STY", sty, zero_page_x_write);
-    SET_INSTRUCTION(0x8C, " STY", sty, absolute_write);
+    SET_INSTRUCTION(0x84, " STY", sty, zero_page_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x94, " STY", sty, zero_page_x_write, BLOCK_NEXT);
+    SET_INSTRUCTION(0x8C, " STY", sty, absolute_write, BLOCK_WRITE_ABSOLUTE);
 
     /* TAX - Transfer Accumulator to X. */
-    SET_INSTRUCTION(0xAA, " TAX", tax, implied);
+    SET_INSTRUCTION(0xAA, " TAX", tax, implied, BLOCK_NEXT);
 
     /* TAY - Transfer Accumulator to Y. */
-    SET_INSTRUCTION(0xA8, " TAY", tay, implied);
+    SET_INSTRUCTION(0xA8, " TAY", tay, implied, BLOCK_NEXT);
 
     /* TSX - Transfer Stack Pointer to X. */
-    SET_INSTRUCTION(0xBA, " TSX", tsx, implied);
+    SET_INSTRUCTION(0xBA, " TSX", tsx, implied, BLOCK_NEXT);
 
     /* TSA - Transfer X to Accumulator. */
-    SET_INSTRUCTION(0x8A, " TXA", txa, implied);
+    SET_INSTRUCTION(0x8A, " TXA", txa, implied, BLOCK_NEXT);
 
     /* TXS - Transfer X to Stack Pointer. */
-    SET_INSTRUCTION(0x9A, " TXS", txs, implied);
+    SET_INSTRUCTION(0x9A, " TXS", txs, implied, BLOCK_NEXT);
 
     /* TYA - Transfer Y to Accumulator. */
-    SET_INSTRUCTION(0x98, " TYA", tya, implied);
+    SET_INSTRUCTION(0x98, " TYA", tya, implied, BLOCK_NEXT);
 
     /* XAA - Transfer X to Accumulator and AND. */
-    SET_INSTRUCTION(0x8B, "*XAA", xaa, implied);
+    SET_INSTRUCTION(0x8B, "*XAA", xaa, implied, BLOCK_NEXT);
+}
+
+/* Superinstructions, indexed by the opcode of their first instruction. */
+static inline void init_superinstruction_table(void) {
+    cpu_superinstruction_table[0xCA] = dex_bne;         /* DEX; BNE */
+    cpu_superinstruction_table[0x88] = dey_bne;         /* DEY; BNE */
+    cpu_superinstruction_table[0xA5] = lda_sta_zp;      /* LDA zp; STA abs */
+    cpu_superinstruction_table[0xBD] = lda_sta_abs_x;   /* LDA abs,X; STA abs,X */
+    cpu_superinstruction_table[0xC9] = cmp_beq;         /* CMP #imm; BEQ */
+    cpu_superinstruction_table[0xE6] = inc_lda_zp;      /* INC zp; LDA zp */
 }
 
 /* -----------------------------------------------------------------
@@ -1113,30 +1438,40 @@ static inline void init_instruction_table(void) {
  * -------------------------------------------------------------- */
 
 void cpu_set_nmi(void) {
-    nmi = true;
+    machine.nmi = true;
 }
 
 void cpu_reset(void) {
-    cpu.S -= 3;
+    machine.cpu.S -= 3;
     flg_set_I();
-    /* ... */
+    machine.cpu.PC = mem_read_16(RESET_VECTOR);
+}
+
+static void init_tables(void) {
+    init_instruction_table();
+    init_superinstruction_table();
+    #ifdef NES_AOT_MODULE
+    init_aot_index();
+    #endif
 }
 
 void cpu_init(void) {
-    /* Initialize instruction table. */
-    if (!initialized_table) {
-        init_instruction_table();
-    }
-    initialized_table = true;
+    /* Initialize instruction table, once for all threads. */
+    pthread_once(&initialized_table, init_tables);
 
     /* Initialize CPU status. */
-    cpu = (CPU) { 0x0000, 0xFD, 0x00, 0x00, 0x00 };
-    cpu.PC = mem_read_16(RESET_VECTOR);
+    machine.cpu = (CPU) { 0x0000, 0xFD, 0x00, 0x00, 0x00 };
+    machine.cpu.PC = mem_read_16(RESET_VECTOR);
+    #ifdef NES_AOT_MODULE
+    memset(aot_pages, 0, sizeof(aot_pages));
+    #endif
 
     /* Clear RAM. */
+    mch_begin_write(machine.ram, RAM_SIZE);
     for (int i = 0; i < RAM_SIZE; i++) {
-        cpu.ram[i] = 0x00;
+        machine.ram[i] = 0x00;
     }
+    mch_end_write(machine.ram, RAM_SIZE);
 
     /* Clear all flags; IRQ disabled. */
     flg_reset();
@@ -1144,9 +1479,18 @@ void cpu_init(void) {
 }
 
 void cpu_execute(void) {
-    if (nmi) {
+    dispatch_frame = machine.ppu.frame;
+    if (machine.nmi) {
         cpu_interrupt(NMI_VECTOR);
-        nmi = false;
+        machine.nmi = false;
+    }
+    #ifdef NES_AOT_MODULE
+    else if (aot && aot_execute()) {
+        /* Ran a translated block. */
+    }
+    #endif
+    else if (blk_is_enabled() && block_execute()) {
+        /* Ran a decoded block. */
     }
     else {
         #ifdef CPU_LOGGING
@@ -1154,23 +1498,69 @@ void cpu_execute(void) {
         #endif
 
         opcode = cpu_fetch();               /* Fetch opcode. */
-        (*cpu_addressing_table[opcode])();  /* Fetch arguments. */
-        (*cpu_instruction_table[opcode])(); /* Execute operation. */
+        if (superinstructions && cpu_superinstruction_table[opcode]) {
+            (*cpu_superinstruction_table[opcode])();
+        }
+        else {
+            (*cpu_addressing_table[opcode])();  /* Fetch arguments. */
+            (*cpu_instruction_table[opcode])(); /* Execute operation. */
+        }
     }
+
+    dispatches++;
+}
+
+inline void cpu_set_superinstructions(bool enabled) {
+    superinstructions = enabled;
+}
+
+inline void cpu_set_aot(bool enabled) {
+    aot = enabled;
+}
+
+inline unsigned long long cpu_get_dispatches(void) {
+    return dispatches;
+}
+
+inline unsigned long long cpu_get_instructions(void) {
+    return dispatches + fused;
+}
+
+inline const char *cpu_get_operation_name(byte opcode) {
+    return cpu_operation_names[opcode];
+}
+
+inline const char *cpu_get_addressing_name(byte opcode) {
+    return cpu_addressing_names[opcode];
+}
+
+/* The block cache checks cached blocks with these, even before cpu_init. */
+inline BlockKind cpu_get_block_kind(byte opcode) {
+    pthread_once(&initialized_table, init_tables);
+    return cpu_block_table[opcode];
+}
+
+inline int cpu_get_length(byte opcode) {
+    pthread_once(&initialized_table, init_tables);
+    return cpu_length_table[opcode];
 }
 
 inline unsigned long long cpu_get_ticks(void) {
-    return cycles;
+    return machine.cycles;
 }
 
 inline void cpu_suspend(int num_cycles) {
-    cycles += num_cycles;
+    machine.cycles += num_cycles;
 }
 
 inline byte cpu_ram_read(word address) {
-    return cpu.ram[address];
+    return machine.ram[address];
+}
+
+inline byte *cpu_ram_page(word address) {
+    return &machine.ram[address & 0x700];
 }
 
 inline void cpu_ram_write(word address, byte data) {
-    cpu.ram[address] = data;
+    WRITE_MEMORY(machine.ram[address], data);
 }
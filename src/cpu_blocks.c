@@ -0,0 +1,289 @@
+/* -----------------------------------------------------------------
+ * Decoded block cache.
+ *
+ * Blocks are indexed by their CPU address in 0x8000-0xFFFF, with one
+ * block per bank that was mapped there. A block is only used while the
+ * code mapped at its address is the code it was decoded from.
+ *
+ * Cache files hold the blocks of one ROM: they are mapped read-only at
+ * startup, and replaced as a whole (write and rename) when new blocks
+ * were decoded, so processes can share them safely.
+ * -------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/cpu.h"
+#include "../include/cpu_blocks.h"
+#include "../include/log.h"
+#include "../include/memory.h"
+
+#define CACHE_MAGIC   "NESBLKS"
+#define CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];                  /* CACHE_MAGIC. */
+    dword version;                  /* CACHE_VERSION. */
+    dword num_blocks;               /* Number of blocks following the header. */
+    unsigned long long rom_hash;    /* Hash of the ROM the blocks are from. */
+} CacheHeader;
+
+typedef struct Entry {
+    const Block *block;             /* Block at this address. */
+    const byte *page;               /* Mapped code the block was last checked against. */
+    struct Entry *next;             /* Block of another bank at this address. */
+} Entry;
+
+typedef struct {
+    char *path;                     /* Cache file (NULL: none). */
+    unsigned long long rom_hash;
+
+    Entry *entries[0x8000];
+
+    /* Blocks mapped from the cache file. */
+    void *mapping;
+    size_t mapping_size;
+    const Block *mapped_blocks;
+    int num_mapped_blocks;
+
+    /* Blocks decoded since the cache was opened. */
+    Block **new_blocks;
+    int num_new_blocks, size_new_blocks;
+} Cache;
+
+/* Cache of the emulation thread (NULL: blocks are disabled). Every thread
+ * that runs a machine has its own, as blk_lookup reorders the entries. */
+static _Thread_local Cache *cache = NULL;
+
+static void add_entry(const Block *block) {
+    Entry *entry = malloc(sizeof(Entry));
+    if (entry == NULL) {
+        LOG_ERROR("Unable to allocate memory for decoded blocks.");
+    }
+
+    entry->block = block;
+    entry->page  = NULL;
+    entry->next  = cache->entries[block->address - 0x8000];
+    cache->entries[block->address - 0x8000] = entry;
+}
+
+static dword checksum(const Block *block) {
+    Block copy = *block;
+    copy.checksum = 0;
+
+    dword hash = 2166136261u;
+    const byte *data = (const byte *) &copy;
+    for (int i = 0; i < sizeof(Block); i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* The code must decode to exactly count instructions filling exactly
+ * length bytes, as run_block walks it, none of them left to the
+ * interpreter. */
+static bool is_valid(const Block *block) {
+    if (block->address < 0x8000 || block->count == 0 ||
+            block->length == 0 || block->length > BLOCK_MAX_LENGTH ||
+            block->address + block->length > 0x10000 ||
+            block->checksum != checksum(block)) {
+        return false;
+    }
+
+    int length = 0, count = 0;
+    while (length < block->length) {
+        if (cpu_get_block_kind(block->code[length]) == BLOCK_EXCLUDE) {
+            return false;
+        }
+        length += cpu_get_length(block->code[length]);
+        count++;
+    }
+    return length == block->length && count == block->count;
+}
+
+static void map_cache_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+
+    /* Ignore files of another version or ROM, or of another size than
+     * their blocks take. */
+    const CacheHeader *header = data;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != CACHE_VERSION || header->rom_hash != cache->rom_hash ||
+            (st.st_size - sizeof(CacheHeader)) / sizeof(Block) != header->num_blocks ||
+            (st.st_size - sizeof(CacheHeader)) % sizeof(Block) != 0) {
+        LOG_WARNING("Ignoring stale block cache %s.", path);
+        munmap(data, st.st_size);
+        return;
+    }
+
+    /* A damaged block means the file cannot be trusted. */
+    const Block *blocks = (const Block *) (header + 1);
+    for (dword i = 0; i < header->num_blocks; i++) {
+        if (!is_valid(&blocks[i])) {
+            LOG_WARNING("Ignoring damaged block cache %s.", path);
+            munmap(data, st.st_size);
+            return;
+        }
+    }
+
+    cache->mapping = data;
+    cache->mapping_size = st.st_size;
+    cache->mapped_blocks = blocks;
+    cache->num_mapped_blocks = header->num_blocks;
+    for (int i = 0; i < cache->num_mapped_blocks; i++) {
+        add_entry(&cache->mapped_blocks[i]);
+    }
+}
+
+static bool write_cache_file(const char *path) {
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", path, (int) getpid());
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    CacheHeader header = { CACHE_MAGIC, CACHE_VERSION,
+        cache->num_mapped_blocks + cache->num_new_blocks, cache->rom_hash };
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(cache->mapped_blocks, sizeof(Block), cache->num_mapped_blocks, file) ==
+            cache->num_mapped_blocks;
+    for (int i = 0; i < cache->num_new_blocks && success; i++) {
+        success = fwrite(cache->new_blocks[i], sizeof(Block), 1, file) == 1;
+    }
+
+    success = fclose(file) == 0 && success;
+    if (!success || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return false;
+    }
+    return true;
+}
+
+void blk_open(const char *path, unsigned long long rom_hash) {
+    blk_close();
+
+    cache = calloc(1, sizeof(Cache));
+    if (cache == NULL) {
+        LOG_ERROR("Unable to allocate memory for decoded blocks.");
+    }
+
+    cache->rom_hash = rom_hash;
+    if (path != NULL) {
+        cache->path = strdup(path);
+        map_cache_file(path);
+    }
+}
+
+void blk_close(void) {
+    if (cache == NULL) {
+        return;
+    }
+
+    if (cache->path != NULL && cache->num_new_blocks > 0 && !write_cache_file(cache->path)) {
+        LOG_WARNING("Unable to write block cache %s.", cache->path);
+    }
+
+    if (cache->mapping != NULL) {
+        munmap(cache->mapping, cache->mapping_size);
+    }
+    for (int i = 0; i < cache->num_new_blocks; i++) {
+        free(cache->new_blocks[i]);
+    }
+    free(cache->new_blocks);
+    free(cache->path);
+
+    for (int i = 0; i < 0x8000; i++) {
+        while (cache->entries[i] != NULL) {
+            Entry *next = cache->entries[i]->next;
+            free(cache->entries[i]);
+            cache->entries[i] = next;
+        }
+    }
+    free(cache);
+    cache = NULL;
+}
+
+inline bool blk_is_enabled(void) {
+    return cache != NULL;
+}
+
+/* Check that a block is the code mapped at its address. */
+static inline bool is_mapped(Entry *entry) {
+    const Block *block = entry->block;
+
+    /* The code must be mapped contiguously, and be the decoded code. */
+    const byte *page = mem_page(block->address);
+    if (page == NULL ||
+            mem_page(block->address + block->length - 1) != page + block->length - 1) {
+        return false;
+    }
+    if (page != entry->page) {
+        if (memcmp(page, block->code, block->length) != 0) {
+            return false;
+        }
+        entry->page = page;
+    }
+
+    return true;
+}
+
+inline const Block *blk_lookup(word address) {
+    if (address < 0x8000) {
+        return NULL;
+    }
+
+    Entry **link = &cache->entries[address - 0x8000];
+    for (Entry *entry = *link; entry != NULL; link = &entry->next, entry = entry->next) {
+        if (is_mapped(entry)) {
+            /* Move the block of the current bank to the front. */
+            *link = entry->next;
+            entry->next = cache->entries[address - 0x8000];
+            cache->entries[address - 0x8000] = entry;
+            return entry->block;
+        }
+    }
+
+    return NULL;
+}
+
+const Block *blk_insert(Block *block) {
+    if (cache->num_new_blocks == cache->size_new_blocks) {
+        cache->size_new_blocks = cache->size_new_blocks ? 2 * cache->size_new_blocks : 256;
+        cache->new_blocks = realloc(cache->new_blocks, cache->size_new_blocks * sizeof(Block *));
+        if (cache->new_blocks == NULL) {
+            LOG_ERROR("Unable to allocate memory for decoded blocks.");
+        }
+    }
+
+    Block *copy = malloc(sizeof(Block));
+    if (copy == NULL) {
+        LOG_ERROR("Unable to allocate memory for decoded blocks.");
+    }
+    *copy = *block;
+    copy->checksum = checksum(copy);
+    cache->new_blocks[cache->num_new_blocks++] = copy;
+
+    add_entry(copy);
+    return copy;
+}
@@ -1,7 +1,8 @@
 #include "../include/cpu_flags.h"
 #include "../include/cpu_internal.h"
+#include "../include/machine.h"
 
-static byte lo, hi;
+static _Thread_local byte lo, hi;
 
 inline word cpu_fetch_16(void) {
     lo = cpu_fetch();
@@ -16,32 +17,32 @@ inline word cpu_read_16(word address) {
 }
 
 inline void cpu_push(byte data) {
-    cpu.ram[0x100 | cpu.S--] = data;
-    cycles++;
+    WRITE_MEMORY(machine.ram[0x100 | machine.cpu.S--], data);
+    machine.cycles++;
 }
 
 inline void cpu_push_address(word address) {
-    cpu.ram[0x100 | cpu.S--] = address >> 8;
-    cpu.ram[0x100 | cpu.S--] = address & 0xFF;
-    cycles += 2;
+    WRITE_MEMORY(machine.ram[0x100 | machine.cpu.S--], address >> 8);
+    WRITE_MEMORY(machine.ram[0x100 | machine.cpu.S--], address & 0xFF);
+    machine.cycles += 2;
 }
 
 inline byte cpu_pop(void) {
-    cycles++;
-    return cpu.ram[0x100 | ++cpu.S];
+    machine.cycles++;
+    return machine.ram[0x100 | ++machine.cpu.S];
 }
 
 inline word cpu_pop_address(void) {
-    cycles += 2;
-    lo = cpu.ram[0x100 | ++cpu.S];
-    hi = cpu.ram[0x100 | ++cpu.S];
+    machine.cycles += 2;
+    lo = machine.ram[0x100 | ++machine.cpu.S];
+    hi = machine.ram[0x100 | ++machine.cpu.S];
     return (hi << 8) | lo;
 }
 
 inline void cpu_interrupt(word vector) {
-    cycles += 2;
-    cpu_push_address(cpu.PC);
+    machine.cycles += 2;
+    cpu_push_address(machine.cpu.PC);
     cpu_push(flg_get_status(false));
-    cpu.PC = cpu_read_16(vector);
+    machine.cpu.PC = cpu_read_16(vector);
     flg_set_I();
 }
@@ -5,22 +5,23 @@
 #include "../include/cpu_internal.h"
 #include "../include/cpu_logging.h"
 #include "../include/log.h"
+#include "../include/machine.h"
 #include "../include/ppu_internal.h"
 
 #define LOG_INSTRUCTION_1() LOG_CPU(20, "%04X  %02X       %s",     \
-    cpu.PC, opcode, cpu_names_table[opcode]);
+    machine.cpu.PC, opcode, cpu_names_table[opcode]);
 #define LOG_INSTRUCTION_2() LOG_CPU(20, "%04X  %02X %02X    %s",   \
-    cpu.PC, opcode, mem_get(cpu.PC + 1), cpu_names_table[opcode]);
+    machine.cpu.PC, opcode, mem_get(machine.cpu.PC + 1), cpu_names_table[opcode]);
 #define LOG_INSTRUCTION_3() LOG_CPU(20, "%04X  %02X %02X %02X %s", \
-    cpu.PC, opcode, mem_get(cpu.PC + 1), mem_get(cpu.PC + 2),      \
+    machine.cpu.PC, opcode, mem_get(machine.cpu.PC + 1), mem_get(machine.cpu.PC + 2),      \
     cpu_names_table[opcode]);
 
-#define ARGUMENT    mem_get   (cpu.PC + 1)
-#define ARGUMENT_16 mem_get_16(cpu.PC + 1)
+#define ARGUMENT    mem_get   (machine.cpu.PC + 1)
+#define ARGUMENT_16 mem_get_16(machine.cpu.PC + 1)
 
 static Function cpu_logging_table[256];
 static char *cpu_names_table[256];
-static word opcode;
+static _Thread_local word opcode;
 
 inline void cpu_log_set_function(byte opcode, Function function) {
     cpu_logging_table[opcode] = function;
@@ -46,7 +47,7 @@ inline void cpu_log_absolute_jump(void) {
 
 inline void cpu_log_absolute_x(void) {
     word pointer = ARGUMENT_16;
-    word address = address + cpu.X;
+    word address = address + machine.cpu.X;
 
     LOG_INSTRUCTION_3();
     LOG_CPU(28, "$%04X,X @ %04X = %02X", pointer, address, mem_get(address));
@@ -54,7 +55,7 @@ inline void cpu_log_absolute_x(void) {
 
 inline void cpu_log_absolute_y(void) {
     word pointer = ARGUMENT_16;
-    word address = address + cpu.Y;
+    word address = address + machine.cpu.Y;
 
     LOG_INSTRUCTION_3();
     LOG_CPU(28, "$%04X,Y @ %04X = %02X", pointer, address, mem_get(address));
@@ -89,20 +90,20 @@ inline void cpu_log_indirect(void) {
 
 inline void cpu_log_indirect_x(void) {
     byte pointer = ARGUMENT;
-    byte lo = cpu.ram[(pointer + cpu.X) & 0xFF];
-    byte hi = cpu.ram[(pointer + cpu.X + 1) & 0xFF];
+    byte lo = machine.ram[(pointer + machine.cpu.X) & 0xFF];
+    byte hi = machine.ram[(pointer + machine.cpu.X + 1) & 0xFF];
     word address = (hi << 8) | lo;
 
     LOG_INSTRUCTION_2();
     LOG_CPU(28, "($%02X,X) @ %02X = %04X = %02X",
-        pointer, (pointer + cpu.X) & 0xFF, address, mem_get(address));
+        pointer, (pointer + machine.cpu.X) & 0xFF, address, mem_get(address));
 }
 
 inline void cpu_log_indirect_y(void) {
     byte pointer = ARGUMENT;
-    byte lo = cpu.ram[pointer];
-    byte hi = cpu.ram[(pointer + 1) & 0xFF];
-    word address = ((hi << 8) | lo) + cpu.Y;
+    byte lo = machine.ram[pointer];
+    byte hi = machine.ram[(pointer + 1) & 0xFF];
+    word address = ((hi << 8) | lo) + machine.cpu.Y;
 
     LOG_INSTRUCTION_2();
     LOG_CPU(28, "($%02X),Y = %04X @ %04X = %02X",
@@ -111,7 +112,7 @@ inline void cpu_log_indirect_y(void) {
 
 inline void cpu_log_relative(void) {
     LOG_INSTRUCTION_2();
-    LOG_CPU(28, "$%04X", (word) (cpu.PC + 2 + (int8_t) ARGUMENT));
+    LOG_CPU(28, "$%04X", (word) (machine.cpu.PC + 2 + (int8_t) ARGUMENT));
 }
 
 inline void cpu_log_zero_page(void) {
@@ -122,7 +123,7 @@ inline void cpu_log_zero_page(void) {
 
 inline void cpu_log_zero_page_x(void) {
     byte pointer = ARGUMENT;
-    byte address = (pointer + cpu.X) & 0xFF;
+    byte address = (pointer + machine.cpu.X) & 0xFF;
 
     LOG_INSTRUCTION_2();
     LOG_CPU(28, "$%02X,X @ %02X = %02X", pointer, address, mem_get(address));
@@ -130,16 +131,16 @@ inline void cpu_log_zero_page_x(void) {
 
 inline void cpu_log_zero_page_y(void) {
     byte pointer = ARGUMENT;
-    byte address = (pointer + cpu.Y) & 0xFF;
+    byte address = (pointer + machine.cpu.Y) & 0xFF;
 
     LOG_INSTRUCTION_2();
     LOG_CPU(28, "$%02X,Y @ %02X = %02X", pointer, address, mem_get(address));
 }
 
 inline void cpu_log_operation(void) {
-    opcode = mem_get(cpu.PC);
+    opcode = mem_get(machine.cpu.PC);
     (*cpu_logging_table[opcode])();
     LOG_CPU(33, "A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%3d SL:%d\n",
-        cpu.A, cpu.X, cpu.Y, flg_get_status(false), cpu.S, ppu.dot,
-        ppu.scanline);
+        machine.cpu.A, machine.cpu.X, machine.cpu.Y, flg_get_status(false), machine.cpu.S, machine.ppu.dot,
+        machine.ppu.scanline);
 }
@@ -0,0 +1,160 @@
+#include <string.h>
+#include "../include/machine.h"
+
+_Thread_local Machine machine;
+_Thread_local unsigned long long dirty_pages[NUM_DIRTY_WORDS];
+
+/* Pages that hold anything besides tracked memory. */
+static _Thread_local unsigned long long untracked_pages[NUM_DIRTY_WORDS];
+static _Thread_local bool initialized_untracked = false;
+
+void mch_mark_dirty(const void *pointer, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    size_t last = DIRTY_PAGE((const byte *) pointer + size - 1);
+    for (size_t page = DIRTY_PAGE(pointer); page <= last; page++) {
+        dirty_pages[page / 64] |= 1ull << (page % 64);
+    }
+}
+
+void mch_mark_all_dirty(void) {
+    memset(dirty_pages, 0xFF, sizeof(dirty_pages));
+}
+
+typedef struct {
+    const byte *start;
+    size_t size;
+} Region;
+
+/* Memory of the current machine that is written through WRITE_MEMORY;
+ * returns the number of regions. */
+static int hashed_regions(Region regions[]) {
+    regions[0] = (Region) { machine.ram,     RAM_SIZE };
+    regions[1] = (Region) { machine.prg_ram, PRG_RAM_SIZE };
+    regions[2] = (Region) { machine.chr_ram, CHR_RAM_SIZE };
+    regions[3] = (Region) { machine.ppu.palette,     PALETTE_SIZE };
+    regions[4] = (Region) { machine.ppu.oam,         OAM_SIZE };
+    regions[5] = (Region) { machine.ppu.nametable,   NAMETABLE_SIZE };
+    return 6;
+}
+
+static void init_untracked(void) {
+    /* Start from all pages, and clear those that lie entirely within
+     * tracked memory: the hashed memory and the colors. */
+    Region tracked[7];
+    int count = hashed_regions(tracked);
+    tracked[count++] = (Region) { (const byte *) machine.ppu.colors, sizeof(machine.ppu.colors) };
+
+    memset(untracked_pages, 0xFF, sizeof(untracked_pages));
+    for (int i = 0; i < count; i++) {
+        size_t offset = tracked[i].start - (const byte *) &machine;
+        size_t first = (offset + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+        size_t end   = (offset + tracked[i].size) / DIRTY_PAGE_SIZE;
+        for (size_t page = first; page < end; page++) {
+            untracked_pages[page / 64] &= ~(1ull << (page % 64));
+        }
+    }
+    initialized_untracked = true;
+}
+
+/* Copy the dirty and untracked pages from one machine to another. */
+static void copy_dirty(byte *dst, const byte *src) {
+    if (!initialized_untracked) {
+        init_untracked();
+    }
+
+    for (int i = 0; i < NUM_DIRTY_WORDS; i++) {
+        unsigned long long pages = dirty_pages[i] | untracked_pages[i];
+        dirty_pages[i] = 0;
+
+        while (pages != 0) {
+            size_t offset = (64 * i + __builtin_ctzll(pages)) * DIRTY_PAGE_SIZE;
+            if (offset >= sizeof(Machine)) {
+                break;
+            }
+            size_t size = sizeof(Machine) - offset < DIRTY_PAGE_SIZE ?
+                sizeof(Machine) - offset : DIRTY_PAGE_SIZE;
+            memcpy(dst + offset, src + offset, size);
+            pages &= pages - 1;
+        }
+    }
+}
+
+void mch_copy_dirty_to(Machine *snapshot) {
+    copy_dirty((byte *) snapshot, (const byte *) &machine);
+}
+
+void mch_copy_dirty_from(const Machine *snapshot) {
+    copy_dirty((byte *) &machine, (const byte *) snapshot);
+}
+
+/* Add or take out the hash of a range of memory. */
+static void toggle_hash(const byte *start, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        machine.memory_hash ^= mch_byte_hash(start + i, start[i]);
+    }
+}
+
+void mch_begin_write(const void *pointer, size_t size) {
+    toggle_hash(pointer, size);
+}
+
+void mch_end_write(const void *pointer, size_t size) {
+    toggle_hash(pointer, size);
+    mch_mark_dirty(pointer, size);
+}
+
+/* Hash the bytes of a range that change from old to new, comparing a word
+ * at a time. */
+static void hash_changes(const byte *start, const byte *old, const byte *new, size_t size) {
+    size_t j = 0;
+    for (; j + 8 <= size; j += 8) {
+        unsigned long long a, b;
+        memcpy(&a, new + j, 8);
+        memcpy(&b, old + j, 8);
+        if (a == b) {
+            continue;
+        }
+        for (size_t k = j; k < j + 8; k++) {
+            if (new[k] != old[k]) {
+                machine.memory_hash ^= mch_byte_hash(start + k, old[k]) ^
+                    mch_byte_hash(start + k, new[k]);
+            }
+        }
+    }
+    for (; j < size; j++) {
+        if (new[j] != old[j]) {
+            machine.memory_hash ^= mch_byte_hash(start + j, old[j]) ^
+                mch_byte_hash(start + j, new[j]);
+        }
+    }
+}
+
+void mch_write(void *destination, const void *source, size_t size) {
+    hash_changes(destination, destination, source, size);
+    memcpy(destination, source, size);
+    mch_mark_dirty(destination, size);
+}
+
+void mch_update_hash(const Machine *previous) {
+    Region regions[6];
+    int count = hashed_regions(regions);
+
+    for (int i = 0; i < count; i++) {
+        const byte *start = regions[i].start;
+        const byte *old = (const byte *) previous + (start - (const byte *) &machine);
+        hash_changes(start, old, start, regions[i].size);
+    }
+}
+
+void mch_rehash(void) {
+    Region regions[6];
+    int count = hashed_regions(regions);
+
+    machine.memory_hash = 0;
+    for (int i = 0; i < count; i++) {
+        toggle_hash(regions[i].start, regions[i].size);
+    }
+}
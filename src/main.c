@@ -2,20 +2,28 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "../include/boot_cache.h"
 #include "../include/controller.h"
 #include "../include/cpu.h"
+#include "../include/cpu_blocks.h"
+#include "../include/machine.h"
 #include "../include/memory.h"
+#include "../include/movie.h"
 #include "../include/nes.h"
-#include "../include/palette.h"
 #include "../include/ppu.h"
 #include "../include/ppu_internal.h"
+#include "../include/render.h"
+#include "../include/rewind.h"
+#include "../include/runahead.h"
 
 #define SCALE          2
 #define DISPLAY_WIDTH  256
 #define DISPLAY_HEIGHT 240
 
-void setRenderDrawColor(SDL_Renderer* renderer, SDL_Color c) {
-    SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
+/* Set the draw color from an RGBA (0xRRGGBBAA) color. */
+void setRenderDrawColor(SDL_Renderer* renderer, dword c) {
+    SDL_SetRenderDrawColor(renderer, c >> 24, (c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF);
 }
 
 static SDL_Window* window     = NULL;
@@ -24,6 +32,8 @@ static SDL_Renderer* renderer = NULL;
 static byte display[DISPLAY_WIDTH][DISPLAY_HEIGHT];
 
 static unsigned long long current_frame = 0;
+static unsigned long long input_frame = 0;
+static bool rewinding = false;
 
 static bool initialize(void) {
     /* Initialize SDL. */
@@ -76,13 +86,13 @@ static bool load_rom(char *path) {
 
 static void draw_display(SDL_Renderer* renderer) {
     /* Clear the screen. */
-    setRenderDrawColor(renderer, PALETTE[0]);
+    setRenderDrawColor(renderer, 0x000000FF);
     SDL_RenderClear(renderer);
 
     /* Draw all pixels on the display. */
     for (int x = 0; x < DISPLAY_WIDTH; x++) {
         for (int y = 0; y < DISPLAY_HEIGHT; y++) {
-            setRenderDrawColor(renderer, PALETTE[ppu_get_pixel(x, y)]);
+            setRenderDrawColor(renderer, ppu_get_pixel(x, y));
             SDL_Rect pixel = {SCALE * x, SCALE * y, SCALE, SCALE};
             SDL_RenderFillRect(renderer, &pixel);
         }
@@ -104,6 +114,7 @@ static void handle_event(SDL_Event* event) {
                 case SDLK_DOWN:     nes_controller1_set(BUTTON_DOWN,    true);  break;
                 case SDLK_LEFT:     nes_controller1_set(BUTTON_LEFT,    true);  break;
                 case SDLK_RIGHT:    nes_controller1_set(BUTTON_RIGHT,   true);  break;
+                case SDLK_BACKSPACE: rewinding = true;                          break;
             } break;
         case SDL_KEYUP:
             switch (event->key.keysym.sym) {
@@ -115,6 +126,7 @@ static void handle_event(SDL_Event* event) {
                 case SDLK_DOWN:     nes_controller1_set(BUTTON_DOWN,    false); break;
                 case SDLK_LEFT:     nes_controller1_set(BUTTON_LEFT,    false); break;
                 case SDLK_RIGHT:    nes_controller1_set(BUTTON_RIGHT,   false); break;
+                case SDLK_BACKSPACE: rewinding = false;                         break;
             } break;
     }
 }
@@ -122,6 +134,12 @@ static void handle_event(SDL_Event* event) {
 
 
 static void close(void) {
+    rdr_disable();
+    blk_close();
+    rwd_free();
+    rah_free();
+    mov_stop();
+
     /* Delete window and renderer. */
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -136,10 +154,45 @@ int main(int argc, char *argv[]) {
     /* Parse command line arguments. */
     if (argc < 2) {
         printf("Error: missing argument.\n");
-        printf("Usage: ./nes_emulator <path-to-rom>\n");
+        printf("Usage: ./nes_emulator [--deferred] [--superinstructions] [--block-cache <path>] [--rewind <MB>] [--run-ahead <frames>] [--boot-cache <dir> --boot-frame <n>] [--record <movie>] <path-to-rom>\n");
         return 1;
     }
 
+    bool deferred = false;
+    bool superinstructions = false;
+    char *block_cache = NULL;
+    int rewind_budget = 0;
+    int run_ahead = 0;
+    char *boot_cache = NULL;
+    int boot_frame = 0;
+    char *movie = NULL;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--deferred") == 0) {
+            deferred = true;
+        }
+        else if (strcmp(argv[i], "--superinstructions") == 0) {
+            superinstructions = true;
+        }
+        else if (strcmp(argv[i], "--block-cache") == 0 && i + 1 < argc - 1) {
+            block_cache = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc - 1) {
+            rewind_budget = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc - 1) {
+            run_ahead = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--boot-cache") == 0 && i + 1 < argc - 1) {
+            boot_cache = argv[++i];
+        }
+        else if (strcmp(argv[i], "--boot-frame") == 0 && i + 1 < argc - 1) {
+            boot_frame = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc - 1) {
+            movie = argv[++i];
+        }
+    }
+
     /* Start up SDL and create window. */
     if (!initialize()) {
         printf("Failed to initialize SDL.\n");
@@ -147,7 +200,7 @@ int main(int argc, char *argv[]) {
     }
 
     /* Attempt to load the ROM. */
-    if (!load_rom(argv[1])) {
+    if (!load_rom(argv[argc - 1])) {
         printf("Failed to load ROM.\n");
         return 1;
     }
@@ -155,6 +208,39 @@ int main(int argc, char *argv[]) {
     cpu_init();
     nes_init();
 
+    /* Render frames on a worker thread. */
+    if (deferred) {
+        rdr_enable();
+    }
+
+    /* Run common instruction pairs by one dispatch. */
+    cpu_set_superinstructions(superinstructions);
+
+    /* Run decoded blocks, kept in a cache file shared by all runs of the ROM. */
+    if (block_cache != NULL) {
+        blk_open(block_cache, nes_get_rom_hash());
+    }
+
+    /* Record the input of every frame from power-on. */
+    if (movie != NULL) {
+        mov_record(movie);
+    }
+
+    /* Skip the boot from a snapshot kept in the boot cache. */
+    if (boot_cache != NULL && boot_frame > 0 && !mov_is_recording()) {
+        btc_boot(boot_cache, boot_frame, NULL);
+    }
+
+    /* Keep a snapshot every frame to rewind with backspace. */
+    if (rewind_budget > 0) {
+        rwd_init((size_t) rewind_budget << 20, 1);
+    }
+
+    /* Show frames as they will be a few frames later to hide input latency. */
+    if (run_ahead > 0) {
+        rah_init(run_ahead);
+    }
+
     SDL_Event event;
     while (1) {
         while (SDL_PollEvent(&event) != 0) {
@@ -169,9 +255,23 @@ int main(int argc, char *argv[]) {
         cpu_execute();
         ppu_catch_up();
 
-        if (ppu.status_vblank && current_frame < ppu.frame) {
+        if (input_frame != machine.ppu.frame) {
+            mov_record_frame();
+            input_frame = machine.ppu.frame;
+        }
+
+        if (machine.ppu.status_vblank && current_frame < machine.ppu.frame) {
+            rah_frame();
             draw_display(renderer);
-            current_frame = ppu.frame;
+
+            /* Go back a frame while rewinding, otherwise keep a snapshot. */
+            if (rewinding) {
+                rwd_step_back();
+            }
+            else {
+                rwd_push();
+            }
+            current_frame = machine.ppu.frame;
         }
     }
 
@@ -2,15 +2,16 @@
  * NROM (mapper 0).
  * -------------------------------------------------------------- */
 
-#include <stdlib.h>
+#include <string.h>
 #include "../include/log.h"
+#include "../include/machine.h"
 #include "../include/mapper000.h"
 
 static byte mapper000_cpu_read(Cartridge *cartridge, word address) {
     if (address >= 0x6000) {
         /* CPU 0x6000-0x7FFF: 8 KB PRG RAM. */
         if (address < 0x8000) {
-            return cartridge->prg_ram[address - 0x6000];
+            return machine.prg_ram[address - 0x6000];
         }
         /* CPU 0x8000-0xBFFF: First 16 KB of ROM. */
         else if (address < 0xC000) {
@@ -27,10 +28,27 @@ static byte mapper000_cpu_read(Cartridge *cartridge, word address) {
     }
 }
 
+/* Pointer to the 256-byte page at address (0x6000-0xFFFF). */
+static byte *mapper000_cpu_page(Cartridge *cartridge, word address) {
+    if (address >= 0x6000) {
+        if (address < 0x8000) {
+            return &machine.prg_ram[address - 0x6000];
+        }
+        else if (address < 0xC000) {
+            return &cartridge->prg_rom[address - 0x8000];
+        }
+        else {
+            word offset = cartridge->prg_banks > 1 ? 0x8000 : 0xC000;
+            return &cartridge->prg_rom[address - offset];
+        }
+    }
+    return NULL;
+}
+
 static void mapper000_cpu_write(Cartridge *cartridge, word address, byte data) {
     /* CPU 0x6000-0x7FFF: 8KB PRG RAM. */
     if (address >= 0x6000 && address < 0x8000) {
-        cartridge->prg_ram[address - 0x6000] = data;
+        WRITE_MEMORY(machine.prg_ram[address - 0x6000], data);
     }
     else {
         LOG_ERROR("Invalid address %04X at CPU write (mapper 0).", address);
@@ -38,7 +56,7 @@ static void mapper000_cpu_write(Cartridge *cartridge, word address, byte data) {
 }
 
 static byte mapper000_ppu_read(Cartridge *cartridge, word address) {
-    /* PPU 0x0000-0x1FFF: 8KB CHR ROM (RAM supported/writable). */
+    /* PPU 0x0000-0x1FFF: 8KB CHR ROM. */
     if (address < 0x2000) {
         return cartridge->chr_rom[address];
     }
@@ -47,10 +65,20 @@ static byte mapper000_ppu_read(Cartridge *cartridge, word address) {
     }
 }
 
-static void mapper000_ppu_write(Cartridge *cartridge, word address, byte data) {
-    /* PPU 0x0000-0x1FFF: 8KB CHR ROM (RAM supported/writeable). */
+static byte mapper000_ppu_read_ram(Cartridge *cartridge, word address) {
+    /* PPU 0x0000-0x1FFF: 8KB CHR RAM. */
     if (address < 0x2000) {
-        cartridge->chr_rom[address] = data;
+        return machine.chr_ram[address];
+    }
+    else {
+        LOG_ERROR("Invalid address $%04X at PPU read (mapper 0).", address);
+    }
+}
+
+static void mapper000_ppu_write_ram(Cartridge *cartridge, word address, byte data) {
+    /* PPU 0x0000-0x1FFF: 8KB CHR RAM. */
+    if (address < 0x2000) {
+        WRITE_MEMORY(machine.chr_ram[address], data);
     }
     else {
         LOG_ERROR("Invalid address $%04X at PPU write (mapper 0).", address);
@@ -58,16 +86,20 @@ static void mapper000_ppu_write(Cartridge *cartridge, word address, byte data) {
 }
 
 void mapper000_init(Cartridge *cartridge) {
-    /* Allocate 8KB of PRG RAM. */
-    cartridge->prg_ram = malloc(0x2000);
-    for (int i = 0; i < 0x2000; i++) {
-        cartridge->prg_ram[i] = 0x00;
-    }
+    /* Clear 8KB of PRG RAM and CHR RAM. */
+    mch_begin_write(machine.prg_ram, PRG_RAM_SIZE);
+    mch_begin_write(machine.chr_ram, CHR_RAM_SIZE);
+    memset(machine.prg_ram, 0x00, PRG_RAM_SIZE);
+    memset(machine.chr_ram, 0x00, CHR_RAM_SIZE);
+    mch_end_write(machine.prg_ram, PRG_RAM_SIZE);
+    mch_end_write(machine.chr_ram, CHR_RAM_SIZE);
 
     /* Initialize mapper. */
     cartridge->cpu_read  = mapper000_cpu_read;
     cartridge->cpu_get   = mapper000_cpu_read;
+    cartridge->cpu_page  = mapper000_cpu_page;
     cartridge->cpu_write = mapper000_cpu_write;
-    cartridge->ppu_read  = mapper000_ppu_read;
-    cartridge->ppu_write = mapper000_ppu_write;
+    cartridge->ppu_read  = cartridge->chr_rom ? mapper000_ppu_read : mapper000_ppu_read_ram;
+    cartridge->ppu_write = cartridge->chr_rom ? NULL : mapper000_ppu_write_ram;
+    cartridge->is_valid  = NULL;
 }
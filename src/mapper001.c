@@ -2,24 +2,25 @@
  * MMC1 (mapper 1).
  * -------------------------------------------------------------- */
 
-#include <stdlib.h>
+#include <string.h>
 #include "../include/log.h"
+#include "../include/machine.h"
 #include "../include/mapper001.h"
 #include "../include/vram.h"
 
 #define NUM_REGISTERS 10
 
-#define shift_register  cartridge->registers[0]
-#define prg_bank_mode   cartridge->registers[1]
-#define prg_bank        cartridge->registers[2]
-#define chr_bank_mode   cartridge->registers[3]
-#define chr_bank_0      cartridge->registers[4]
-#define chr_bank_1      cartridge->registers[5]
+#define shift_register  machine.mapper_registers[0]
+#define prg_bank_mode   machine.mapper_registers[1]
+#define prg_bank        machine.mapper_registers[2]
+#define chr_bank_mode   machine.mapper_registers[3]
+#define chr_bank_0      machine.mapper_registers[4]
+#define chr_bank_1      machine.mapper_registers[5]
 
-#define prg_page_0      cartridge->registers[6]
-#define prg_page_1      cartridge->registers[7]
-#define chr_page_0      cartridge->registers[8]
-#define chr_page_1      cartridge->registers[9]
+#define prg_page_0      machine.mapper_registers[6]
+#define prg_page_1      machine.mapper_registers[7]
+#define chr_page_0      machine.mapper_registers[8]
+#define chr_page_1      machine.mapper_registers[9]
 
 /* -----------------------------------------------------------------
  * MMC1 register control.
@@ -117,7 +118,7 @@ static inline byte mapper001_cpu_read(Cartridge *cartridge, word address) {
     if (address >= 0x6000) {
         /* CPU 0x6000-0x7FFF: 8KB PRG RAM bank (fixed). */
         if (address < 0x8000) {
-            return cartridge->prg_ram[address - 0x6000];
+            return machine.prg_ram[address - 0x6000];
         }
         /* CPU 0x8000-0xBFFF: 16 KB PRG ROM bank (switchable). */
         else if (address < 0xC000) {
@@ -135,11 +136,29 @@ static inline byte mapper001_cpu_read(Cartridge *cartridge, word address) {
     }
 }
 
+/* Pointer to the 256-byte page at address (0x6000-0xFFFF). */
+static inline byte *mapper001_cpu_page(Cartridge *cartridge, word address) {
+    if (address >= 0x6000) {
+        if (address < 0x8000) {
+            return &machine.prg_ram[address - 0x6000];
+        }
+        else if (address < 0xC000) {
+            address -= 0x8000;
+            return &cartridge->prg_rom[prg_page_0 * 0x4000 + address];
+        }
+        else {
+            address -= 0xC000;
+            return &cartridge->prg_rom[prg_page_1 * 0x4000 + address];
+        }
+    }
+    return NULL;
+}
+
 static inline void mapper001_cpu_write(Cartridge *cartridge, word address, byte data) {
     if (address >= 0x6000) {
         /* CPU 0x6000-0x7FFF: 8KB PRG RAM bank (fixed). */
         if (address < 0x8000) {
-            cartridge->prg_ram[address - 0x6000] = data;
+            WRITE_MEMORY(machine.prg_ram[address - 0x6000], data);
         }
         /* CPU 0x8000-0xFFFF: Load register. */
         else {
@@ -168,16 +187,33 @@ static inline byte mapper001_ppu_read(Cartridge *cartridge, word address) {
     }
 }
 
-static inline void mapper001_ppu_write(Cartridge *cartridge, word address, byte data) {
+static inline byte mapper001_ppu_read_ram(Cartridge *cartridge, word address) {
     if (address < 0x2000) {
-        /* PPU 0x0000-0x0FFF: 4KB switchable CHR bank. */
+        /* PPU 0x0000-0x0FFF: 4 KB CHR RAM bank (switchable). */
         if (address < 0x1000) {
-            cartridge->chr_rom[(chr_page_0 << 12) | address] = data;
+            return machine.chr_ram[((chr_page_0 & 0x01) << 12) | address];
         }
-        /* PPU 0x1000-0x1FFF: 4KB switchable CHR bank. */
+        /* PPU 0x1000-0x1FFF: 4 KB CHR RAM bank (switchable). */
         else {
             address &= 0x0FFF;
-            cartridge->chr_rom[(chr_page_1 << 12) | address] = data;
+            return machine.chr_ram[((chr_page_1 & 0x01) << 12) | address];
+        }
+    }
+    else {
+        LOG_ERROR("Invalid address $%04X at PPU read (mapper 1).", address);
+    }
+}
+
+static inline void mapper001_ppu_write_ram(Cartridge *cartridge, word address, byte data) {
+    if (address < 0x2000) {
+        /* PPU 0x0000-0x0FFF: 4 KB CHR RAM bank (switchable). */
+        if (address < 0x1000) {
+            WRITE_MEMORY(machine.chr_ram[((chr_page_0 & 0x01) << 12) | address], data);
+        }
+        /* PPU 0x1000-0x1FFF: 4 KB CHR RAM bank (switchable). */
+        else {
+            address &= 0x0FFF;
+            WRITE_MEMORY(machine.chr_ram[((chr_page_1 & 0x01) << 12) | address], data);
         }
     }
     else {
@@ -185,25 +221,38 @@ static inline void mapper001_ppu_write(Cartridge *cartridge, word address, byte
     }
 }
 
+/* Registers as write_register and update_banks leave them, with pages
+ * inside the cartridge. CHR RAM pages are masked when used. */
+static bool mapper001_is_valid(Cartridge *cartridge) {
+    bool chr_in_range = cartridge->chr_rom == NULL ||
+        (chr_page_0 < 2 * cartridge->chr_banks && chr_page_1 < 2 * cartridge->chr_banks);
+    return shift_register != 0 && shift_register <= 0x1F &&
+        prg_bank_mode <= 3 && prg_bank <= 0x0F && chr_bank_mode <= 1 &&
+        chr_bank_0 <= 0x1F && chr_bank_1 <= 0x1F &&
+        prg_page_0 < cartridge->prg_banks && prg_page_1 < cartridge->prg_banks &&
+        chr_in_range;
+}
+
 void mapper001_init(Cartridge *cartridge) {
-    /* Allocate 8KB of PRG RAM. */
-    cartridge->prg_ram = malloc(0x1000);
-    for (int i = 0; i < 0x1000; i++) {
-        cartridge->prg_ram[i] = 0x00;
-    }
+    /* Clear 8KB of PRG RAM and CHR RAM. */
+    mch_begin_write(machine.prg_ram, PRG_RAM_SIZE);
+    mch_begin_write(machine.chr_ram, CHR_RAM_SIZE);
+    memset(machine.prg_ram, 0x00, PRG_RAM_SIZE);
+    memset(machine.chr_ram, 0x00, CHR_RAM_SIZE);
+    mch_end_write(machine.prg_ram, PRG_RAM_SIZE);
+    mch_end_write(machine.chr_ram, CHR_RAM_SIZE);
 
     /* Initialize registers. */
-    cartridge->registers = malloc(NUM_REGISTERS);
-    for (int i = 0; i < NUM_REGISTERS; i++) {
-        cartridge->registers[i] = 0x00;
-    }
+    memset(machine.mapper_registers, 0x00, NUM_REGISTERS);
     shift_register = 0x10;
     prg_page_1 = cartridge->prg_banks - 1;
 
     /* Initialize mapper functions. */
     cartridge->cpu_read  = mapper001_cpu_read;
     cartridge->cpu_get   = mapper001_cpu_read;
+    cartridge->cpu_page  = mapper001_cpu_page;
     cartridge->cpu_write = mapper001_cpu_write;
-    cartridge->ppu_read  = mapper001_ppu_read;
-    cartridge->ppu_write = mapper001_ppu_write;
+    cartridge->ppu_read  = cartridge->chr_rom ? mapper001_ppu_read : mapper001_ppu_read_ram;
+    cartridge->ppu_write = cartridge->chr_rom ? NULL : mapper001_ppu_write_ram;
+    cartridge->is_valid  = mapper001_is_valid;
 }
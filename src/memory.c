@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include "../include/cpu.h"
 #include "../include/memory.h"
 #include "../include/mmc.h"
@@ -34,6 +35,23 @@ inline word mem_read_16(word address) {
     return (mem_read(address + 1) << 8) | mem_read(address);
 }
 
+/* Pointer to the 256-byte page at address if it can be read without side
+ * effects (RAM and cartridge memory), NULL otherwise. */
+inline byte *mem_page(word address) {
+    /* 0x0000 - 0x1FFF: RAM. */
+    if (address < 0x2000) {
+        return cpu_ram_page(address & 0x7FF);
+    }
+
+    /* 0x4020 - 0xFFFF: Cartridge space. */
+    else if (address >= 0x4020) {
+        return mmc_cpu_page(address);
+    }
+
+    /* 0x2000 - 0x401F: I/O registers. */
+    return NULL;
+}
+
 /* Memory access without side effects. */
 inline byte mem_get(word address) {
     /* 0x0000 - 0x1FFF: RAM. */
@@ -5,9 +5,14 @@
 #include "../include/mapper001.h"
 #include "../include/mmc.h"
 #include "../include/nes.h"
+#include "../include/render.h"
 #include "../include/vram.h"
 
-static Cartridge *cartridge = NULL;
+static _Thread_local Cartridge *cartridge = NULL;
+
+bool mmc_is_supported(byte mapper) {
+    return mapper == 0 || mapper == 1;
+}
 
 void mmc_init(Cartridge *cartridge_) {
     if (cartridge != NULL) {
@@ -32,6 +37,32 @@ void mmc_init(Cartridge *cartridge_) {
     vrm_set_mode(mode);
 }
 
+/* Use an already initialized cartridge on the current thread. */
+void mmc_attach(Cartridge *cartridge_) {
+    cartridge = cartridge_;
+}
+
+/* Copy the cartridge of the current thread. The copy shares its ROM with the
+ * original: all mutable cartridge state is part of the machine. */
+Cartridge *mmc_clone(void) {
+    Cartridge *clone = malloc(sizeof(Cartridge));
+    if (clone == NULL) {
+        LOG_ERROR("Unable to allocate memory for cartridge clone.");
+    }
+    *clone = *cartridge;
+    return clone;
+}
+
+void mmc_free_clone(Cartridge *clone) {
+    free(clone);
+}
+
+/* Mapper registers index the cartridge ROM unchecked: a save state must
+ * leave them in range. */
+bool mmc_is_valid_state(void) {
+    return cartridge->is_valid == NULL || (*cartridge->is_valid)(cartridge);
+}
+
 inline byte mmc_cpu_read(word address) {
     return (*cartridge->cpu_read)(cartridge, address);
 }
@@ -40,8 +71,19 @@ inline byte mmc_cpu_get(word address) {
     return (*cartridge->cpu_get)(cartridge, address);
 }
 
+inline byte *mmc_cpu_page(word address) {
+    if (cartridge->cpu_page != NULL) {
+        return (*cartridge->cpu_page)(cartridge, address);
+    }
+    return NULL;
+}
+
 inline void mmc_cpu_write(word address, byte data) {
     if (cartridge->cpu_write != NULL) {
+        /* Writes to 0x8000-0xFFFF may switch CHR banks or mirroring. */
+        if (address >= 0x8000) {
+            rdr_log_cartridge_write(address, data);
+        }
         (*cartridge->cpu_write)(cartridge, address, data);
     }
 }
@@ -0,0 +1,448 @@
+/* -----------------------------------------------------------------
+ * Input movies.
+ *
+ * A movie holds the buttons of both controllers for every frame from
+ * power-on. Input only changes at the start of a frame, when the frame
+ * counter changes, so a movie plays back to exactly the machine it was
+ * recorded on. The state hash at the end of every frame is kept with it,
+ * which shows the first frame where playback went another way.
+ *
+ * While recording, rewinding the machine to an earlier frame drops the
+ * frames after it, and recording goes on from there.
+ *
+ * Keyframes make it quick to get to a frame late in a long movie: a save
+ * state every keyframe_interval frames, so that seeking loads one and runs
+ * the frames after it. Movies without keyframes get them the first time
+ * they are played, and keep them when they are saved. A file holds the
+ * header, the input, the hashes, an index of the file offset of every
+ * keyframe, and the keyframes.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/controller.h"
+#include "../include/cpu.h"
+#include "../include/log.h"
+#include "../include/machine.h"
+#include "../include/movie.h"
+#include "../include/nes.h"
+#include "../include/ppu.h"
+
+#define MOVIE_MAGIC   "NESMOVIE"
+#define MOVIE_VERSION 3
+#define MOVIE_OLDEST  2             /* Oldest version that still loads. */
+#define HASH_VERSION  3             /* First version with the current state hash. */
+
+typedef struct {
+    char magic[8];                  /* MOVIE_MAGIC. */
+    dword version;                  /* MOVIE_VERSION. */
+    dword frames;
+    unsigned long long rom_hash;
+    dword has_hashes;
+    dword keyframes;
+    dword keyframe_interval;
+    dword state_size;               /* Size of a keyframe. */
+} MovieHeader;
+
+static Movie *recording = NULL;
+static char *recording_path = NULL;
+static int recording_capacity;
+static byte pending[2];             /* Input of the next frame. */
+
+static Movie *new_movie(int frames) {
+    Movie *movie = calloc(1, sizeof(Movie));
+    if (movie == NULL) {
+        return NULL;
+    }
+
+    movie->rom_hash = nes_get_rom_hash();
+    movie->frames = frames;
+    movie->keyframe_interval = KEYFRAME_INTERVAL;
+    movie->inputs = malloc(frames * sizeof(*movie->inputs) + 1);
+    if (movie->inputs == NULL) {
+        free(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+void mov_free(Movie *movie) {
+    if (movie != NULL) {
+        free(movie->inputs);
+        free(movie->hashes);
+        free(movie->states);
+        free(movie);
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Movie files.
+ * -------------------------------------------------------------- */
+
+/* An FM2 port field lists the buttons as "RLDUTSBA", with '.' or ' ' for
+ * buttons that are up. */
+static byte parse_fm2_port(const char *field) {
+    byte buttons = 0;
+    for (int i = 0; i < 8 && field[i] != '|' && field[i] != '\0'; i++) {
+        if (field[i] != '.' && field[i] != ' ') {
+            buttons |= 0x80 >> i;
+        }
+    }
+    return buttons;
+}
+
+/* Frames of an FM2 movie are lines "|commands|port 0|port 1|port 2|". */
+static Movie *load_fm2(FILE *file) {
+    Movie *movie = new_movie(0);
+    int capacity = 0;
+    bool commands = false;
+
+    char line[256];
+    while (movie != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] != '|') {
+            continue;
+        }
+
+        if (movie->frames == capacity) {
+            capacity = capacity == 0 ? 1024 : 2 * capacity;
+            byte (*inputs)[2] = realloc(movie->inputs, capacity * sizeof(*inputs));
+            if (inputs == NULL) {
+                mov_free(movie);
+                return NULL;
+            }
+            movie->inputs = inputs;
+        }
+
+        char *port0 = strchr(line + 1, '|');
+        char *port1 = port0 != NULL ? strchr(port0 + 1, '|') : NULL;
+        commands |= atoi(line + 1) != 0;
+
+        byte *input = movie->inputs[movie->frames++];
+        input[0] = port0 != NULL ? parse_fm2_port(port0 + 1) : 0;
+        input[1] = port1 != NULL ? parse_fm2_port(port1 + 1) : 0;
+    }
+
+    if (commands) {
+        LOG_WARNING("Reset and power commands of the FM2 movie are ignored.");
+    }
+    return movie;
+}
+
+static Movie *load_binary(FILE *file) {
+    MovieHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, MOVIE_MAGIC, 8) != 0 || header.version < MOVIE_OLDEST ||
+            header.version > MOVIE_VERSION) {
+        LOG_WARNING("Movie has an unsupported format.");
+        return NULL;
+    }
+
+    Movie *movie = new_movie(header.frames);
+    if (movie == NULL) {
+        return NULL;
+    }
+    movie->rom_hash = header.rom_hash;
+    movie->keyframe_interval = header.keyframe_interval;
+
+    bool success = fread(movie->inputs, sizeof(*movie->inputs), movie->frames, file) == movie->frames;
+    if (success && header.has_hashes) {
+        movie->hashes = malloc(movie->frames * sizeof(*movie->hashes) + 1);
+        success = movie->hashes != NULL &&
+            fread(movie->hashes, sizeof(*movie->hashes), movie->frames, file) == movie->frames;
+    }
+
+    /* Hashes of an older state hash are taken again. */
+    if (success && movie->hashes != NULL && header.version < HASH_VERSION) {
+        LOG_WARNING("State hashes of the movie are from an older version; ignored.");
+        free(movie->hashes);
+        movie->hashes = NULL;
+    }
+
+    /* Keyframes of another state format are taken again. */
+    size_t state_size = nes_state_size();
+    if (success && header.keyframes > 0 && header.state_size != state_size) {
+        LOG_WARNING("Keyframes of the movie have another state format; ignored.");
+    }
+    else if (success && header.keyframes > 0) {
+        unsigned long long *index = malloc(header.keyframes * sizeof(*index));
+        movie->states = malloc(header.keyframes * state_size);
+        success = index != NULL && movie->states != NULL &&
+            fread(index, sizeof(*index), header.keyframes, file) == header.keyframes;
+
+        for (int i = 0; i < header.keyframes && success; i++) {
+            success = fseek(file, index[i], SEEK_SET) == 0 &&
+                fread(movie->states + i * state_size, state_size, 1, file) == 1;
+        }
+        movie->keyframes = header.keyframes;
+        free(index);
+    }
+
+    if (!success) {
+        LOG_WARNING("Movie is truncated.");
+        mov_free(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+Movie *mov_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_WARNING("Unable to open movie %s.", path);
+        return NULL;
+    }
+
+    size_t length = strlen(path);
+    bool fm2 = length >= 4 && strcmp(path + length - 4, ".fm2") == 0;
+
+    Movie *movie = fm2 ? load_fm2(file) : load_binary(file);
+    fclose(file);
+    return movie;
+}
+
+bool mov_save(const Movie *movie, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_WARNING("Unable to write movie %s.", path);
+        return false;
+    }
+
+    size_t state_size = nes_state_size();
+    MovieHeader header = {
+        MOVIE_MAGIC, MOVIE_VERSION, movie->frames, movie->rom_hash, movie->hashes != NULL,
+        movie->keyframes, movie->keyframe_interval, state_size
+    };
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(movie->inputs, sizeof(*movie->inputs), movie->frames, file) == movie->frames;
+    if (success && movie->hashes != NULL) {
+        success = fwrite(movie->hashes, sizeof(*movie->hashes), movie->frames, file) == movie->frames;
+    }
+
+    /* The keyframes follow their index. */
+    unsigned long long offset = ftell(file) + movie->keyframes * sizeof(offset);
+    for (int i = 0; i < movie->keyframes && success; i++) {
+        success = fwrite(&offset, sizeof(offset), 1, file) == 1;
+        offset += state_size;
+    }
+    if (success && movie->keyframes > 0) {
+        success = fwrite(movie->states, state_size, movie->keyframes, file) == movie->keyframes;
+    }
+
+    success = fclose(file) == 0 && success;
+    if (!success) {
+        LOG_WARNING("Unable to write movie %s.", path);
+    }
+    return success;
+}
+
+/* -----------------------------------------------------------------
+ * Playback.
+ * -------------------------------------------------------------- */
+
+static void set_input(const byte input[2]) {
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+        controller_set_key(&machine.controller1, i, input[0] >> i & 1);
+        controller_set_key(&machine.controller2, i, input[1] >> i & 1);
+    }
+}
+
+/* Take the keyframe of a frame that is about to start, if it is the next
+ * one the movie is missing. */
+static void take_keyframe(Movie *movie, int frame) {
+    if (movie->keyframe_interval <= 0 || frame != movie->keyframes * movie->keyframe_interval) {
+        return;
+    }
+
+    size_t size = nes_state_size();
+    byte *states = realloc(movie->states, (movie->keyframes + 1) * size);
+    if (states != NULL) {
+        movie->states = states;
+        nes_save_state(states + movie->keyframes * size, size);
+        movie->keyframes++;
+    }
+}
+
+/* Play frames from the start of the first one; returns the frame where
+ * playback went another way, or the end. */
+static int play_frames(Movie *movie, int first, int end, bool record_hashes) {
+    for (int i = first; i < end; i++) {
+        take_keyframe(movie, i);
+        set_input(movie->inputs[i]);
+
+        unsigned long long frame = machine.ppu.frame;
+        while (machine.ppu.frame == frame) {
+            cpu_execute();
+            ppu_catch_up();
+        }
+
+        unsigned long long hash = nes_state_hash();
+        if (record_hashes) {
+            movie->hashes[i] = hash;
+        }
+        else if (movie->hashes != NULL && hash != movie->hashes[i]) {
+            LOG_WARNING("Movie playback went another way at frame %d.", i);
+            return i;
+        }
+    }
+    return end;
+}
+
+int mov_play(Movie *movie) {
+    if (movie->rom_hash != nes_get_rom_hash()) {
+        LOG_WARNING("Movie belongs to another ROM.");
+        return 0;
+    }
+
+    bool record_hashes = movie->hashes == NULL;
+    if (record_hashes) {
+        movie->hashes = malloc(movie->frames * sizeof(*movie->hashes) + 1);
+        if (movie->hashes == NULL) {
+            return 0;
+        }
+    }
+    return play_frames(movie, 0, movie->frames, record_hashes);
+}
+
+bool mov_seek(Movie *movie, int frame) {
+    if (movie->rom_hash != nes_get_rom_hash()) {
+        LOG_WARNING("Movie belongs to another ROM.");
+        return false;
+    }
+    if (frame < 0 || frame > movie->frames) {
+        LOG_WARNING("Movie has no frame %d.", frame);
+        return false;
+    }
+
+    /* Start from the last keyframe before the frame that loads; keyframes
+     * that do not load are dropped. */
+    size_t size = nes_state_size();
+    int keyframe = movie->keyframe_interval > 0 ? frame / movie->keyframe_interval : 0;
+    int first = 0;
+    for (keyframe = keyframe < movie->keyframes ? keyframe : movie->keyframes - 1;
+            keyframe >= 0; keyframe--) {
+        if (nes_load_state(movie->states + keyframe * size, size)) {
+            first = keyframe * movie->keyframe_interval;
+            break;
+        }
+        movie->keyframes = keyframe;
+    }
+
+    if (play_frames(movie, first, frame, false) < frame) {
+        return false;
+    }
+
+    /* Check the keyframe when no frames were played after it. */
+    if (movie->hashes != NULL && frame > 0 && nes_state_hash() != movie->hashes[frame - 1]) {
+        LOG_WARNING("Movie keyframe of frame %d does not match the movie.", frame);
+        return false;
+    }
+    return true;
+}
+
+/* -----------------------------------------------------------------
+ * Recording.
+ * -------------------------------------------------------------- */
+
+bool mov_record(const char *path) {
+    mov_stop();
+
+    if (machine.ppu.frame != 0) {
+        LOG_WARNING("Movies are recorded from power-on; not recording.");
+        return false;
+    }
+
+    recording_capacity = 1024;
+    recording = new_movie(recording_capacity);
+    recording_path = strdup(path);
+    if (recording != NULL) {
+        recording->hashes = malloc(recording_capacity * sizeof(*recording->hashes));
+    }
+    if (recording == NULL || recording_path == NULL || recording->hashes == NULL) {
+        LOG_ERROR("Unable to allocate memory for movie.");
+        mov_free(recording);
+        free(recording_path);
+        recording = NULL;
+        recording_path = NULL;
+        return false;
+    }
+
+    /* The first frame starts with the input held now. */
+    pending[0] = pending[1] = 0;
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+        pending[0] |= machine.controller1.button[i] << i;
+        pending[1] |= machine.controller2.button[i] << i;
+    }
+    take_keyframe(recording, 0);
+    recording->frames = 1;
+    memcpy(recording->inputs[0], pending, 2);
+    return true;
+}
+
+void mov_record_frame(void) {
+    if (recording == NULL) {
+        return;
+    }
+
+    /* Rewound: the frames after the current one are recorded again. */
+    if (machine.ppu.frame < recording->frames) {
+        int keyframes = recording->keyframe_interval > 0 ?
+            machine.ppu.frame / recording->keyframe_interval + 1 : 0;
+        recording->frames = machine.ppu.frame + 1;
+        recording->keyframes = keyframes < recording->keyframes ? keyframes : recording->keyframes;
+        return;
+    }
+
+    if (recording->frames == recording_capacity) {
+        int capacity = 2 * recording_capacity;
+        byte (*inputs)[2] = realloc(recording->inputs, capacity * sizeof(*inputs));
+        unsigned long long *hashes = inputs != NULL ?
+            realloc(recording->hashes, capacity * sizeof(*hashes)) : NULL;
+        if (inputs != NULL) {
+            recording->inputs = inputs;
+        }
+        if (hashes == NULL) {
+            LOG_ERROR("Unable to allocate memory for movie; recording stopped.");
+            mov_stop();
+            return;
+        }
+        recording->hashes = hashes;
+        recording_capacity = capacity;
+    }
+
+    /* The last frame has ended, and the next one starts with the input
+     * set during it. */
+    recording->hashes[recording->frames - 1] = nes_state_hash();
+    take_keyframe(recording, recording->frames);
+    memcpy(recording->inputs[recording->frames], pending, 2);
+    set_input(pending);
+    recording->frames++;
+}
+
+inline bool mov_is_recording(void) {
+    return recording != NULL;
+}
+
+void mov_set_input(int controller, int keycode, bool value) {
+    if (value) {
+        pending[controller] |= 1 << keycode;
+    }
+    else {
+        pending[controller] &= ~(1 << keycode);
+    }
+}
+
+void mov_stop(void) {
+    if (recording == NULL) {
+        return;
+    }
+
+    /* The frame that is running has no hash yet. */
+    recording->frames--;
+    mov_save(recording, recording_path);
+
+    mov_free(recording);
+    free(recording_path);
+    recording = NULL;
+    recording_path = NULL;
+}
@@ -1,53 +1,483 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../include/cartridge.h"
 #include "../include/controller.h"
+#include "../include/cpu.h"
+#include "../include/log.h"
+#include "../include/machine.h"
 #include "../include/mmc.h"
+#include "../include/movie.h"
 #include "../include/nes.h"
+#include "../include/ppu.h"
+#include "../include/render.h"
 
-static Cartridge cartridge;
-static Controller controller1;
-static Controller controller2;
+#define STATE_MAGIC   "NESS"
+#define STATE_VERSION 1
+
+/* The cartridge in the machine of the current thread. */
+static _Thread_local Cartridge cartridge;
+static _Thread_local unsigned long long rom_hash;
+
+/* The machine before a state was loaded, to update the memory hash. */
+static _Thread_local Machine previous;
+
+/* The snapshot kept up to date by nes_snapshot and nes_restore. */
+static _Thread_local const Machine *base = NULL;
 
 void nes_init(void) {
-    controller_init(&controller1);
-    controller_init(&controller2);
+    ppu_init();
+    controller_init(&machine.controller1);
+    controller_init(&machine.controller2);
+    mch_rehash();
+}
+
+void nes_reset(void) {
+    ppu_reset();
+    cpu_reset();
 }
 
 bool nes_insert_cartridge(byte *data, int length) {
     bool success = cartridge_load(&cartridge, data, length);
     mmc_init(&cartridge);
+
+    /* FNV-1a hash of the ROM file. */
+    rom_hash = 14695981039346656037ull;
+    for (int i = 0; i < length; i++) {
+        rom_hash = (rom_hash ^ data[i]) * 1099511628211ull;
+    }
+
     return success;
 }
 
+/* Free the ROM and power the machine off: it is left as a thread starts. */
+void nes_eject_cartridge(void) {
+    mmc_attach(NULL);
+    free(cartridge.prg_rom);
+    free(cartridge.chr_rom);
+    memset(&cartridge, 0, sizeof(cartridge));
+    rom_hash = 0;
+    ppu_free_display();
+
+    base = NULL;
+    memset(&machine, 0, sizeof(machine));
+    mch_mark_all_dirty();
+}
+
+inline unsigned long long nes_get_rom_hash(void) {
+    return rom_hash;
+}
+
+/* The memory hash is kept up to date on every write; the registers are
+ * mixed in here. Time (cycles and frame number) is left out, so the same
+ * state reached at different times has the same hash. */
+unsigned long long nes_state_hash(void) {
+    byte registers[] = {
+        machine.cpu.PC & 0xFF, machine.cpu.PC >> 8, machine.cpu.S,
+        machine.cpu.A, machine.cpu.X, machine.cpu.Y,
+        machine.flags.C, machine.flags.ZN, machine.flags.I, machine.flags.D,
+        machine.flags.V, machine.nmi,
+
+        machine.ppu.scanline & 0xFF, machine.ppu.scanline >> 8, machine.ppu.dot & 0xFF, machine.ppu.dot >> 8,
+        machine.ppu.v & 0xFF, machine.ppu.v >> 8, machine.ppu.t & 0xFF, machine.ppu.t >> 8,
+        machine.ppu.x, machine.ppu.w,
+        machine.ppu.odd_frame, machine.ppu.ctrl_nmi, machine.ppu.ctrl_master_slave,
+        machine.ppu.ctrl_sprite_size, machine.ppu.ctrl_background_addr >> 8,
+        machine.ppu.ctrl_sprite_addr >> 8, machine.ppu.ctrl_increment,
+        machine.ppu.mask_sprites, machine.ppu.mask_background, machine.ppu.mask_sprites_L,
+        machine.ppu.mask_background_L, machine.ppu.mask_red, machine.ppu.mask_green, machine.ppu.mask_blue,
+        machine.ppu.mask_grayscale, machine.ppu.status_vblank, machine.ppu.status_zero_hit,
+        machine.ppu.status_overflow, machine.ppu.oam_addr, machine.ppu.read_buffer, machine.ppu.latch,
+
+        machine.mirror_mode, machine.controller1.strobe, machine.controller1.index,
+        machine.controller2.strobe, machine.controller2.index
+    };
+
+    /* FNV-1a of the registers and mapper registers, on top of the memory hash. */
+    unsigned long long hash = machine.memory_hash ^ 14695981039346656037ull;
+    for (int i = 0; i < sizeof(registers); i++) {
+        hash = (hash ^ registers[i]) * 1099511628211ull;
+    }
+    for (int i = 0; i < MAX_MAPPER_REGISTERS; i++) {
+        hash = (hash ^ machine.mapper_registers[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/* A movie being recorded takes the input at the start of the next frame. */
 inline void nes_controller1_set(int keycode, bool value) {
-    controller_set_key(&controller1, keycode, value);
+    if (mov_is_recording()) {
+        mov_set_input(0, keycode, value);
+    }
+    else {
+        controller_set_key(&machine.controller1, keycode, value);
+    }
 }
 
 inline void nes_controller2_set(int keycode, bool value) {
-    controller_set_key(&controller2, keycode, value);
+    if (mov_is_recording()) {
+        mov_set_input(1, keycode, value);
+    }
+    else {
+        controller_set_key(&machine.controller2, keycode, value);
+    }
 }
 
 inline byte nes_controller1_read(void) {
-    return controller_read(&controller1);
+    return controller_read(&machine.controller1);
 }
 
 inline byte nes_controller2_read(void) {
-    return controller_read(&controller2);
+    return controller_read(&machine.controller2);
 }
 
 inline byte nes_controller1_get(void) {
-    return controller_get(&controller1);
+    return controller_get(&machine.controller1);
 }
 
 inline byte nes_controller2_get(void) {
-    return controller_get(&controller2);
+    return controller_get(&machine.controller2);
 }
 
 inline void nes_controller1_write(byte data) {
-    controller_write(&controller1, data);
+    controller_write(&machine.controller1, data);
 }
 
 inline void nes_controller2_write(byte data) {
-    controller_write(&controller2, data);
+    controller_write(&machine.controller2, data);
+}
+
+/* -----------------------------------------------------------------
+ * Save states.
+ *
+ * A save state is a fixed sequence of little-endian fields, so it does not
+ * depend on the layout of the host structs. The same field list is used to
+ * measure, save and load a state. It starts with a header holding the
+ * format version and the hash of the ROM the state belongs to.
+ * -------------------------------------------------------------- */
+
+typedef struct {
+    byte *data;             /* State data (NULL: only measure the size). */
+    size_t offset;          /* Current position in the data. */
+    bool load;              /* Load the fields from the data. */
+} Stream;
+
+static inline void transfer_bytes(Stream *stream, void *field, size_t size) {
+    if (stream->data != NULL) {
+        if (stream->load) {
+            memcpy(field, stream->data + stream->offset, size);
+        }
+        else {
+            memcpy(stream->data + stream->offset, field, size);
+        }
+    }
+    stream->offset += size;
+}
+
+static inline void transfer_integer(Stream *stream, unsigned long long *value, int size) {
+    if (stream->data != NULL) {
+        byte *data = stream->data + stream->offset;
+        if (stream->load) {
+            *value = 0;
+            for (int i = size - 1; i >= 0; i--) {
+                *value = (*value << 8) | data[i];
+            }
+        }
+        else {
+            for (int i = 0; i < size; i++) {
+                data[i] = *value >> (8 * i);
+            }
+        }
+    }
+    stream->offset += size;
+}
+
+#define TRANSFER_INTEGER(name, type, size)                          \
+    static inline void name(Stream *stream, type *field) {         \
+        unsigned long long value = *field;                          \
+        transfer_integer(stream, &value, size);                     \
+        *field = (type) value;                                      \
+    }
+
+TRANSFER_INTEGER(transfer_8,   byte,               1)
+TRANSFER_INTEGER(transfer_16,  word,               2)
+TRANSFER_INTEGER(transfer_32,  dword,              4)
+TRANSFER_INTEGER(transfer_int, int,                4)
+TRANSFER_INTEGER(transfer_64,  unsigned long long, 8)
+
+static inline void transfer_bool(Stream *stream, bool *field) {
+    byte value = *field;
+    transfer_8(stream, &value);
+    *field = value != 0;
+}
+
+#define TRANSFER(stream, field) _Generic((field),                   \
+    bool: transfer_bool, byte: transfer_8, word: transfer_16,       \
+    dword: transfer_32, int: transfer_int,                          \
+    unsigned long long: transfer_64)(stream, &(field))
+
+static void transfer_controller(Stream *stream, Controller *controller) {
+    TRANSFER(stream, controller->strobe);
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+        TRANSFER(stream, controller->button[i]);
+    }
+    TRANSFER(stream, controller->index);
+}
+
+static void transfer_ppu(Stream *stream) {
+    TRANSFER(stream, machine.ppu.scanline);
+    TRANSFER(stream, machine.ppu.dot);
+    TRANSFER(stream, machine.ppu.frame);
+    TRANSFER(stream, machine.ppu.odd_frame);
+
+    TRANSFER(stream, machine.ppu.v);
+    TRANSFER(stream, machine.ppu.t);
+    TRANSFER(stream, machine.ppu.x);
+    TRANSFER(stream, machine.ppu.w);
+
+    TRANSFER(stream, machine.ppu.low_tile_register);
+    TRANSFER(stream, machine.ppu.high_tile_register);
+    TRANSFER(stream, machine.ppu.attribute_register);
+    TRANSFER(stream, machine.ppu.nametable_byte);
+    TRANSFER(stream, machine.ppu.attribute_byte);
+    TRANSFER(stream, machine.ppu.low_tile);
+    TRANSFER(stream, machine.ppu.high_tile);
+
+    TRANSFER(stream, machine.ppu.ctrl_nmi);
+    TRANSFER(stream, machine.ppu.ctrl_master_slave);
+    TRANSFER(stream, machine.ppu.ctrl_sprite_size);
+    TRANSFER(stream, machine.ppu.ctrl_background_addr);
+    TRANSFER(stream, machine.ppu.ctrl_sprite_addr);
+    TRANSFER(stream, machine.ppu.ctrl_increment);
+
+    TRANSFER(stream, machine.ppu.mask_red);
+    TRANSFER(stream, machine.ppu.mask_green);
+    TRANSFER(stream, machine.ppu.mask_blue);
+    TRANSFER(stream, machine.ppu.mask_sprites);
+    TRANSFER(stream, machine.ppu.mask_background);
+    TRANSFER(stream, machine.ppu.mask_sprites_L);
+    TRANSFER(stream, machine.ppu.mask_background_L);
+    TRANSFER(stream, machine.ppu.mask_grayscale);
+
+    TRANSFER(stream, machine.ppu.status_vblank);
+    TRANSFER(stream, machine.ppu.status_zero_hit);
+    TRANSFER(stream, machine.ppu.status_overflow);
+
+    TRANSFER(stream, machine.ppu.oam_addr);
+    TRANSFER(stream, machine.ppu.read_buffer);
+    TRANSFER(stream, machine.ppu.latch);
+
+    for (int i = 0; i < MAX_SPRITES; i++) {
+        Sprite *sprite = &machine.ppu.sprites[i];
+        TRANSFER(stream, sprite->x);
+        TRANSFER(stream, sprite->y);
+        TRANSFER(stream, sprite->tile);
+        TRANSFER(stream, sprite->low_tile);
+        TRANSFER(stream, sprite->high_tile);
+        TRANSFER(stream, sprite->palette);
+        TRANSFER(stream, sprite->priority);
+        TRANSFER(stream, sprite->flip_h);
+        TRANSFER(stream, sprite->flip_v);
+    }
+    TRANSFER(stream, machine.ppu.sprite_count);
+
+    transfer_bytes(stream, machine.ppu.palette, PALETTE_SIZE);
+    for (int i = 0; i < PALETTE_SIZE; i++) {
+        TRANSFER(stream, machine.ppu.colors[i]);
+    }
+    transfer_bytes(stream, machine.ppu.oam, OAM_SIZE);
+    transfer_bytes(stream, machine.ppu.nametable, NAMETABLE_SIZE);
+}
+
+static void transfer_machine(Stream *stream) {
+    /* CPU. */
+    TRANSFER(stream, machine.cpu.PC);
+    TRANSFER(stream, machine.cpu.S);
+    TRANSFER(stream, machine.cpu.A);
+    TRANSFER(stream, machine.cpu.X);
+    TRANSFER(stream, machine.cpu.Y);
+    TRANSFER(stream, machine.flags.C);
+    TRANSFER(stream, machine.flags.ZN);
+    TRANSFER(stream, machine.flags.I);
+    TRANSFER(stream, machine.flags.D);
+    TRANSFER(stream, machine.flags.V);
+    TRANSFER(stream, machine.nmi);
+    TRANSFER(stream, machine.cycles);
+    TRANSFER(stream, machine.ppu_ticks);
+
+    /* PPU. */
+    transfer_ppu(stream);
+
+    /* Memory. */
+    transfer_bytes(stream, machine.ram, RAM_SIZE);
+    transfer_bytes(stream, machine.prg_ram, PRG_RAM_SIZE);
+    transfer_bytes(stream, machine.chr_ram, CHR_RAM_SIZE);
+
+    /* Cartridge and I/O. */
+    transfer_bytes(stream, machine.mapper_registers, MAX_MAPPER_REGISTERS);
+    byte mirror_mode = machine.mirror_mode;
+    TRANSFER(stream, mirror_mode);
+    machine.mirror_mode = mirror_mode;
+    transfer_controller(stream, &machine.controller1);
+    transfer_controller(stream, &machine.controller2);
+}
+
+static void transfer_header(Stream *stream, char *magic, dword *version,
+        unsigned long long *hash) {
+    transfer_bytes(stream, magic, 4);
+    TRANSFER(stream, *version);
+    TRANSFER(stream, *hash);
+}
+
+inline dword nes_state_version(void) {
+    return STATE_VERSION;
+}
+
+size_t nes_state_size(void) {
+    char magic[4];
+    dword version = 0;
+    unsigned long long hash = 0;
+
+    Stream stream = { NULL, 0, false };
+    transfer_header(&stream, magic, &version, &hash);
+    transfer_machine(&stream);
+    return stream.offset;
+}
+
+size_t nes_save_state(byte *data, size_t size) {
+    size_t state_size = nes_state_size();
+    if (size < state_size) {
+        return 0;
+    }
+
+    dword version = STATE_VERSION;
+    unsigned long long hash = rom_hash;
+
+    Stream stream = { data, 0, false };
+    transfer_header(&stream, STATE_MAGIC, &version, &hash);
+    transfer_machine(&stream);
+    return state_size;
+}
+
+/* Fields used as indexes or loop bounds must be in range. */
+static bool is_valid_state(void) {
+    return machine.mirror_mode <= MMC &&
+        machine.ppu.sprite_count <= MAX_SPRITES && machine.ppu.x < 8 &&
+        machine.ppu.scanline >= -1 && machine.ppu.scanline <= 260 &&
+        machine.ppu.dot >= 0 && machine.ppu.dot <= 340 &&
+        mmc_is_valid_state();
+}
+
+bool nes_load_state(const byte *data, size_t size) {
+    char magic[4];
+    dword version = 0;
+    unsigned long long hash = 0;
+
+    if (size != nes_state_size()) {
+        LOG_WARNING("Save state has the wrong size.");
+        return false;
+    }
+
+    /* Check the header before loading anything. */
+    Stream stream = { (byte *) data, 0, true };
+    transfer_header(&stream, magic, &version, &hash);
+    if (memcmp(magic, STATE_MAGIC, 4) != 0 || version != STATE_VERSION) {
+        LOG_WARNING("Save state has an unsupported format.");
+        return false;
+    }
+    if (hash != rom_hash) {
+        LOG_WARNING("Save state belongs to another ROM.");
+        return false;
+    }
+
+    /* The render worker restarts from the loaded machine. */
+    bool deferred = rdr_is_enabled();
+    if (deferred) {
+        rdr_disable();
+    }
+
+    /* A damaged state leaves the machine as it was. */
+    previous = machine;
+    transfer_machine(&stream);
+    bool valid = is_valid_state();
+    if (valid) {
+        mch_mark_all_dirty();
+        mch_update_hash(&previous);
+    }
+    else {
+        LOG_WARNING("Save state is damaged.");
+        machine = previous;
+    }
+
+    if (deferred) {
+        rdr_enable();
+    }
+    return valid;
+}
+
+/* -----------------------------------------------------------------
+ * Machine clones.
+ * -------------------------------------------------------------- */
+
+struct Machine *nes_alloc_machine(void) {
+    Machine *clone = aligned_alloc(CACHE_LINE_SIZE, sizeof(Machine));
+    if (clone == NULL) {
+        LOG_ERROR("Unable to allocate memory for machine.");
+    }
+    return clone;
+}
+
+void nes_free_machine(struct Machine *clone) {
+    if (clone == base) {
+        base = NULL;
+    }
+    free(clone);
+}
+
+/* All mutable state is in the machine, so a clone is a plain copy. */
+inline void nes_clone(struct Machine *dst, const struct Machine *src) {
+    /* The render worker restarts from the new machine. */
+    bool deferred = dst == &machine && rdr_is_enabled();
+    if (deferred) {
+        rdr_disable();
+    }
+
+    *dst = *src;
+    if (dst == &machine) {
+        mch_mark_all_dirty();
+    }
+    if (dst == base) {
+        base = NULL;
+    }
+
+    if (deferred) {
+        rdr_enable();
+    }
+}
+
+/* The first snapshot to or from a machine copies all of it. */
+static void set_base(const Machine *snapshot) {
+    if (snapshot != base) {
+        mch_mark_all_dirty();
+        base = snapshot;
+    }
+}
+
+void nes_snapshot(struct Machine *snapshot) {
+    set_base(snapshot);
+    mch_copy_dirty_to(snapshot);
+}
+
+void nes_restore(const struct Machine *snapshot) {
+    bool deferred = rdr_is_enabled();
+    if (deferred) {
+        rdr_disable();
+    }
+
+    set_base(snapshot);
+    mch_copy_dirty_from(snapshot);
+
+    if (deferred) {
+        rdr_enable();
+    }
 }
@@ -0,0 +1,105 @@
+#include <pthread.h>
+#include "../include/palette.h"
+
+/* Emphasized channels keep their value, the other channels are attenuated. */
+#define ATTENUATION 0.816328
+
+static const byte BASE_COLORS[NUM_COLORS][3] = {
+    {0x75, 0x75, 0x75},   // 00
+    {0x27, 0x1B, 0x8F},   // 01
+    {0x00, 0x00, 0xAB},   // 02
+    {0x47, 0x00, 0x9F},   // 03
+    {0x8F, 0x00, 0x77},   // 04
+    {0xAB, 0x00, 0x13},   // 05
+    {0xA7, 0x00, 0x00},   // 06
+    {0x7F, 0x0B, 0x00},   // 07
+    {0x43, 0x2F, 0x00},   // 08
+    {0x00, 0x47, 0x00},   // 09
+    {0x00, 0x51, 0x00},   // 0A
+    {0x00, 0x3F, 0x17},   // 0B
+    {0x1B, 0x3F, 0x5F},   // 0C
+    {0x00, 0x00, 0x00},   // 0D
+    {0x00, 0x00, 0x00},   // 0E
+    {0x00, 0x00, 0x00},   // 0F
+
+    {0xBC, 0xBC, 0xBC},   // 10
+    {0x00, 0x73, 0xEF},   // 11
+    {0x23, 0x3B, 0xEF},   // 12
+    {0x83, 0x00, 0xF3},   // 13
+    {0xBF, 0x00, 0xBF},   // 14
+    {0xE7, 0x00, 0x5B},   // 15
+    {0xDB, 0x2B, 0x00},   // 16
+    {0xCB, 0x4F, 0x0F},   // 17
+    {0x8B, 0x73, 0x00},   // 18
+    {0x00, 0x97, 0x00},   // 19
+    {0x00, 0xAB, 0x00},   // 1A
+    {0x00, 0x93, 0x3B},   // 1B
+    {0x00, 0x83, 0x8B},   // 1C
+    {0x00, 0x00, 0x00},   // 1D
+    {0x00, 0x00, 0x00},   // 1E
+    {0x00, 0x00, 0x00},   // 1F
+
+    {0xFF, 0xFF, 0xFF},   // 20
+    {0x3F, 0xBF, 0xFF},   // 21
+    {0x5F, 0x97, 0xFF},   // 22
+    {0xA7, 0x8B, 0xFD},   // 23
+    {0xF7, 0x7B, 0xFF},   // 24
+    {0xFF, 0x77, 0xB7},   // 25
+    {0xFF, 0x77, 0x63},   // 26
+    {0xFF, 0x9B, 0x3B},   // 27
+    {0xF3, 0xBF, 0x3F},   // 28
+    {0x83, 0xD3, 0x13},   // 29
+    {0x4F, 0xDF, 0x4B},   // 2A
+    {0x58, 0xF8, 0x98},   // 2B
+    {0x00, 0xEB, 0xDB},   // 2C
+    {0x00, 0x00, 0x00},   // 2D
+    {0x00, 0x00, 0x00},   // 2E
+    {0x00, 0x00, 0x00},   // 2F
+
+    {0xFF, 0xFF, 0xFF},   // 30
+    {0xAB, 0xE7, 0xFF},   // 31
+    {0xC7, 0xD7, 0xFF},   // 32
+    {0xD7, 0xCB, 0xFF},   // 33
+    {0xFF, 0xC7, 0xFF},   // 34
+    {0xFF, 0xC7, 0xDB},   // 35
+    {0xFF, 0xBF, 0xB3},   // 36
+    {0xFF, 0xDB, 0xAB},   // 37
+    {0xFF, 0xE7, 0xA3},   // 38
+    {0xE3, 0xFF, 0xA3},   // 39
+    {0xAB, 0xF3, 0xBF},   // 3A
+    {0xB3, 0xFF, 0xCF},   // 3B
+    {0x9F, 0xFF, 0xF3},   // 3C
+    {0x00, 0x00, 0x00},   // 3D
+    {0x00, 0x00, 0x00},   // 3E
+    {0x00, 0x00, 0x00},   // 3F
+};
+
+/* RGBA (0xRRGGBBAA) for every color under each of the 8 emphasis states
+ * (bit 0: red; bit 1: green; bit 2: blue). */
+static dword color_table[NUM_EMPHASIS * NUM_COLORS];
+
+static pthread_once_t initialized_table = PTHREAD_ONCE_INIT;
+
+static void init_color_table(void) {
+    for (int emphasis = 0; emphasis < NUM_EMPHASIS; emphasis++) {
+        for (int color = 0; color < NUM_COLORS; color++) {
+            dword rgba = 0xFF;
+            for (int channel = 0; channel < 3; channel++) {
+                double value = BASE_COLORS[color][channel];
+                if (emphasis != 0 && !(emphasis & (1 << channel))) {
+                    value *= ATTENUATION;
+                }
+                rgba |= (dword) (value + 0.5) << (24 - 8 * channel);
+            }
+            color_table[emphasis * NUM_COLORS + color] = rgba;
+        }
+    }
+}
+
+void pal_init(void) {
+    pthread_once(&initialized_table, init_color_table);
+}
+
+inline dword pal_get_color(byte emphasis, byte color) {
+    return color_table[emphasis * NUM_COLORS + (color & 0x3F)];
+}
@@ -1,51 +1,60 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../include/cpu.h"
+#include "../include/log.h"
+#include "../include/machine.h"
 #include "../include/memory.h"
+#include "../include/palette.h"
 #include "../include/ppu.h"
 #include "../include/ppu_internal.h"
+#include "../include/render.h"
 #include "../include/vram.h"
 
-#define SPRITE ppu.sprites[ppu.sprite_count]
+#define SPRITE machine.ppu.sprites[machine.ppu.sprite_count]
 #define TRANSPARENT_PIXEL (Pixel) {0x00, 0x00, false};
 
 /* -----------------------------------------------------------------
  * PPU status.
  * -------------------------------------------------------------- */
 
-PPU ppu;
+#define FRAME_SIZE (FRAME_WIDTH * FRAME_HEIGHT * sizeof(dword))
 
-byte display[256][240];
-
-unsigned long long ppu_ticks;
+/* The frame the current thread displays, and the frame it renders into
+ * (the display, unless set by ppu_render_to before ppu_init). The display
+ * is allocated by the first thread that shows a frame, so threads that
+ * render for another one, or never render, do not carry a frame. */
+static _Thread_local dword (*display)[FRAME_HEIGHT] = NULL;
+static _Thread_local dword (*frame)[FRAME_HEIGHT] = NULL;
 
 static inline bool is_rendering_background(void) {
-    return ppu.mask_background;
+    return machine.ppu.mask_background;
 }
 
 static inline bool is_rendering_sprites(void) {
-    return ppu.mask_sprites;
+    return machine.ppu.mask_sprites;
 }
 
 static inline bool is_rendering(void) {
-    return ppu.mask_background || ppu.mask_sprites;
+    return machine.ppu.mask_background || machine.ppu.mask_sprites;
 }
 
 static inline bool is_prerender_line(void) {
-    return ppu.scanline == -1;
+    return machine.ppu.scanline == -1;
 }
 
 static inline bool is_visible_line(void) {
-    return ppu.scanline >= 0 && ppu.scanline < 240;
+    return machine.ppu.scanline >= 0 && machine.ppu.scanline < 240;
 }
 
 static inline bool is_render_line(void) {
-    return ppu.scanline < 240;
+    return machine.ppu.scanline < 240;
 }
 
 static inline bool is_visible_cycle(void) {
-    return ppu.dot > 0 && ppu.dot <= 256;
+    return machine.ppu.dot > 0 && machine.ppu.dot <= 256;
 }
 
 /* -----------------------------------------------------------------
@@ -54,29 +63,29 @@ static inline bool is_visible_cycle(void) {
 
 /* Coarse X increment. */
 static inline void increment_x(void) {
-    if ((ppu.v & 0x001F) == 31) {
-        ppu.v &= ~0x001F;
-        ppu.v ^= 0x0400;
+    if ((machine.ppu.v & 0x001F) == 31) {
+        machine.ppu.v &= ~0x001F;
+        machine.ppu.v ^= 0x0400;
     } else {
-        ppu.v += 1;
+        machine.ppu.v += 1;
     }
 }
 
 /* Y increment. */
 static inline void increment_y(void) {
     /* If fine Y < 7 then increment fine Y. */
-    if ((ppu.v & 0x7000) != 0x7000) {
-        ppu.v += 0x1000;
+    if ((machine.ppu.v & 0x7000) != 0x7000) {
+        machine.ppu.v += 0x1000;
     }
 
     /* Otherwise, update coarse Y. */
     else {
-        ppu.v &= ~0x7000;
-        byte coarse_y = (ppu.v & 0x03E0) >> 5;
+        machine.ppu.v &= ~0x7000;
+        byte coarse_y = (machine.ppu.v & 0x03E0) >> 5;
 
         if (coarse_y == 29) {
             coarse_y = 0;
-            ppu.v ^= 0x0800;
+            machine.ppu.v ^= 0x0800;
         }
         else if (coarse_y == 31) {
             coarse_y = 0;
@@ -85,7 +94,7 @@ static inline void increment_y(void) {
             coarse_y += 1;
         }
 
-        ppu.v = (ppu.v & ~0x03E0) | (coarse_y << 5);
+        machine.ppu.v = (machine.ppu.v & ~0x03E0) | (coarse_y << 5);
     }
 }
 
@@ -96,8 +105,37 @@ static inline void increment_v(void) {
         increment_y();
     }
     else {
-        ppu.v += ppu.ctrl_increment;
+        machine.ppu.v += machine.ppu.ctrl_increment;
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Palette colors.
+ * -------------------------------------------------------------- */
+
+/* Palette index of a 0x3F00-0x3FFF address. */
+static inline byte palette_index(word address) {
+    address &= 0x1F;
+
+    /* 0x3F10/0x3F14/0x3F18/0x3F1C mirror 0x3F00/0x3F04/0x3F08/0x3F0C. */
+    if ((address & 0x13) == 0x10) {
+        address &= 0x0F;
     }
+    return address;
+}
+
+/* Resolve the RGBA color of a palette entry under the current mask. */
+static inline dword resolve_color(byte index) {
+    byte emphasis = machine.ppu.mask_red | (machine.ppu.mask_green << 1) | (machine.ppu.mask_blue << 2);
+    byte color = machine.ppu.palette[palette_index(index)];
+    return pal_get_color(emphasis, machine.ppu.mask_grayscale ? color & 0x30 : color);
+}
+
+static inline void update_colors(void) {
+    for (int i = 0; i < PALETTE_SIZE; i++) {
+        machine.ppu.colors[i] = resolve_color(i);
+    }
+    mch_mark_dirty(machine.ppu.colors, sizeof(machine.ppu.colors));
 }
 
 /* -----------------------------------------------------------------
@@ -106,152 +144,161 @@ static inline void increment_v(void) {
 
 /* 0x2000: PPUCTRL (write). */
 static inline void write_ppu_ctrl(byte data) {
-    ppu.ctrl_nmi             = data & 0x80;
-    ppu.ctrl_master_slave    = data & 0x40;
-    ppu.ctrl_sprite_size     = data & 0x20 ? 16 : 8;
-    ppu.ctrl_background_addr = data & 0x10 ? 0x1000 : 0x0000;
-    ppu.ctrl_sprite_addr     = data & 0x08 ? 0x1000 : 0x0000;
-    ppu.ctrl_increment       = data & 0x04 ? 32 : 1;
+    machine.ppu.ctrl_nmi             = data & 0x80;
+    machine.ppu.ctrl_master_slave    = data & 0x40;
+    machine.ppu.ctrl_sprite_size     = data & 0x20 ? 16 : 8;
+    machine.ppu.ctrl_background_addr = data & 0x10 ? 0x1000 : 0x0000;
+    machine.ppu.ctrl_sprite_addr     = data & 0x08 ? 0x1000 : 0x0000;
+    machine.ppu.ctrl_increment       = data & 0x04 ? 32 : 1;
 
     /* t: ...BA.. ........ = d: ......BA */
-    ppu.t = (ppu.t & 0xF3FF) | ((data & 0x3) << 10);
+    machine.ppu.t = (machine.ppu.t & 0xF3FF) | ((data & 0x3) << 10);
 }
 
 /* 0x2001: PPUMASK (write). */
 static inline void write_ppu_mask(byte data) {
-    ppu.mask_red             = data & 0x80;
-    ppu.mask_green           = data & 0x40;
-    ppu.mask_blue            = data & 0x20;
-    ppu.mask_sprites         = data & 0x10;
-    ppu.mask_background      = data & 0x08;
-    ppu.mask_sprites_L       = data & 0x04;
-    ppu.mask_background_L    = data & 0x02;
-    ppu.mask_grayscale       = data & 0x01;
+    /* Emphasis or grayscale changes all colors. */
+    byte color_bits = (machine.ppu.mask_blue  << 7) | (machine.ppu.mask_green << 6) |
+                      (machine.ppu.mask_red   << 5) | machine.ppu.mask_grayscale;
+    bool recolor = (data & 0xE1) != color_bits;
+
+    machine.ppu.mask_blue            = data & 0x80;
+    machine.ppu.mask_green           = data & 0x40;
+    machine.ppu.mask_red             = data & 0x20;
+    machine.ppu.mask_sprites         = data & 0x10;
+    machine.ppu.mask_background      = data & 0x08;
+    machine.ppu.mask_sprites_L       = data & 0x04;
+    machine.ppu.mask_background_L    = data & 0x02;
+    machine.ppu.mask_grayscale       = data & 0x01;
+
+    if (recolor) {
+        update_colors();
+    }
 }
 
 /* 0x2002: PPUSTATUS (read). */
 static inline byte read_ppu_status() {
-    ppu.latch &= 0x1F;
-    ppu.latch |= (ppu.status_vblank   << 7);
-    ppu.latch |= (ppu.status_zero_hit << 6);
-    ppu.latch |= (ppu.status_overflow << 5);
-    ppu.status_vblank = false;
-    ppu.w = false;           /* w:    = 0 */
-    return ppu.latch;
+    machine.ppu.latch &= 0x1F;
+    machine.ppu.latch |= (machine.ppu.status_vblank   << 7);
+    machine.ppu.latch |= (machine.ppu.status_zero_hit << 6);
+    machine.ppu.latch |= (machine.ppu.status_overflow << 5);
+    machine.ppu.status_vblank = false;
+    machine.ppu.w = false;           /* w:    = 0 */
+    return machine.ppu.latch;
 }
 
 /* 0x2002: PPUSTATUS (get). */
 static inline byte get_ppu_status() {
-    byte result = ppu.latch & 0x1F;
-    result |= (ppu.status_vblank   << 7);
-    result |= (ppu.status_zero_hit << 6);
-    result |= (ppu.status_overflow << 5);
+    byte result = machine.ppu.latch & 0x1F;
+    result |= (machine.ppu.status_vblank   << 7);
+    result |= (machine.ppu.status_zero_hit << 6);
+    result |= (machine.ppu.status_overflow << 5);
     return result;
 }
 
 /* 0x2003: OAMADDR (write). */
 static inline void write_oam_address(byte data) {
-    ppu.oam_addr = data; 
+    machine.ppu.oam_addr = data; 
 }
 
 /* 0x2004: OAMDATA (read). */
 static inline byte read_oam_data() {
-    if (ppu.oam_addr % 4 == 2) {
+    if (machine.ppu.oam_addr % 4 == 2) {
         /* The three unimplemented bits of each
          * sprite's byte 2 always read back as 0. */
-        return ppu.latch = ppu.oam[ppu.oam_addr] & 0xE3;
+        return machine.ppu.latch = machine.ppu.oam[machine.ppu.oam_addr] & 0xE3;
     }
     else {
-        return ppu.latch = ppu.oam[ppu.oam_addr];
+        return machine.ppu.latch = machine.ppu.oam[machine.ppu.oam_addr];
     }
 }
 
 /* 0x2004: OAMDATA (get). */
 static inline byte get_oam_data() {
-    if (ppu.oam_addr % 4 == 2) {
-        return ppu.oam[ppu.oam_addr] & 0xE3;
+    if (machine.ppu.oam_addr % 4 == 2) {
+        return machine.ppu.oam[machine.ppu.oam_addr] & 0xE3;
     }
     else {
-        return ppu.oam[ppu.oam_addr];
+        return machine.ppu.oam[machine.ppu.oam_addr];
     }
 }
 
 /* 0x2004: OAMDATA (write). */
 static inline void write_oam_data(byte data) {
-    ppu.oam[ppu.oam_addr++] = data;
+    WRITE_MEMORY(machine.ppu.oam[machine.ppu.oam_addr++], data);
 }
 
 /* 0x2005: PPUSCROLL (write). */
 static inline void write_ppu_scroll(byte data) {
     /* First write (w is 0). */ 
-    if (!ppu.w) {
+    if (!machine.ppu.w) {
         /* t: ....... ...HGFED = d: HGFED... *
          * x:              CBA = d: .....CBA *
          * w:                  = 1           */
-        ppu.t = (ppu.t & 0xFFE0) | (data >> 3);
-        ppu.x = data & 0x07;
-        ppu.w = true;
+        machine.ppu.t = (machine.ppu.t & 0xFFE0) | (data >> 3);
+        machine.ppu.x = data & 0x07;
+        machine.ppu.w = true;
     }
     /* Second write (w is 1). */
     else {
         /* t: CBA..HG FED..... = d: HGFEDCBA *
          * w:                  = 0           */
-        ppu.t = (ppu.t & 0x8FFF) | ((data & 0x07) << 12);
-        ppu.t = (ppu.t & 0xFC1F) | ((data & 0xF8) << 2);
-        ppu.w = false;
+        machine.ppu.t = (machine.ppu.t & 0x8FFF) | ((data & 0x07) << 12);
+        machine.ppu.t = (machine.ppu.t & 0xFC1F) | ((data & 0xF8) << 2);
+        machine.ppu.w = false;
     }
 }
 
 /* 0x2006: PPUADDR (write). */
 static inline void write_ppu_address(byte data) {
     /* First write (w is 0). */
-    if (!ppu.w) {
+    if (!machine.ppu.w) {
         /* t: .FEDCBA ........ = d: ..FEDCBA *
          * t: X...... ........ = 0           *
          * w:                  = 1           */
-        ppu.t = (ppu.t & 0x80FF) | ((data & 0x3F) << 8);
-        ppu.w = true;
+        machine.ppu.t = (machine.ppu.t & 0x80FF) | ((data & 0x3F) << 8);
+        machine.ppu.w = true;
     }
     /* Second write (w is 1). */
     else {
         /* t: ....... HGFEDCBA = d: HGFEDCBA *
          * v                   = t           *
          * w:                  = 0           */
-        ppu.t = (ppu.t & 0xFF00) | data;
-        ppu.v = ppu.t;
-        ppu.w = false;
+        machine.ppu.t = (machine.ppu.t & 0xFF00) | data;
+        machine.ppu.v = machine.ppu.t;
+        machine.ppu.w = false;
     }
 }
 
 /* 0x2007: PPUDATA (read). */
 static inline byte read_ppu_data() {
-    if ((ppu.v & 0x3FFF) < 0x3F00) {
-        ppu.latch = ppu.read_buffer;
-        ppu.read_buffer = vrm_read(ppu.v);
+    if ((machine.ppu.v & 0x3FFF) < 0x3F00) {
+        machine.ppu.latch = machine.ppu.read_buffer;
+        machine.ppu.read_buffer = vrm_read(machine.ppu.v);
     }
     else {
-        ppu.latch = ppu_palette_read(ppu.v);
-        ppu.read_buffer = vrm_read(ppu.v - 0x1000);
+        machine.ppu.latch = ppu_palette_read(machine.ppu.v);
+        machine.ppu.read_buffer = vrm_read(machine.ppu.v - 0x1000);
     }
 
     increment_v();
-    return ppu.latch;
+    return machine.ppu.latch;
 }
 
 /* 0x2007: PPUDATA (get). */
 static inline byte get_ppu_data() {
-    return (ppu.v & 0x3FFF) < 0x3F00 ? ppu.read_buffer : ppu_palette_read(ppu.v);
+    return (machine.ppu.v & 0x3FFF) < 0x3F00 ? machine.ppu.read_buffer : ppu_palette_read(machine.ppu.v);
 }
 
 /* 0x2007: PPUDATA (write). */
 static inline void write_ppu_data(byte data) {
-    vrm_write(ppu.v, data);
+    vrm_write(machine.ppu.v, data);
     increment_v();
 }
 
 /* 0x4014: OAMDMA (read). */
 inline byte ppu_dma_read(void) {
-    return ppu.latch;
+    return machine.ppu.latch;
 }
 
 /* 0x4014: OAMDMA (write). */
@@ -259,23 +306,43 @@ inline void ppu_dma_write(byte data) {
     ppu_catch_up();
 
     word mem_address = data << 8;
-    for (int i = 0; i < 256; i++) {
-        ppu.oam[ppu.oam_addr++] = mem_read(mem_address++);
+    byte *page = mem_page(mem_address);
+
+    /* RAM and cartridge pages are copied directly, wrapping around at the
+     * end of OAM; oam_addr ends where it started. */
+    if (page != NULL) {
+        int length = OAM_SIZE - machine.ppu.oam_addr;
+        mch_write(machine.ppu.oam + machine.ppu.oam_addr, page, length);
+        mch_write(machine.ppu.oam, page + length, machine.ppu.oam_addr);
+    }
+
+    /* I/O pages are read byte by byte for their side effects. */
+    else {
+        for (int i = 0; i < 256; i++) {
+            WRITE_MEMORY(machine.ppu.oam[machine.ppu.oam_addr++], mem_read(mem_address++));
+        }
     }
+    rdr_log_oam(machine.ppu.oam);
     cpu_suspend(513 + (cpu_get_ticks() % 2));
-    ppu.latch = data;
+    machine.ppu.latch = data;
 }
 
-/* 0x2000-0x2007: Read PPU register. */
-inline byte ppu_io_read(word address) {
-    ppu_catch_up();
-
+/* 0x2000-0x2007: Read PPU register (without catching up). */
+inline byte ppu_register_read(word address) {
     switch (address & 0x7) {
         case 2: return read_ppu_status();
         case 4: return read_oam_data();
         case 7: return read_ppu_data();
     }
-    return ppu.latch;
+    return machine.ppu.latch;
+}
+
+/* 0x2000-0x2007: Read PPU register. */
+inline byte ppu_io_read(word address) {
+    ppu_catch_up();
+
+    rdr_log_register_read(address);
+    return ppu_register_read(address);
 }
 
 /* 0x2000-0x2007: Read PPU register (without side-effects). */
@@ -285,13 +352,11 @@ inline byte ppu_io_get(word address) {
         case 4: return get_oam_data();
         case 7: return get_ppu_data();
     }
-    return ppu.latch;
+    return machine.ppu.latch;
 }
 
-/* 0x2000-0x2007: Write PPU register. */
-inline void ppu_io_write(word address, byte data) {
-    ppu_catch_up();
-
+/* 0x2000-0x2007: Write PPU register (without catching up). */
+inline void ppu_register_write(word address, byte data) {
     switch (address & 0x7) {
         case 0: write_ppu_ctrl(data);      break;
         case 1: write_ppu_mask(data);      break;
@@ -301,27 +366,44 @@ inline void ppu_io_write(word address, byte data) {
         case 6: write_ppu_address(data);   break;
         case 7: write_ppu_data(data);      break;
     }
-    ppu.latch = data;
+    machine.ppu.latch = data;
+}
+
+/* 0x2000-0x2007: Write PPU register. */
+inline void ppu_io_write(word address, byte data) {
+    ppu_catch_up();
+
+    rdr_log_register_write(address, data);
+    ppu_register_write(address, data);
 }
 
 /* 0x3F00-0x3FFF: Read PPU palette. */
 inline byte ppu_palette_read(word address) {
-    return ppu.palette[address & 0x1F];
+    return machine.ppu.palette[palette_index(address)];
 }
 
 /* 0x3F00-0x3FFF: Write PPU palette. */
 inline void ppu_palette_write(word address, byte data) {
-    ppu.palette[address & 0x1F] = data;
+    byte index = palette_index(address);
+    WRITE_MEMORY(machine.ppu.palette[index], data & 0x3F);
+
+    /* Update the color of the entry and its mirror. */
+    machine.ppu.colors[index] = resolve_color(index);
+    MARK_DIRTY(&machine.ppu.colors[index]);
+    if ((index & 0x03) == 0x00) {
+        machine.ppu.colors[index | 0x10] = machine.ppu.colors[index];
+        MARK_DIRTY(&machine.ppu.colors[index | 0x10]);
+    }
 }
 
 /* 0x2000-0x3EFF: Read PPU nametable. */
 inline byte ppu_nametable_read(word address) {
-    return ppu.nametable[address & 0x1FFF];
+    return machine.ppu.nametable[address & 0x1FFF];
 }
 
 /* 0x2000-0x3EFF: Write PPU nametable. */
 inline void ppu_nametable_write(word address, byte data) {
-    ppu.nametable[address & 0x1FFF] = data;
+    WRITE_MEMORY(machine.ppu.nametable[address & 0x1FFF], data);
 }
 
 /* -----------------------------------------------------------------
@@ -330,56 +412,56 @@ inline void ppu_nametable_write(word address, byte data) {
 
 static inline void copy_horizontal(void) {
     /* v: ....F.. ...EDCBA = t: ....F.. ...EDCBA */
-    ppu.v = (ppu.v & 0xFBE0) | (ppu.t & ~0xFBE0);
+    machine.ppu.v = (machine.ppu.v & 0xFBE0) | (machine.ppu.t & ~0xFBE0);
 }
 
 static inline void copy_vertical(void) {
     /* v: IHGF.ED CBA..... = t: IHGF.ED CBA..... */
-    ppu.v = (ppu.v & 0x841F) | (ppu.t & ~0x841F);
+    machine.ppu.v = (machine.ppu.v & 0x841F) | (machine.ppu.t & ~0x841F);
 }
 
 static inline void fetch_nametable_byte(void) {
-    ppu.nametable_byte = vrm_read(0x2000 | (ppu.v & 0x0FFF));
+    machine.ppu.nametable_byte = vrm_read(0x2000 | (machine.ppu.v & 0x0FFF));
 }
 
 static inline void fetch_attribute_byte(void) {
-    word address = 0x23C0 | (ppu.v & 0x0C00);
-    address = address | ((ppu.v >> 4) & 0x38);
-    address = address | ((ppu.v >> 2) & 0x07);
-    byte shift = ((ppu.v >> 4) & 4) | (ppu.v & 0x2);
-    ppu.attribute_byte = (vrm_read(address) >> shift) & 0x3;
+    word address = 0x23C0 | (machine.ppu.v & 0x0C00);
+    address = address | ((machine.ppu.v >> 4) & 0x38);
+    address = address | ((machine.ppu.v >> 2) & 0x07);
+    byte shift = ((machine.ppu.v >> 4) & 4) | (machine.ppu.v & 0x2);
+    machine.ppu.attribute_byte = (vrm_read(address) >> shift) & 0x3;
 }
 
 static inline void fetch_low_tile(void) {
-    byte fine_y = (ppu.v >> 12) & 0x7;
-    word address = ppu.ctrl_background_addr + 16 * ppu.nametable_byte + fine_y;
-    ppu.low_tile = vrm_read(address);
+    byte fine_y = (machine.ppu.v >> 12) & 0x7;
+    word address = machine.ppu.ctrl_background_addr + 16 * machine.ppu.nametable_byte + fine_y;
+    machine.ppu.low_tile = vrm_read(address);
 }
 
 static inline void fetch_high_tile(void) {
-    byte fine_y = (ppu.v >> 12) & 0x7;
-    word address = ppu.ctrl_background_addr + 16 * ppu.nametable_byte + fine_y;
-    ppu.high_tile = vrm_read(address + 8);
+    byte fine_y = (machine.ppu.v >> 12) & 0x7;
+    word address = machine.ppu.ctrl_background_addr + 16 * machine.ppu.nametable_byte + fine_y;
+    machine.ppu.high_tile = vrm_read(address + 8);
 }
 
 /* Store the background tile data in the shift registers. */
 static inline void store_tile_data(void) {
-    ppu.attribute_register <<= 2;
-    ppu.low_tile_register  |= ppu.low_tile;
-    ppu.high_tile_register |= ppu.high_tile;
-    ppu.attribute_register |= ppu.attribute_byte;
+    machine.ppu.attribute_register <<= 2;
+    machine.ppu.low_tile_register  |= machine.ppu.low_tile;
+    machine.ppu.high_tile_register |= machine.ppu.high_tile;
+    machine.ppu.attribute_register |= machine.ppu.attribute_byte;
 }
 
 /* Fetch the sprite's low and high tile for the next scanline. */
 static inline void fetch_sprite_tiles(byte row) {
     /* Check if the sprite should be flipped vertically. */
     if (SPRITE.flip_v) {
-        row = ppu.ctrl_sprite_size - row - 1;
+        row = machine.ppu.ctrl_sprite_size - row - 1;
     }
 
     word address;   /* Sprite pattern address. */
-    if (ppu.ctrl_sprite_size == 8) {
-        address = ppu.ctrl_sprite_addr + 16 * SPRITE.tile + row;
+    if (machine.ppu.ctrl_sprite_size == 8) {
+        address = machine.ppu.ctrl_sprite_addr + 16 * SPRITE.tile + row;
     }
     else {
         word bank = 0x1000 * (SPRITE.tile & 0x01);
@@ -400,61 +482,61 @@ static inline void fetch_sprite_tiles(byte row) {
 /* Fetch the sprite data for the next scanline. */
 static inline void quick_sprite_evaluation(void) {
     /* Reset sprite count. */
-    ppu.sprite_count = 0;
+    machine.ppu.sprite_count = 0;
 
-    for (int n = 0; n < OAM_SIZE && ppu.sprite_count < MAX_SPRITES; n+=4) {
+    for (int n = 0; n < OAM_SIZE && machine.ppu.sprite_count < MAX_SPRITES; n+=4) {
         /* Read a sprite's Y-coordinate. */
-        SPRITE.y = ppu.oam[n];
+        SPRITE.y = machine.ppu.oam[n];
 
         /* If the Y-coordinate is in range, copy the remaining bytes of sprite data */
-        int row = ppu.scanline - SPRITE.y;
-        if (row >= 0 && row < ppu.ctrl_sprite_size) {
-            SPRITE.tile     = ppu.oam[n + 1];
-            SPRITE.palette  = ppu.oam[n + 2] & 0x03;
-            SPRITE.priority = ppu.oam[n + 2] & 0x20;
-            SPRITE.flip_h   = ppu.oam[n + 2] & 0x40;
-            SPRITE.flip_v   = ppu.oam[n + 2] & 0x80;
-            SPRITE.x        = ppu.oam[n + 3];
+        int row = machine.ppu.scanline - SPRITE.y;
+        if (row >= 0 && row < machine.ppu.ctrl_sprite_size) {
+            SPRITE.tile     = machine.ppu.oam[n + 1];
+            SPRITE.palette  = machine.ppu.oam[n + 2] & 0x03;
+            SPRITE.priority = machine.ppu.oam[n + 2] & 0x20;
+            SPRITE.flip_h   = machine.ppu.oam[n + 2] & 0x40;
+            SPRITE.flip_v   = machine.ppu.oam[n + 2] & 0x80;
+            SPRITE.x        = machine.ppu.oam[n + 3];
 
             fetch_sprite_tiles(row);
-            ppu.sprite_count++;
+            machine.ppu.sprite_count++;
         }
     }
 }
 
 /* Get the background pixel using the stored tile data. */
 static inline byte background_pixel(int x, int y) {
-    if (x < 8 && !ppu.mask_background_L) {
+    if (x < 8 && !machine.ppu.mask_background_L) {
         return 0x00;
     }
     else {
-        byte bit_0 = (ppu.low_tile_register  << ppu.x) >> 15;
-        byte bit_1 = (ppu.high_tile_register << ppu.x) >> 15;
-        return (ppu.attribute_register & 0xC) | (bit_1 << 1) | bit_0;
+        byte bit_0 = ((machine.ppu.low_tile_register  << machine.ppu.x) >> 15) & 0x01;
+        byte bit_1 = ((machine.ppu.high_tile_register << machine.ppu.x) >> 15) & 0x01;
+        return (machine.ppu.attribute_register & 0xC) | (bit_1 << 1) | bit_0;
     }
 }
 
 /* Get the sprite pixel using the stored sprite data. */
 static inline Pixel sprite_pixel(int x, int y) {
     /* Check if we should render the current dot. */
-    if (x >= 8 || ppu.mask_sprites_L) {
-        for (int i = 0; i < ppu.sprite_count; i++) {
-            byte col = x - ppu.sprites[i].x;
+    if (x >= 8 || machine.ppu.mask_sprites_L) {
+        for (int i = 0; i < machine.ppu.sprite_count; i++) {
+            byte col = x - machine.ppu.sprites[i].x;
 
             /* Check if the sprite should be rendered at the current dot. */
             if (col >= 0 && col < 8) {
                 /* Check if the sprite should be flipped horizontally. */
-                if (!ppu.sprites[i].flip_h) {
+                if (!machine.ppu.sprites[i].flip_h) {
                     col = 7 - col;
                 }
 
-                byte bit_0 = (ppu.sprites[i].low_tile  >> col) & 0x01;
-                byte bit_1 = (ppu.sprites[i].high_tile >> col) & 0x01;
+                byte bit_0 = (machine.ppu.sprites[i].low_tile  >> col) & 0x01;
+                byte bit_1 = (machine.ppu.sprites[i].high_tile >> col) & 0x01;
                 byte pixel = (bit_1 << 1) | bit_0;
 
                 if (pixel != 0x00) {
-                    byte palette = ppu.sprites[i].palette << 2;
-                    return (Pixel) {pixel, palette, ppu.sprites[i].priority};
+                    byte palette = machine.ppu.sprites[i].palette << 2;
+                    return (Pixel) {pixel, palette, machine.ppu.sprites[i].priority};
                 }
             }
         }
@@ -465,38 +547,45 @@ static inline Pixel sprite_pixel(int x, int y) {
 
 /* Render the current pixel. */
 static inline void render_dot(void) {
-    int x = ppu.dot - 1, y = ppu.scanline;
+    int x = machine.ppu.dot - 1, y = machine.ppu.scanline;
     Pixel sprite = sprite_pixel(x, y);
 
     if (sprite.priority || sprite.pixel == 0x00) {
-        display[x][y] = vrm_read(0x3F00 | background_pixel(x, y));
+        /* Transparent background pixels show the backdrop color (0x3F00). */
+        byte background = background_pixel(x, y);
+        frame[x][y] = machine.ppu.colors[background & 0x03 ? background : 0x00];
     }
     else {
-        display[x][y] = vrm_read(0x3F10 | sprite.palette | sprite.pixel);
+        frame[x][y] = machine.ppu.colors[0x10 | sprite.palette | sprite.pixel];
     }
 }
 
 /* Update the scanline and dot counters after every cycle. */
 static inline void ppu_tick(void) {
-    ppu.dot++;
-    if (ppu.dot > 340) {
-        ppu.dot = 0;
+    machine.ppu.dot++;
+    if (machine.ppu.dot > 340) {
+        machine.ppu.dot = 0;
 
-        ppu.scanline++;
-        if (ppu.scanline > 260) {
-            ppu.scanline = -1;
+        machine.ppu.scanline++;
+        if (machine.ppu.scanline > 260) {
+            machine.ppu.scanline = -1;
 
             /* Skip the first pre-render cycle on odd frames. */
-            ppu.odd_frame = !ppu.odd_frame;
-            if (ppu.odd_frame && is_rendering()) {
-                ppu.dot = 1;
+            machine.ppu.odd_frame = !machine.ppu.odd_frame;
+            if (machine.ppu.odd_frame && is_rendering()) {
+                machine.ppu.dot = 1;
             }
 
-            ppu.frame++;
+            machine.ppu.frame++;
         }
     }
 }
 
+/* Whether this thread runs the pixel pipeline. */
+static inline bool draws_pixels(void) {
+    return render_mode == RENDER_INLINE || render_mode == RENDER_WORKER;
+}
+
 /* Execute one PPU cycle. */
 void ppu_step(void) {
     if (is_rendering()) {
@@ -505,7 +594,7 @@ void ppu_step(void) {
             /* During dots 280 to 340 of the pre-render scanline: If rendering
              * if enabled, the PPU copies all bits related to vertical position
              * from t to v. */
-            if (ppu.dot >= 280 && ppu.dot <= 340) {
+            if (machine.ppu.dot >= 280 && machine.ppu.dot <= 340) {
                 copy_vertical();
             }
         }
@@ -515,66 +604,85 @@ void ppu_step(void) {
             /* During dots 1 to 256 and dots 321 to 336: the data for each tile is
              * fetched. Every 8 dots the horizontal position in v is incremented and
              * the tile data is stored in the shift registers. */
-            if ((ppu.dot > 0 && ppu.dot <= 256) || (ppu.dot > 320 && ppu.dot <= 336)) {
-                ppu.low_tile_register  <<= 1;
-                ppu.high_tile_register <<= 1;
-
-                switch (ppu.dot % 8) {
-                    case 1: fetch_nametable_byte(); break;
-                    case 3: fetch_attribute_byte(); break;
-                    case 5: fetch_low_tile();       break;
-                    case 7: fetch_high_tile();      break;
-                    case 0: store_tile_data();
-                            increment_x();          break;
+            if ((machine.ppu.dot > 0 && machine.ppu.dot <= 256) ||
+                    (machine.ppu.dot > 320 && machine.ppu.dot <= 336)) {
+                /* The tile data only affects pixels; a deferred PPU leaves it
+                 * to the render worker, and frames nobody sees skip it. */
+                if (draws_pixels()) {
+                    machine.ppu.low_tile_register  <<= 1;
+                    machine.ppu.high_tile_register <<= 1;
+
+                    switch (machine.ppu.dot % 8) {
+                        case 1: fetch_nametable_byte(); break;
+                        case 3: fetch_attribute_byte(); break;
+                        case 5: fetch_low_tile();       break;
+                        case 7: fetch_high_tile();      break;
+                        case 0: store_tile_data();      break;
+                    }
+                }
+
+                if (machine.ppu.dot % 8 == 0) {
+                    increment_x();
                 }
             }
 
             /* OAMADDR is set to 0 during each of ticks 257-320 (the sprite tile
              * loading interval) of the pre-render and visible scanlines. */
-            else if (ppu.dot > 256 && ppu.dot <= 320) {
-                ppu.oam_addr = 0x00;
+            else if (machine.ppu.dot > 256 && machine.ppu.dot <= 320) {
+                machine.ppu.oam_addr = 0x00;
             }
 
             /* At dot 256 of each scanline: If rendering is enabled, the PPU
              * increments the vertical position in v. */
-            if (ppu.dot == 256) {
+            if (machine.ppu.dot == 256) {
                 increment_y();
             }
 
             /* At dot 257 of each scanline: If rendering is enabled, the PPU
             * copies all bits related to horizontal position from t to v. */
-            else if (ppu.dot == 257) {
+            else if (machine.ppu.dot == 257) {
                 copy_horizontal();
             }
         }
 
         /* Visible scanlines (0-239). */
-        if (is_visible_line()) {
+        if (is_visible_line() && draws_pixels()) {
             /* Render visible dots (1-256) on visible scanlines. */
             if (is_visible_cycle()) {
                 render_dot();
             }
 
             /* Evaluate sprites near the end (dot 257) of each visible line. */
-            else if (ppu.dot == 257) {
+            else if (machine.ppu.dot == 257) {
                 quick_sprite_evaluation();
             }
         }
+
+        /* The sprites of the last visible line are still loaded at the start
+         * of the next frame, which may be drawn. */
+        else if (render_mode == RENDER_NONE && machine.ppu.scanline == 239 && machine.ppu.dot == 257) {
+            quick_sprite_evaluation();
+        }
     }
 
     /* Start of vblank (scanline 241, dot 1). */
-    if (ppu.scanline == 241 && ppu.dot == 1) {
-        ppu.status_vblank = true;
-        if (ppu.ctrl_nmi) {
+    if (machine.ppu.scanline == 241 && machine.ppu.dot == 1) {
+        machine.ppu.status_vblank = true;
+        if (machine.ppu.ctrl_nmi && render_mode != RENDER_WORKER) {
             cpu_set_nmi();
         }
+
+        /* All visible lines are done: hand the frame to the render worker. */
+        if (render_mode == RENDER_DEFERRED) {
+            rdr_submit_frame();
+        }
     }
     
     /* End of vblank (scanline 261, dot 1). */ 
-    if (is_prerender_line() && ppu.dot == 1) {
-        ppu.status_vblank   = false;
-        ppu.status_zero_hit = false;
-        ppu.status_overflow = false;
+    if (is_prerender_line() && machine.ppu.dot == 1) {
+        machine.ppu.status_vblank   = false;
+        machine.ppu.status_zero_hit = false;
+        machine.ppu.status_overflow = false;
     }
 
     ppu_tick();
@@ -583,14 +691,42 @@ void ppu_step(void) {
 /* Catch up PPU cycle to current CPU cycle. */
 inline void ppu_catch_up(void) {
     unsigned long long cpu_ticks = cpu_get_ticks();
-    for (int i = 0; i < 3 * (cpu_ticks - ppu_ticks); i++) {
+    for (int i = 0; i < 3 * (cpu_ticks - machine.ppu_ticks); i++) {
         ppu_step();
     }
-    ppu_ticks = cpu_ticks;
+    machine.ppu_ticks = cpu_ticks;
+}
+
+inline dword ppu_get_pixel(int x, int y) {
+    return display != NULL ? display[x][y] : 0;
+}
+
+static void allocate_display(void) {
+    if (display == NULL) {
+        display = calloc(1, FRAME_SIZE);
+        if (display == NULL) {
+            LOG_ERROR("Unable to allocate memory for the display.");
+        }
+    }
+}
+
+void ppu_free_display(void) {
+    if (frame == display) {
+        frame = NULL;
+    }
+    free(display);
+    display = NULL;
 }
 
-inline byte ppu_get_pixel(int x, int y) {
-    return display[x][y];
+/* Render the pixels of the current thread into the given frame. */
+void ppu_render_to(dword (*frame_)[FRAME_HEIGHT]) {
+    frame = frame_;
+}
+
+/* Copy a frame rendered on another thread to the display. */
+void ppu_show_frame(dword (*frame_)[FRAME_HEIGHT]) {
+    allocate_display();
+    memcpy(display, frame_, FRAME_SIZE);
 }
 
 /* -----------------------------------------------------------------
@@ -598,37 +734,48 @@ inline byte ppu_get_pixel(int x, int y) {
  * -------------------------------------------------------------- */
 
 void ppu_init(void) {
+    pal_init();
     write_ppu_ctrl   (0x00);
     write_ppu_mask   (0x00);
     write_oam_address(0x00);
 
-    ppu.status_vblank   = true;
-    ppu.status_zero_hit = false;
-    ppu.status_overflow = true;
+    machine.ppu.status_vblank   = true;
+    machine.ppu.status_zero_hit = false;
+    machine.ppu.status_overflow = true;
 
-    ppu.latch = ppu.read_buffer = 0x00;
+    machine.ppu.latch = machine.ppu.read_buffer = 0x00;
 
-    ppu.x = 0x00;
-    ppu.v = 0x0000;
-    ppu.t = 0x0000;
-    ppu.w = false;
+    machine.ppu.x = 0x00;
+    machine.ppu.v = 0x0000;
+    machine.ppu.t = 0x0000;
+    machine.ppu.w = false;
 
+    mch_begin_write(machine.ppu.nametable, NAMETABLE_SIZE);
     for (int i = 0; i < NAMETABLE_SIZE; i++) {
-        ppu.nametable[i] = 0xFF;
+        machine.ppu.nametable[i] = 0xFF;
     }
+    mch_end_write(machine.ppu.nametable, NAMETABLE_SIZE);
+    update_colors();
 
-    ppu.dot      =  0;
-    ppu.scanline = -1;
-    ppu.frame    =  0;
+    machine.ppu.dot      =  0;
+    machine.ppu.scanline = -1;
+    machine.ppu.frame    =  0;
+
+    /* Nothing is drawn while rendering is off. */
+    if (frame == NULL) {
+        allocate_display();
+        frame = display;
+    }
+    memset(frame, 0, FRAME_SIZE);
 }
 
 void ppu_reset(void) {
     write_ppu_ctrl(0x00);
     write_ppu_mask(0x00);
 
-    ppu.latch = ppu.read_buffer = 0x00;
+    machine.ppu.latch = machine.ppu.read_buffer = 0x00;
 
-    ppu.x = 0x00;
-    ppu.t = 0x0000;
-    ppu.w = false;
+    machine.ppu.x = 0x00;
+    machine.ppu.t = 0x0000;
+    machine.ppu.w = false;
 }
@@ -0,0 +1,281 @@
+/* -----------------------------------------------------------------
+ * Deferred rendering.
+ *
+ * The emulation thread steps a PPU that skips the pixel pipeline, and logs
+ * every change that affects pixels together with the dot at which it
+ * happened. Once per frame the log is handed to a worker thread, which
+ * replays it on its own copy of the machine and cartridge to
+ * render the frame, while the emulation thread runs ahead into the next one.
+ * Everything the CPU can observe stays on the emulation thread. Every
+ * emulation thread has a worker of its own.
+ * -------------------------------------------------------------- */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/cartridge.h"
+#include "../include/log.h"
+#include "../include/machine.h"
+#include "../include/mmc.h"
+#include "../include/ppu.h"
+#include "../include/ppu_internal.h"
+#include "../include/render.h"
+
+#define INITIAL_LOG_SIZE 1024
+#define INITIAL_OAM_SIZE 4
+
+typedef enum { REGISTER_READ, REGISTER_WRITE, CARTRIDGE_WRITE, OAM_COPY } EventType;
+
+typedef struct {
+    unsigned long long dot;         /* PPU position of the change. */
+    EventType type;                 /* Type of the change. */
+    word address;                   /* Address (OAM_COPY: index of the copy). */
+    byte data;                      /* Data written. */
+} Event;
+
+typedef struct {
+    Event *events;                  /* Changes in the order they happened. */
+    int count, size;
+    byte (*oam)[OAM_SIZE];          /* OAM contents after each OAM DMA. */
+    int oam_count, oam_size;
+    unsigned long long end;         /* PPU position at which the log ends. */
+} Log;
+
+_Thread_local RenderMode render_mode = RENDER_INLINE;
+
+typedef struct {
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool busy;                      /* The worker is replaying a log. */
+    bool stop;                      /* The worker should exit. */
+
+    Log logs[2];
+    Log *recording;                 /* Log filled by the emulation thread. */
+    Log *rendering;                 /* Log replayed by the worker. */
+
+    /* Worker state. */
+    Machine start;                  /* Machine state at the start of the first log. */
+    Cartridge *cartridge;           /* The worker's copy of the cartridge. */
+    dword frame[FRAME_WIDTH][FRAME_HEIGHT];
+} Renderer;
+
+/* Renderer of the emulation thread (NULL: rendering inline). Every thread
+ * that runs a machine has its own, with a worker of its own. */
+static _Thread_local Renderer *renderer = NULL;
+
+/* Position of the PPU of the current thread in dots since power on. */
+static inline unsigned long long position(void) {
+    return (machine.ppu.frame * 262 + (machine.ppu.scanline + 1)) * 341 + machine.ppu.dot;
+}
+
+/* -----------------------------------------------------------------
+ * Log.
+ * -------------------------------------------------------------- */
+
+static inline void append(EventType type, word address, byte data) {
+    Log *recording = renderer->recording;
+    if (recording->count == recording->size) {
+        recording->size = recording->size ? 2 * recording->size : INITIAL_LOG_SIZE;
+        recording->events = realloc(recording->events, recording->size * sizeof(Event));
+        if (recording->events == NULL) {
+            LOG_ERROR("Unable to allocate memory for render log.");
+        }
+    }
+
+    Event *event   = &recording->events[recording->count++];
+    event->dot     = position();
+    event->type    = type;
+    event->address = address;
+    event->data    = data;
+}
+
+void rdr_log_register_read(word address) {
+    /* Only PPUSTATUS (w) and PPUDATA (v) reads change state used for pixels. */
+    if (render_mode == RENDER_DEFERRED &&
+            ((address & 0x7) == 2 || (address & 0x7) == 7)) {
+        append(REGISTER_READ, address, 0x00);
+    }
+}
+
+void rdr_log_register_write(word address, byte data) {
+    if (render_mode == RENDER_DEFERRED) {
+        append(REGISTER_WRITE, address, data);
+    }
+}
+
+void rdr_log_cartridge_write(word address, byte data) {
+    if (render_mode == RENDER_DEFERRED) {
+        /* Mapper writes do not catch up the PPU by themselves. */
+        ppu_catch_up();
+        append(CARTRIDGE_WRITE, address, data);
+    }
+}
+
+void rdr_log_oam(const byte *oam) {
+    if (render_mode == RENDER_DEFERRED) {
+        Log *recording = renderer->recording;
+        if (recording->oam_count == recording->oam_size) {
+            recording->oam_size = recording->oam_size ? 2 * recording->oam_size :
+                INITIAL_OAM_SIZE;
+            recording->oam = realloc(recording->oam, recording->oam_size * OAM_SIZE);
+            if (recording->oam == NULL) {
+                LOG_ERROR("Unable to allocate memory for render log.");
+            }
+        }
+
+        memcpy(recording->oam[recording->oam_count], oam, OAM_SIZE);
+        append(OAM_COPY, recording->oam_count++, 0x00);
+    }
+}
+
+static void free_log(Log *log) {
+    free(log->events);
+    free(log->oam);
+    *log = (Log) { NULL, 0, 0, NULL, 0, 0, 0 };
+}
+
+/* -----------------------------------------------------------------
+ * Worker.
+ * -------------------------------------------------------------- */
+
+/* Replay a log on the PPU of the worker. */
+static void replay(Log *log) {
+    for (int i = 0; i < log->count; i++) {
+        Event *event = &log->events[i];
+
+        /* Step up to the dot at which the change happened. */
+        while (position() < event->dot) {
+            ppu_step();
+        }
+
+        switch (event->type) {
+            case REGISTER_READ:   ppu_register_read (event->address);              break;
+            case REGISTER_WRITE:  ppu_register_write(event->address, event->data); break;
+            case CARTRIDGE_WRITE: mmc_cpu_write     (event->address, event->data); break;
+            case OAM_COPY:        memcpy(machine.ppu.oam, log->oam[event->address], OAM_SIZE);
+                                  break;
+        }
+    }
+
+    while (position() < log->end) {
+        ppu_step();
+    }
+}
+
+static void *run_worker(void *arg) {
+    Renderer *parent = arg;
+    render_mode = RENDER_WORKER;
+    machine = parent->start;
+    mmc_attach(parent->cartridge);
+    ppu_render_to(parent->frame);
+
+    pthread_mutex_lock(&parent->mutex);
+    while (true) {
+        while (!parent->busy && !parent->stop) {
+            pthread_cond_wait(&parent->cond, &parent->mutex);
+        }
+        if (parent->stop) {
+            break;
+        }
+        pthread_mutex_unlock(&parent->mutex);
+
+        replay(parent->rendering);
+
+        pthread_mutex_lock(&parent->mutex);
+        parent->busy = false;
+        pthread_cond_broadcast(&parent->cond);
+    }
+    pthread_mutex_unlock(&parent->mutex);
+
+    return NULL;
+}
+
+/* Wait until the worker has finished replaying its log. */
+static inline void wait_idle(void) {
+    while (renderer->busy) {
+        pthread_cond_wait(&renderer->cond, &renderer->mutex);
+    }
+}
+
+void rdr_submit_frame(void) {
+    renderer->recording->end = position();
+
+    pthread_mutex_lock(&renderer->mutex);
+    wait_idle();
+
+    /* Show the previous frame and start rendering this one. */
+    ppu_show_frame(renderer->frame);
+
+    Log *log            = renderer->rendering;
+    renderer->rendering = renderer->recording;
+    renderer->recording = log;
+    log->count = log->oam_count = 0;
+
+    renderer->busy = true;
+    pthread_cond_broadcast(&renderer->cond);
+    pthread_mutex_unlock(&renderer->mutex);
+}
+
+/* -----------------------------------------------------------------
+ * Enable/disable deferred rendering.
+ * -------------------------------------------------------------- */
+
+void rdr_enable(void) {
+    if (renderer != NULL) {
+        return;
+    }
+
+    Renderer *created = calloc(1, sizeof(Renderer));
+    if (created == NULL) {
+        LOG_WARNING("Unable to allocate memory for render worker.");
+        return;
+    }
+
+    /* The worker starts from the current state of the emulation thread. */
+    pthread_mutex_init(&created->mutex, NULL);
+    pthread_cond_init(&created->cond, NULL);
+    created->start     = machine;
+    created->cartridge = mmc_clone();
+    created->recording = &created->logs[0];
+    created->rendering = &created->logs[1];
+
+    if (pthread_create(&created->worker, NULL, run_worker, created) != 0) {
+        LOG_WARNING("Unable to start render worker.");
+        mmc_free_clone(created->cartridge);
+        free(created);
+        return;
+    }
+
+    render_mode = RENDER_DEFERRED;
+    renderer = created;
+}
+
+void rdr_disable(void) {
+    if (renderer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&renderer->mutex);
+    wait_idle();
+    renderer->stop = true;
+    pthread_cond_broadcast(&renderer->cond);
+    pthread_mutex_unlock(&renderer->mutex);
+    pthread_join(renderer->worker, NULL);
+
+    /* The emulation thread refills its own tile and sprite data within a
+     * scanline. */
+    render_mode = RENDER_INLINE;
+
+    mmc_free_clone(renderer->cartridge);
+    free_log(&renderer->logs[0]);
+    free_log(&renderer->logs[1]);
+    pthread_mutex_destroy(&renderer->mutex);
+    pthread_cond_destroy(&renderer->cond);
+    free(renderer);
+    renderer = NULL;
+}
+
+inline bool rdr_is_enabled(void) {
+    return renderer != NULL;
+}
@@ -0,0 +1,283 @@
+/* -----------------------------------------------------------------
+ * Rewind.
+ *
+ * Snapshots are save states, stored in a ring buffer that is allocated
+ * once. Every REWIND_KEYFRAME_INTERVAL snapshots a keyframe is stored in
+ * full; the snapshots in between are stored as the XOR with their keyframe.
+ * Both are run-length encoded, which shrinks a delta to the few bytes that
+ * changed. When the buffer is full the oldest keyframe is dropped together
+ * with its deltas.
+ * -------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <string.h>
+#include "../include/log.h"
+#include "../include/nes.h"
+#include "../include/rewind.h"
+
+#define AVERAGE_SIZE      128
+#define MAX_RUN           0xFFFF
+
+typedef struct {
+    size_t offset;                  /* Position of the data in the buffer. */
+    size_t size;                    /* Size of the encoded data. */
+    unsigned long long keyframe;    /* Number of the keyframe of the snapshot. */
+} Snapshot;
+
+static bool enabled = false;
+static int interval, frames;
+
+/* Encoded snapshots. Snapshots are numbered in the order they were taken;
+ * those in [first, last) are kept. */
+static byte *buffer = NULL;
+static size_t buffer_size, head;
+static Snapshot *snapshots = NULL;
+static int capacity;
+static unsigned long long first, last;
+
+/* Decoded keyframe, and scratch space for one state. They are part of the
+ * budget. */
+static byte *keyframe = NULL;
+static unsigned long long keyframe_number;
+static byte *state = NULL, *encoded = NULL;
+static size_t state_size;
+
+static inline Snapshot *snapshot(unsigned long long number) {
+    return &snapshots[number % capacity];
+}
+
+/* -----------------------------------------------------------------
+ * Run-length encoding of the XOR of a state with a reference.
+ *
+ * The encoding is a list of runs: a 16 bit count of bytes equal to the
+ * reference, a 16 bit count of bytes that differ, and the XOR of those.
+ * -------------------------------------------------------------- */
+
+static inline void put_16(byte *data, int value) {
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+static inline int get_16(const byte *data) {
+    return data[0] | (data[1] << 8);
+}
+
+static size_t encode(byte *out, const byte *data, const byte *reference) {
+    size_t in = 0, size = 0;
+
+    while (in < state_size) {
+        int same = 0, different = 0;
+        while (in + same < state_size && same < MAX_RUN &&
+                data[in + same] == reference[in + same]) {
+            same++;
+        }
+        in += same;
+
+        /* Differing bytes run on until two bytes in a row are equal. */
+        while (in + different < state_size && different < MAX_RUN &&
+                (data[in + different] != reference[in + different] ||
+                (in + different + 1 < state_size &&
+                data[in + different + 1] != reference[in + different + 1]))) {
+            out[size + 4 + different] = data[in + different] ^ reference[in + different];
+            different++;
+        }
+        in += different;
+
+        put_16(&out[size], same);
+        put_16(&out[size + 2], different);
+        size += 4 + different;
+    }
+
+    return size;
+}
+
+static void decode(byte *out, const byte *data, size_t size, const byte *reference) {
+    size_t in = 0, position = 0;
+
+    while (in < size) {
+        int same = get_16(&data[in]);
+        int different = get_16(&data[in + 2]);
+        in += 4;
+
+        memcpy(&out[position], &reference[position], same);
+        position += same;
+        for (int i = 0; i < different; i++, position++) {
+            out[position] = data[in + i] ^ reference[position];
+        }
+        in += different;
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Ring buffer.
+ * -------------------------------------------------------------- */
+
+/* Drop the oldest snapshot, and the deltas left without their keyframe. */
+static void drop_oldest(void) {
+    first++;
+    while (first < last && snapshot(first)->keyframe != first) {
+        first++;
+    }
+    if (keyframe_number < first) {
+        keyframe_number = ~0ull;
+    }
+}
+
+/* Find room for size bytes at the head of the buffer, which can always
+ * hold one snapshot. */
+static void reserve(size_t size) {
+    while (true) {
+        if (first == last) {
+            if (head + size > buffer_size) {
+                head = 0;
+            }
+            return;
+        }
+        if (last - first == capacity) {
+            drop_oldest();
+            continue;
+        }
+
+        size_t tail = snapshot(first)->offset;
+        bool wrapped = snapshot(last - 1)->offset < tail;
+
+        if (!wrapped && head + size <= buffer_size) {
+            return;
+        }
+        if (!wrapped && size <= tail) {
+            head = 0;
+            return;
+        }
+        if (wrapped && head + size <= tail) {
+            return;
+        }
+        drop_oldest();
+    }
+}
+
+static void load_keyframe(unsigned long long number) {
+    if (keyframe_number != number) {
+        Snapshot *key = snapshot(number);
+        memset(state, 0x00, state_size);
+        decode(keyframe, buffer + key->offset, key->size, state);
+        keyframe_number = number;
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Rewind interface.
+ * -------------------------------------------------------------- */
+
+void rwd_init(size_t budget, int interval_) {
+    rwd_free();
+
+    /* The budget covers the buffer, its index, which has room for an
+     * average snapshot of AVERAGE_SIZE bytes, and the decoded keyframe and
+     * scratch space. */
+    state_size = nes_state_size();
+    capacity   = budget / AVERAGE_SIZE + 1;
+    interval   = interval_ > 0 ? interval_ : 1;
+
+    size_t max_encoded_size = state_size + 4 * (state_size / 2 + 2);
+    size_t fixed_size = capacity * sizeof(Snapshot) + 2 * state_size + max_encoded_size;
+    buffer_size = budget > fixed_size ? budget - fixed_size : 0;
+
+    /* The buffer must hold at least one encoded snapshot. */
+    if (buffer_size < max_encoded_size) {
+        LOG_WARNING("Rewind budget too small; rewind disabled.");
+        return;
+    }
+
+    buffer    = malloc(buffer_size);
+    snapshots = malloc(capacity * sizeof(Snapshot));
+    keyframe  = malloc(state_size);
+    state     = malloc(state_size);
+    encoded   = malloc(max_encoded_size);
+    if (buffer == NULL || snapshots == NULL || keyframe == NULL || state == NULL ||
+            encoded == NULL) {
+        LOG_ERROR("Unable to allocate memory for rewind.");
+    }
+
+    head = first = last = 0;
+    keyframe_number = ~0ull;
+    frames = 0;
+    enabled = true;
+}
+
+void rwd_free(void) {
+    free(buffer);
+    free(snapshots);
+    free(keyframe);
+    free(state);
+    free(encoded);
+    buffer = encoded = state = keyframe = NULL;
+    snapshots = NULL;
+    enabled = false;
+}
+
+/* Encode the saved state as a keyframe, or as a delta to the keyframe. */
+static size_t encode_snapshot(bool is_keyframe) {
+    if (is_keyframe) {
+        memcpy(keyframe, state, state_size);
+        keyframe_number = ~0ull;
+        memset(state, 0x00, state_size);
+        return encode(encoded, keyframe, state);
+    }
+    return encode(encoded, state, keyframe);
+}
+
+void rwd_push(void) {
+    if (!enabled || frames++ % interval != 0) {
+        return;
+    }
+
+    nes_save_state(state, state_size);
+
+    /* Start a new keyframe after REWIND_KEYFRAME_INTERVAL snapshots, or when
+     * the last keyframe is gone. */
+    bool is_keyframe = first == last || snapshot(last - 1)->keyframe != keyframe_number ||
+        last - keyframe_number >= REWIND_KEYFRAME_INTERVAL;
+    size_t size = encode_snapshot(is_keyframe);
+    reserve(size);
+
+    /* The keyframe may have been dropped to make room. */
+    if (!is_keyframe && keyframe_number == ~0ull) {
+        is_keyframe = true;
+        size = encode_snapshot(true);
+        reserve(size);
+    }
+
+    memcpy(buffer + head, encoded, size);
+    *snapshot(last) = (Snapshot) { head, size, is_keyframe ? last : keyframe_number };
+    if (is_keyframe) {
+        keyframe_number = last;
+    }
+    head += size;
+    last++;
+}
+
+bool rwd_step_back(void) {
+    if (!enabled || first == last) {
+        return false;
+    }
+
+    Snapshot *last_snapshot = snapshot(last - 1);
+    load_keyframe(last_snapshot->keyframe);
+    if (last_snapshot->keyframe == last - 1) {
+        memcpy(state, keyframe, state_size);
+    }
+    else {
+        decode(state, buffer + last_snapshot->offset, last_snapshot->size, keyframe);
+    }
+
+    nes_load_state(state, state_size);
+
+    head = last_snapshot->offset;
+    last--;
+    frames = 1;
+    return true;
+}
+
+inline int rwd_count(void) {
+    return last - first;
+}
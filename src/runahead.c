@@ -0,0 +1,158 @@
+/* -----------------------------------------------------------------
+ * Run-ahead.
+ *
+ * Games read their input late in the frame, so a button press shows up
+ * only a frame or more after it was made. Run-ahead hides that latency:
+ * at the end of every frame the machine is saved, run a number of frames
+ * ahead with the current input, and restored. Only the last frame ahead
+ * is rendered and shown; every other frame skips the pixel pipeline. The
+ * snapshots are incremental, so they copy only the memory a frame wrote.
+ *
+ * All of this must fit in one host frame. The time it takes is measured
+ * over a window of frames, and when the host falls behind the number of
+ * frames run ahead is lowered until run-ahead switches itself off.
+ * -------------------------------------------------------------- */
+
+#include <time.h>
+#include "../include/cpu.h"
+#include "../include/log.h"
+#include "../include/machine.h"
+#include "../include/nes.h"
+#include "../include/ppu.h"
+#include "../include/ppu_internal.h"
+#include "../include/render.h"
+#include "../include/runahead.h"
+
+#define FRAME_PERIOD_US 16639.0     /* One NTSC frame (60.0988 Hz). */
+#define WINDOW          60          /* Host frames per measurement. */
+
+static bool enabled = false;
+static int frames;
+
+static Machine *snapshot = NULL;
+
+/* Measurements of the current window, and the averages of the last one. */
+static RunAheadStats window, stats;
+static int window_frames;
+static double last_end;
+
+static double now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec * 1e-3;
+}
+
+/* Run until the start of the next vblank. The vblank flag can be cleared
+ * by the CPU, so the scanline tells where vblank is. */
+static void run_frame(RenderMode mode) {
+    unsigned long long frame = machine.ppu.scanline >= 241 ? machine.ppu.frame + 1 : machine.ppu.frame;
+
+    render_mode = mode;
+    while (machine.ppu.frame < frame || machine.ppu.scanline < 241) {
+        cpu_execute();
+        ppu_catch_up();
+    }
+    render_mode = RENDER_NONE;
+}
+
+void rah_init(int frames_) {
+    rah_free();
+    if (frames_ <= 0) {
+        return;
+    }
+
+    /* A restored machine would restart the render worker every frame. */
+    if (rdr_is_enabled()) {
+        LOG_WARNING("Run-ahead needs inline rendering; run-ahead disabled.");
+        return;
+    }
+
+    snapshot = nes_alloc_machine();
+    frames = frames_;
+    window = stats = (RunAheadStats) { frames, 0, 0.0, 0.0, 0.0, 0.0 };
+    window_frames = 0;
+    last_end = 0.0;
+
+    /* The frames of the machine itself are never shown. */
+    render_mode = RENDER_NONE;
+    enabled = true;
+}
+
+void rah_free(void) {
+    if (enabled) {
+        render_mode = RENDER_INLINE;
+    }
+    nes_free_machine(snapshot);
+    snapshot = NULL;
+    frames = 0;
+    enabled = false;
+}
+
+inline bool rah_is_enabled(void) {
+    return enabled;
+}
+
+/* Average the window, and run fewer frames ahead if the host fell behind. */
+static void end_window(void) {
+    stats = (RunAheadStats) {
+        frames,
+        window.late_frames,
+        window.save_us  / window_frames,
+        window.ahead_us / window_frames,
+        window.load_us  / window_frames,
+        window.frame_us / window_frames
+    };
+    window = (RunAheadStats) { frames, 0, 0.0, 0.0, 0.0, 0.0 };
+    window_frames = 0;
+
+    if (stats.frame_us > FRAME_PERIOD_US) {
+        if (frames > 1) {
+            frames--;
+            LOG_WARNING("Host frames take %.0f us; running %d frames ahead.",
+                stats.frame_us, frames);
+        }
+        else {
+            LOG_WARNING("Host frames take %.0f us; run-ahead disabled.", stats.frame_us);
+            rah_free();
+            stats.frames = 0;
+        }
+    }
+}
+
+void rah_frame(void) {
+    if (!enabled) {
+        return;
+    }
+
+    double start = now_us();
+    nes_snapshot(snapshot);
+    double saved = now_us();
+
+    for (int i = 1; i <= frames; i++) {
+        run_frame(i == frames ? RENDER_INLINE : RENDER_NONE);
+    }
+    double ahead = now_us();
+
+    nes_restore(snapshot);
+    double end = now_us();
+
+    /* The host frame runs from the end of the last one, and includes the
+     * frame of the machine itself and presenting it. */
+    if (last_end > 0.0) {
+        double frame_us = end - last_end;
+        window.save_us  += saved - start;
+        window.ahead_us += ahead - saved;
+        window.load_us  += end - ahead;
+        window.frame_us += frame_us;
+        window.late_frames += frame_us > FRAME_PERIOD_US;
+
+        if (++window_frames == WINDOW) {
+            end_window();
+        }
+    }
+    last_end = end;
+}
+
+inline RunAheadStats rah_get_stats(void) {
+    return stats;
+}
@@ -0,0 +1,463 @@
+/* -----------------------------------------------------------------
+ * Deduplicating state store.
+ *
+ * Save states are split into chunks of CHUNK_SIZE bytes, and each unique
+ * chunk is stored once, with a count of the states that use it. A state is
+ * stored as the list of its chunks.
+ *
+ * The store file is an array of slots, mapped into memory. A slot holds
+ * one chunk, or part of the chunk list of a state: the list of a state
+ * takes as many consecutive slots as it needs. Freed slots are reused for
+ * the same kind of data. The index from chunk hashes to slots is kept in
+ * memory and rebuilt when the store is opened.
+ * -------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/log.h"
+#include "../include/nes.h"
+#include "../include/state_store.h"
+
+#define STORE_MAGIC   "NESSTORE"
+#define STORE_VERSION 2
+#define CHUNK_SIZE    256
+#define LIST_ENTRIES  (CHUNK_SIZE / sizeof(dword))
+#define HEADER_SIZE   64
+#define MIN_SLOTS     1024
+
+typedef enum {
+    SLOT_FREE,                      /* Unused chunk slot. */
+    SLOT_CHUNK,                     /* A chunk. */
+    SLOT_STATE,                     /* First slot of the chunk list of a state. */
+    SLOT_FREE_STATE,                /* First slot of an unused state. */
+    SLOT_STATE_REST                 /* Other slots of a state. */
+} SlotKind;
+
+typedef struct {
+    char magic[8];                  /* STORE_MAGIC. */
+    dword version;                  /* STORE_VERSION. */
+    dword chunk_size;               /* CHUNK_SIZE. */
+    dword state_size;               /* Size of the save states. */
+    dword num_slots;                /* Number of slots used so far. */
+    unsigned long long rom_hash;    /* Hash of the ROM the states are from. */
+} StoreHeader;
+
+typedef struct {
+    unsigned long long hash;        /* Hash of the chunk. */
+    dword refs;                     /* Number of states that use the chunk. */
+    dword kind;                     /* SlotKind. */
+    byte data[CHUNK_SIZE];          /* Chunk, or chunk list of a state. */
+} Slot;
+
+static bool enabled = false;
+static int fd = -1;
+
+/* The mapped file. */
+static byte *mapping = NULL;
+static size_t mapping_size;
+static StoreHeader *header;
+static Slot *slots;
+static dword capacity;              /* Number of slots the file has room for. */
+
+/* State layout. */
+static size_t state_size;
+static int num_chunks;              /* Chunks per state. */
+static int state_slots;             /* Slots per chunk list. */
+static byte *state = NULL;          /* A state, padded to whole chunks. */
+
+/* Index of chunk hashes: buckets of chains through the slots. */
+static dword *buckets = NULL;       /* First slot + 1 of each chain (0: empty). */
+static dword *next = NULL;          /* Next slot + 1 in the chain of each slot. */
+static dword num_buckets;
+
+/* Free slots. */
+static dword *free_chunks = NULL, *free_states = NULL;
+static int num_free_chunks, num_free_states;
+
+static int num_states, num_unique_chunks;
+
+static unsigned long long hash_chunk(const byte *data) {
+    unsigned long long hash = 14695981039346656037ull;
+    for (int i = 0; i < CHUNK_SIZE; i += 8) {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+/* Entry i of the chunk list starting at slot, which runs on through the
+ * data of the following slots. */
+static inline dword *chunk_list(dword slot, int i) {
+    return (dword *) slots[slot + i / LIST_ENTRIES].data + i % LIST_ENTRIES;
+}
+
+/* -----------------------------------------------------------------
+ * File mapping.
+ * -------------------------------------------------------------- */
+
+static bool map_file(dword slots_) {
+    size_t size = HEADER_SIZE + (size_t) slots_ * sizeof(Slot);
+    if (ftruncate(fd, size) != 0) {
+        return false;
+    }
+
+    if (mapping != NULL) {
+        munmap(mapping, mapping_size);
+    }
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        return false;
+    }
+
+    mapping_size = size;
+    header = (StoreHeader *) mapping;
+    slots = (Slot *) (mapping + HEADER_SIZE);
+    capacity = slots_;
+
+    next = realloc(next, capacity * sizeof(dword));
+    free_chunks = realloc(free_chunks, capacity * sizeof(dword));
+    free_states = realloc(free_states, capacity * sizeof(dword));
+    if (next == NULL || free_chunks == NULL || free_states == NULL) {
+        LOG_ERROR("Unable to allocate memory for state store.");
+    }
+    return true;
+}
+
+/* Take count consecutive slots from the end of the used slots. */
+static bool append_slots(int count, dword *slot) {
+    if (header->num_slots + count > capacity) {
+        dword slots_ = 2 * capacity;
+        while (header->num_slots + count > slots_) {
+            slots_ *= 2;
+        }
+        if (!map_file(slots_)) {
+            LOG_WARNING("Unable to grow state store.");
+            return false;
+        }
+    }
+
+    *slot = header->num_slots;
+    header->num_slots += count;
+    return true;
+}
+
+/* -----------------------------------------------------------------
+ * Chunk index.
+ * -------------------------------------------------------------- */
+
+static void index_chunk(dword slot) {
+    dword bucket = slots[slot].hash & (num_buckets - 1);
+    next[slot] = buckets[bucket];
+    buckets[bucket] = slot + 1;
+}
+
+static void unindex_chunk(dword slot) {
+    dword *link = &buckets[slots[slot].hash & (num_buckets - 1)];
+    while (*link != slot + 1) {
+        link = &next[*link - 1];
+    }
+    *link = next[slot];
+}
+
+/* Keep the chains short: at least as many buckets as chunks. */
+static void resize_index(void) {
+    dword size = num_buckets ? num_buckets : MIN_SLOTS;
+    while (size < num_unique_chunks) {
+        size *= 2;
+    }
+    if (size == num_buckets && buckets != NULL) {
+        return;
+    }
+
+    free(buckets);
+    buckets = calloc(size, sizeof(dword));
+    if (buckets == NULL) {
+        LOG_ERROR("Unable to allocate memory for state store.");
+    }
+    num_buckets = size;
+
+    for (dword i = 0; i < header->num_slots; i++) {
+        if (slots[i].kind == SLOT_CHUNK) {
+            index_chunk(i);
+        }
+    }
+}
+
+static dword find_chunk(const byte *data, unsigned long long hash) {
+    for (dword i = buckets[hash & (num_buckets - 1)]; i != 0; i = next[i - 1]) {
+        if (slots[i - 1].hash == hash && memcmp(slots[i - 1].data, data, CHUNK_SIZE) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/* Store a chunk, or share the stored copy; returns its slot + 1. */
+static dword put_chunk(const byte *data) {
+    unsigned long long hash = hash_chunk(data);
+    dword found = find_chunk(data, hash);
+    if (found != 0) {
+        slots[found - 1].refs++;
+        return found;
+    }
+
+    dword slot;
+    if (num_free_chunks > 0) {
+        slot = free_chunks[--num_free_chunks];
+    }
+    else if (!append_slots(1, &slot)) {
+        return 0;
+    }
+
+    slots[slot].hash = hash;
+    slots[slot].refs = 1;
+    slots[slot].kind = SLOT_CHUNK;
+    memcpy(slots[slot].data, data, CHUNK_SIZE);
+
+    num_unique_chunks++;
+    if (num_unique_chunks > num_buckets) {
+        resize_index();
+    }
+    else {
+        index_chunk(slot);
+    }
+    return slot + 1;
+}
+
+static void release_chunk(dword slot) {
+    if (--slots[slot].refs == 0) {
+        unindex_chunk(slot);
+        slots[slot].kind = SLOT_FREE;
+        free_chunks[num_free_chunks++] = slot;
+        num_unique_chunks--;
+    }
+}
+
+/* -----------------------------------------------------------------
+ * State store interface.
+ * -------------------------------------------------------------- */
+
+/* The chunk list of a state at slot must lie inside the used slots, and
+ * name chunks that count it among their users. */
+static bool check_states(void) {
+    dword *refs = calloc(header->num_slots, sizeof(dword));
+    if (refs == NULL) {
+        LOG_ERROR("Unable to allocate memory for state store.");
+    }
+
+    bool valid = true;
+    for (dword slot = 0; slot < header->num_slots && valid; slot++) {
+        if (slots[slot].kind != SLOT_STATE) {
+            continue;
+        }
+        valid = slot + state_slots <= header->num_slots;
+        for (int i = 1; i < state_slots && valid; i++) {
+            valid = slots[slot + i].kind == SLOT_STATE_REST;
+        }
+        for (int i = 0; i < num_chunks && valid; i++) {
+            dword chunk = *chunk_list(slot, i);
+            valid = chunk >= 1 && chunk <= header->num_slots &&
+                slots[chunk - 1].kind == SLOT_CHUNK;
+            if (valid) {
+                refs[chunk - 1]++;
+            }
+        }
+    }
+    for (dword slot = 0; slot < header->num_slots && valid; slot++) {
+        valid = slots[slot].kind != SLOT_CHUNK || slots[slot].refs == refs[slot];
+    }
+
+    free(refs);
+    return valid;
+}
+
+/* Rebuild the counts, the free lists and the index of an opened file. */
+static void scan_slots(void) {
+    num_states = num_unique_chunks = 0;
+    num_free_chunks = num_free_states = 0;
+
+    for (dword i = 0; i < header->num_slots; i++) {
+        switch (slots[i].kind) {
+            case SLOT_FREE:       free_chunks[num_free_chunks++] = i; break;
+            case SLOT_CHUNK:      num_unique_chunks++;                break;
+            case SLOT_STATE:      num_states++;                       break;
+            case SLOT_FREE_STATE: free_states[num_free_states++] = i; break;
+        }
+    }
+
+    num_buckets = 0;
+    resize_index();
+}
+
+bool sts_open(const char *path) {
+    sts_close();
+
+    state_size  = nes_state_size();
+    num_chunks  = (state_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    state_slots = (num_chunks * sizeof(dword) + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        LOG_WARNING("Unable to open state store %s.", path);
+        sts_close();
+        return false;
+    }
+
+    /* A new file starts with an empty header. */
+    bool is_new = st.st_size == 0;
+    dword slots_ = is_new ? MIN_SLOTS : (st.st_size - HEADER_SIZE) / sizeof(Slot);
+    if (st.st_size != 0 && st.st_size < HEADER_SIZE + sizeof(Slot)) {
+        LOG_WARNING("State store %s is damaged.", path);
+        sts_close();
+        return false;
+    }
+    if (!map_file(slots_)) {
+        LOG_WARNING("Unable to map state store %s.", path);
+        sts_close();
+        return false;
+    }
+
+    if (is_new) {
+        memcpy(header->magic, STORE_MAGIC, sizeof(header->magic));
+        header->version    = STORE_VERSION;
+        header->chunk_size = CHUNK_SIZE;
+        header->state_size = state_size;
+        header->num_slots  = 0;
+        header->rom_hash   = nes_get_rom_hash();
+    }
+
+    /* States of another ROM or state format cannot be loaded. */
+    if (memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != STORE_VERSION || header->chunk_size != CHUNK_SIZE ||
+            header->num_slots > capacity) {
+        LOG_WARNING("State store %s has an unsupported format.", path);
+        sts_close();
+        return false;
+    }
+    if (header->rom_hash != nes_get_rom_hash() || header->state_size != state_size) {
+        LOG_WARNING("State store %s belongs to another ROM or state format.", path);
+        sts_close();
+        return false;
+    }
+
+    if (!check_states()) {
+        LOG_WARNING("State store %s is damaged.", path);
+        sts_close();
+        return false;
+    }
+
+    state = calloc(num_chunks, CHUNK_SIZE);
+    if (state == NULL) {
+        LOG_ERROR("Unable to allocate memory for state store.");
+    }
+
+    scan_slots();
+    enabled = true;
+    return true;
+}
+
+void sts_close(void) {
+    if (mapping != NULL) {
+        munmap(mapping, mapping_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buckets);
+    free(next);
+    free(free_chunks);
+    free(free_states);
+    free(state);
+
+    mapping = NULL;
+    buckets = next = free_chunks = free_states = NULL;
+    state = NULL;
+    num_buckets = 0;
+    fd = -1;
+    enabled = false;
+}
+
+int sts_put(void) {
+    if (!enabled) {
+        return -1;
+    }
+
+    dword slot;
+    if (num_free_states > 0) {
+        slot = free_states[--num_free_states];
+    }
+    else if (!append_slots(state_slots, &slot)) {
+        return -1;
+    }
+    slots[slot].kind = SLOT_FREE_STATE;
+    for (int i = 1; i < state_slots; i++) {
+        slots[slot + i].kind = SLOT_STATE_REST;
+    }
+
+    /* The slots move when the file grows, so they are found by index. */
+    nes_save_state(state, state_size);
+    for (int i = 0; i < num_chunks; i++) {
+        dword chunk = put_chunk(state + i * CHUNK_SIZE);
+        if (chunk == 0) {
+            for (int j = 0; j < i; j++) {
+                release_chunk(*chunk_list(slot, j) - 1);
+            }
+            free_states[num_free_states++] = slot;
+            return -1;
+        }
+        *chunk_list(slot, i) = chunk;
+    }
+
+    slots[slot].kind = SLOT_STATE;
+    num_states++;
+    return slot;
+}
+
+/* Ids come from callers: only the first slot of a stored state is one.
+ * Its chunk list was checked when the store was opened. */
+static bool is_state(int id) {
+    return enabled && id >= 0 && (dword) id + state_slots <= header->num_slots &&
+        slots[id].kind == SLOT_STATE;
+}
+
+bool sts_get(int id) {
+    if (!is_state(id)) {
+        return false;
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+        memcpy(state + i * CHUNK_SIZE, slots[*chunk_list(id, i) - 1].data, CHUNK_SIZE);
+    }
+    return nes_load_state(state, state_size);
+}
+
+void sts_remove(int id) {
+    if (!is_state(id)) {
+        return;
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+        release_chunk(*chunk_list(id, i) - 1);
+    }
+    slots[id].kind = SLOT_FREE_STATE;
+    free_states[num_free_states++] = id;
+    num_states--;
+}
+
+StoreStats sts_get_stats(void) {
+    StoreStats stats = { num_states, num_unique_chunks, enabled ? mapping_size : 0, 0.0 };
+    if (num_states > 0) {
+        size_t used = ((size_t) num_unique_chunks + (size_t) num_states * state_slots) *
+            sizeof(Slot);
+        stats.bytes_per_state = (double) used / num_states;
+    }
+    return stats;
+}
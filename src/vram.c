@@ -1,11 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "../include/machine.h"
 #include "../include/mmc.h"
 #include "../include/ppu.h"
 #include "../include/vram.h"
 
-static MirrorMode mode;
 static int mirror_lookup_table[4][4] = {
     {0x000, 0x000, 0x400, 0x400},
     {0x000, 0x400, 0x000, 0x400},
@@ -15,11 +15,15 @@ static int mirror_lookup_table[4][4] = {
 
 static inline word mirror(word address) {
     address &= 0xFFF;
-    return mirror_lookup_table[mode][address >> 10] + (address & 0x3FF);
+    return mirror_lookup_table[machine.mirror_mode][address >> 10] + (address & 0x3FF);
 }
 
 inline void vrm_set_mode(MirrorMode mode_) {
-    mode = mode_;
+    machine.mirror_mode = mode_;
+}
+
+inline MirrorMode vrm_get_mode(void) {
+    return machine.mirror_mode;
 }
 
 inline byte vrm_read(word address) {
@@ -32,7 +36,7 @@ inline byte vrm_read(word address) {
 
     /* 0x2000 - 0x3EFF: Nametables. */
     else if (address < 0x3F00) {
-        if (mode == MMC) {
+        if (machine.mirror_mode == MMC) {
             return mmc_ppu_read(address);
         }
         else {
@@ -57,7 +61,7 @@ inline void vrm_write(word address, byte data) {
 
     /* 0x2000 - 0x3EFF: Nametables. */
     else if (address < 0x3F00) {
-        if (mode == MMC) {
+        if (machine.mirror_mode == MMC) {
             mmc_ppu_write(address, data);
         }
         else {
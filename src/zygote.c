@@ -0,0 +1,128 @@
+/* -----------------------------------------------------------------
+ * Zygote.
+ *
+ * Loading a ROM, building the CPU tables and running the power-on frames
+ * takes tens of milliseconds, and every worker process would pay for it.
+ * A zygote does it once, then listens on a Unix socket and forks a worker
+ * for every connection. Workers start from the warm machine, sharing its
+ * memory copy-on-write, and keep the connection to talk to their client.
+ * A worker reports its process id when it is running.
+ * -------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "../include/log.h"
+#include "../include/render.h"
+#include "../include/zygote.h"
+
+#define BACKLOG 64
+
+static bool make_address(const char *path, struct sockaddr_un *address) {
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        LOG_WARNING("Zygote socket path %s is too long.", path);
+        return false;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+/* Run a worker in the child of a fork; does not return. */
+static void run_worker(int listener, int connection, ZygoteWorker worker) {
+    close(listener);
+
+    dword pid = getpid();
+    int status = 1;
+    if (write(connection, &pid, sizeof(pid)) == sizeof(pid)) {
+        status = worker(connection);
+    }
+
+    close(connection);
+    fflush(NULL);
+    _exit(status);
+}
+
+bool zyg_serve(const char *path, ZygoteWorker worker) {
+    /* Threads do not survive a fork. */
+    if (rdr_is_enabled()) {
+        LOG_WARNING("The zygote needs inline rendering.");
+        return false;
+    }
+
+    struct sockaddr_un address;
+    if (!make_address(path, &address)) {
+        return false;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        LOG_WARNING("Failed to create zygote socket: %s.", strerror(errno));
+        return false;
+    }
+
+    unlink(path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+            listen(listener, BACKLOG) != 0) {
+        LOG_WARNING("Failed to listen on %s: %s.", path, strerror(errno));
+        close(listener);
+        return false;
+    }
+
+    /* Output buffered now would be written again by every worker. */
+    fflush(NULL);
+
+    while (true) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            LOG_WARNING("Zygote failed to accept: %s.", strerror(errno));
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_worker(listener, connection, worker);
+        }
+        if (pid < 0) {
+            LOG_WARNING("Zygote failed to fork a worker: %s.", strerror(errno));
+        }
+        close(connection);
+
+        /* Reap the workers that have exited. */
+        while (waitpid(-1, NULL, WNOHANG) > 0);
+    }
+
+    close(listener);
+    unlink(path);
+    return false;
+}
+
+int zyg_spawn(const char *path) {
+    struct sockaddr_un address;
+    if (!make_address(path, &address)) {
+        return -1;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) {
+        return -1;
+    }
+
+    /* The worker is running once it has sent its process id. */
+    dword pid;
+    if (connect(connection, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+            read(connection, &pid, sizeof(pid)) != sizeof(pid)) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
@@ -0,0 +1,201 @@
+/* -----------------------------------------------------------------
+ * nes_aot: ahead-of-time translation of a ROM to C.
+ *
+ * Walks PRG ROM from the NMI, reset and IRQ vectors under the power-on
+ * bank layout, decodes instructions with the interpreter's instruction
+ * tables, and writes one C function per reachable block. The output is
+ * built into the core with -DNES_AOT_MODULE="<file>". Indirect jumps,
+ * returns and code outside PRG ROM are left to the interpreter.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../bench/include/harness.h"
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/memory.h"
+#include "../../include/nes.h"
+
+#define MAX_BLOCK_LENGTH 64         /* Maximum number of instructions per block. */
+
+static bool queued[0x8000];         /* Addresses queued as block entry points. */
+static word queue[0x8000];
+static int queue_length = 0;
+
+static void enqueue(word address) {
+    if (address >= 0x8000 && !queued[address - 0x8000]) {
+        queued[address - 0x8000] = true;
+        queue[queue_length++] = address;
+    }
+}
+
+static bool is_mode(const char *mode, const char *name) {
+    return strcmp(mode, name) == 0;
+}
+
+/* Write the translation of one instruction. */
+static void translate(FILE *out, word pc, byte opcode, const char *operation,
+        const char *mode) {
+    byte lo = mem_get(pc + 1), hi = mem_get(pc + 2);
+
+    if (is_mode(mode, "implied") || is_mode(mode, "accumulator")) {
+        fprintf(out, "    AOT_IMPLIED        (0x%04X, 0x%02X, %s);\n", pc, opcode, operation);
+    }
+    else if (is_mode(mode, "immediate")) {
+        fprintf(out, "    AOT_IMMEDIATE      (0x%04X, 0x%02X, 0x%02X, %s);\n",
+            pc, opcode, lo, operation);
+    }
+    else if (is_mode(mode, "relative")) {
+        fprintf(out, "    AOT_RELATIVE       (0x%04X, 0x%02X, 0x%02X, %s);\n",
+            pc, opcode, lo, operation);
+    }
+    else if (is_mode(mode, "zero_page")) {
+        fprintf(out, "    AOT_ZERO_PAGE      (0x%04X, 0x%02X, 0x%02X, %s);\n",
+            pc, opcode, lo, operation);
+    }
+    else if (is_mode(mode, "zero_page_write")) {
+        fprintf(out, "    AOT_ZERO_PAGE_WRITE(0x%04X, 0x%02X, 0x%02X, %s);\n",
+            pc, opcode, lo, operation);
+    }
+    else if (is_mode(mode, "absolute")) {
+        fprintf(out, "    AOT_ABSOLUTE       (0x%04X, 0x%02X, 0x%02X%02X, %s);\n",
+            pc, opcode, hi, lo, operation);
+    }
+    else if (is_mode(mode, "absolute_write")) {
+        fprintf(out, "    AOT_ABSOLUTE_WRITE (0x%04X, 0x%02X, 0x%02X%02X, %s);\n",
+            pc, opcode, hi, lo, operation);
+    }
+    else {
+        fprintf(out, "    AOT_GENERIC        (0x%04X, 0x%02X, %s, %s);\n",
+            pc, opcode, mode, operation);
+    }
+}
+
+/* Translate the block at the given address; returns its length in bytes. */
+static int translate_block(FILE *out, word start) {
+    word pc = start;
+    int count = 0;
+
+    if (cpu_get_block_kind(mem_get(start)) == BLOCK_EXCLUDE) {
+        return 0;
+    }
+
+    fprintf(out, "static void aot_block_%04X(void) {\n", start);
+
+    while (count < MAX_BLOCK_LENGTH && pc >= 0x8000) {
+        byte opcode = mem_get(pc);
+        const char *operation = cpu_get_operation_name(opcode);
+        const char *mode = cpu_get_addressing_name(opcode);
+        BlockKind kind = cpu_get_block_kind(opcode);
+        int length = cpu_get_length(opcode);
+
+        if (kind == BLOCK_EXCLUDE || pc + length > 0x10000) {
+            break;
+        }
+
+        if (count > 0) {
+            fprintf(out, "    AOT_CHECK();\n");
+        }
+        translate(out, pc, opcode, operation, mode);
+        count++;
+
+        word operand = (mem_get(pc + 2) << 8) | mem_get(pc + 1);
+        word next = pc + length;
+
+        pc = next;
+        if (kind == BLOCK_JUMP) {
+            /* The code after returns and indirect jumps is not known. */
+            if (is_mode(mode, "relative")) {
+                enqueue(next + (int8_t) (operand & 0xFF));
+                enqueue(next);
+            }
+            else if (strcmp(operation, "jmp_absolute") == 0) {
+                enqueue(operand);
+            }
+            else if (strcmp(operation, "jsr") == 0) {
+                enqueue(operand);
+                enqueue(next);
+            }
+            break;
+        }
+
+        /* A write that may hit the mapper may switch banks. */
+        if (kind == BLOCK_WRITE || (kind == BLOCK_WRITE_ABSOLUTE && operand >= 0x4020)) {
+            enqueue(next);
+            break;
+        }
+    }
+
+    /* Continue into the next block when it was cut off by its length. */
+    if (count == MAX_BLOCK_LENGTH) {
+        enqueue(pc);
+    }
+
+    fprintf(out, "}\n\n");
+    return pc - start;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: ./nes_aot <path-to-rom> <output.c>\n");
+        return 1;
+    }
+
+    if (!hrn_load_rom(argv[1])) {
+        printf("Failed to load ROM %s.\n", argv[1]);
+        return 1;
+    }
+
+    /* Initialize the instruction tables. */
+    cpu_init();
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) {
+        printf("Failed to open %s for writing.\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "/* Generated by nes_aot from %s. Do not edit. */\n\n", argv[1]);
+
+    enqueue(mem_get_16(NMI_VECTOR));
+    enqueue(mem_get_16(RESET_VECTOR));
+    enqueue(mem_get_16(IRQ_VECTOR));
+
+    /* Translate every reachable block. */
+    static word starts[0x8000];
+    static word lengths[0x8000];
+    int num_blocks = 0;
+    int total_length = 0;
+
+    for (int i = 0; i < queue_length; i++) {
+        int length = translate_block(out, queue[i]);
+        if (length > 0) {
+            starts [num_blocks] = queue[i];
+            lengths[num_blocks] = length;
+            num_blocks++;
+            total_length += length;
+        }
+    }
+
+    /* The code each block was translated from. */
+    for (int i = 0; i < num_blocks; i++) {
+        fprintf(out, "static const byte aot_code_%04X[] = {", starts[i]);
+        for (int j = 0; j < lengths[i]; j++) {
+            const char *separator = j == 0 ? "\n    " : j % 12 == 0 ? ",\n    " : ", ";
+            fprintf(out, "%s0x%02X", separator, mem_get(starts[i] + j));
+        }
+        fprintf(out, "\n};\n\n");
+    }
+
+    fprintf(out, "static const AotBlock aot_blocks[] = {\n");
+    for (int i = 0; i < num_blocks; i++) {
+        fprintf(out, "    { 0x%04X, %3d, aot_code_%04X, aot_block_%04X },\n",
+            starts[i], lengths[i], starts[i], starts[i]);
+    }
+    fprintf(out, "};\n");
+    fclose(out);
+
+    printf("Translated %d blocks (%d bytes of code).\n", num_blocks, total_length);
+    return 0;
+}
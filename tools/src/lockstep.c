@@ -0,0 +1,518 @@
+/* -----------------------------------------------------------------
+ * nes_lockstep: runs the fast paths against the reference core.
+ *
+ * Every corpus entry runs in two processes in lockstep, a frame at a time:
+ * the reference, with every fast path switched off (the plain interpreter,
+ * and ppu_step on the emulation thread), and the candidate, with the fast
+ * paths under test. After every frame the state hashes, the hashes of the
+ * parts of the machine and the framebuffers are compared.
+ *
+ * On the first frame that differs, both run that frame again from its
+ * start, reporting every dispatch, to find the first CPU cycle at which
+ * they differ. The entry stops there. A corpus file lists an entry per
+ * line, "<rom> [<movie>]", relative to the corpus file.
+ * -------------------------------------------------------------- */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../bench/include/corpus.h"
+#include "../../bench/include/harness.h"
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/movie.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/ppu_internal.h"
+#include "../../include/render.h"
+
+#define DEFAULT_FRAMES 600
+
+/* -----------------------------------------------------------------
+ * Records of the machine, sent by an instance after a frame or, when
+ * tracing a frame, after every dispatch.
+ * -------------------------------------------------------------- */
+
+typedef enum {
+    COMPONENT_TIME,
+    COMPONENT_CPU,
+    COMPONENT_PPU,
+    COMPONENT_RAM,
+    COMPONENT_PRG_RAM,
+    COMPONENT_CHR_RAM,
+    COMPONENT_PALETTE,
+    COMPONENT_OAM,
+    COMPONENT_NAMETABLE,
+    COMPONENT_MAPPER,
+    COMPONENT_CONTROLLERS,
+    NUM_COMPONENTS
+} Component;
+
+static const char *COMPONENT_NAMES[NUM_COMPONENTS] = {
+    "time", "cpu", "ppu", "ram", "prg_ram", "chr_ram", "palette", "oam",
+    "nametable", "mapper", "controllers"
+};
+
+typedef struct {
+    bool end;                       /* Last record of a traced frame. */
+    unsigned long long cycles;
+    unsigned long long frame;
+    int scanline, dot;
+    unsigned long long state_hash;
+    unsigned long long components[NUM_COMPONENTS];
+    long long display_frame;        /* Frame on display; -1: none yet. */
+    unsigned long long display_hash;
+} Record;
+
+typedef enum { COMMAND_FRAME, COMMAND_TRACE } Command;
+
+static unsigned long long hash_bytes(const void *data, size_t size) {
+    const byte *bytes = data;
+    unsigned long long hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+/* Registers are hashed field by field, leaving out padding and the fields
+ * that only follow from others (the colors). The fetch latches and shift
+ * registers of the pixel pipeline are left out too: a deferred machine
+ * leaves them to the worker, and the framebuffer covers them. */
+static unsigned long long hash_cpu(void) {
+    byte registers[] = {
+        machine.cpu.PC & 0xFF, machine.cpu.PC >> 8, machine.cpu.S,
+        machine.cpu.A, machine.cpu.X, machine.cpu.Y,
+        machine.flags.C, machine.flags.ZN, machine.flags.I, machine.flags.D,
+        machine.flags.V, machine.nmi
+    };
+    return hash_bytes(registers, sizeof(registers));
+}
+
+static unsigned long long hash_ppu(void) {
+    byte registers[] = {
+        machine.ppu.scanline & 0xFF, machine.ppu.scanline >> 8, machine.ppu.dot & 0xFF, machine.ppu.dot >> 8,
+        machine.ppu.v & 0xFF, machine.ppu.v >> 8, machine.ppu.t & 0xFF, machine.ppu.t >> 8,
+        machine.ppu.x, machine.ppu.w,
+        machine.ppu.odd_frame,
+        machine.ppu.ctrl_nmi, machine.ppu.ctrl_sprite_size, machine.ppu.ctrl_background_addr >> 8,
+        machine.ppu.ctrl_sprite_addr >> 8, machine.ppu.ctrl_increment, machine.ppu.ctrl_master_slave,
+        machine.ppu.mask_sprites, machine.ppu.mask_background, machine.ppu.mask_sprites_L,
+        machine.ppu.mask_background_L, machine.ppu.mask_red, machine.ppu.mask_green, machine.ppu.mask_blue,
+        machine.ppu.mask_grayscale, machine.ppu.status_vblank, machine.ppu.status_zero_hit,
+        machine.ppu.status_overflow, machine.ppu.oam_addr, machine.ppu.read_buffer, machine.ppu.latch
+    };
+    return hash_bytes(registers, sizeof(registers));
+}
+
+static unsigned long long hash_controllers(void) {
+    const Controller *controllers[] = { &machine.controller1, &machine.controller2 };
+    unsigned long long hash = 0;
+    for (int i = 0; i < 2; i++) {
+        byte state[NUM_BUTTONS + 2] = { controllers[i]->strobe, controllers[i]->index };
+        for (int j = 0; j < NUM_BUTTONS; j++) {
+            state[2 + j] = controllers[i]->button[j];
+        }
+        hash = hash * 31 + hash_bytes(state, sizeof(state));
+    }
+    return hash;
+}
+
+static unsigned long long hash_display(void) {
+    unsigned long long hash = 0xCBF29CE484222325ull;
+    for (int y = 0; y < FRAME_HEIGHT; y++) {
+        for (int x = 0; x < FRAME_WIDTH; x++) {
+            hash = (hash ^ ppu_get_pixel(x, y)) * 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+static void take_record(Record *record, bool display) {
+    memset(record, 0, sizeof(*record));
+    record->cycles = cpu_get_ticks();
+    record->frame = machine.ppu.frame;
+    record->scanline = machine.ppu.scanline;
+    record->dot = machine.ppu.dot;
+    record->state_hash = nes_state_hash();
+
+    unsigned long long *components = record->components;
+    components[COMPONENT_TIME]        = hash_bytes(&record->cycles, sizeof(record->cycles));
+    components[COMPONENT_CPU]         = hash_cpu();
+    components[COMPONENT_PPU]         = hash_ppu();
+    components[COMPONENT_RAM]         = hash_bytes(machine.ram, RAM_SIZE);
+    components[COMPONENT_PRG_RAM]     = hash_bytes(machine.prg_ram, PRG_RAM_SIZE);
+    components[COMPONENT_CHR_RAM]     = hash_bytes(machine.chr_ram, CHR_RAM_SIZE);
+    components[COMPONENT_PALETTE]     = hash_bytes(machine.ppu.palette, PALETTE_SIZE);
+    components[COMPONENT_OAM]         = hash_bytes(machine.ppu.oam, OAM_SIZE);
+    components[COMPONENT_NAMETABLE]   = hash_bytes(machine.ppu.nametable, NAMETABLE_SIZE);
+    components[COMPONENT_MAPPER]      = hash_bytes(machine.mapper_registers, MAX_MAPPER_REGISTERS) ^
+                                        machine.mirror_mode;
+    components[COMPONENT_CONTROLLERS] = hash_controllers();
+
+    /* The display shows the frame before the current one, and the one
+     * before that when the worker renders it. */
+    record->display_frame = -1;
+    if (display) {
+        record->display_frame = (long long) machine.ppu.frame - (rdr_is_enabled() ? 2 : 1);
+        record->display_hash = hash_display();
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Instances.
+ * -------------------------------------------------------------- */
+
+typedef struct {
+    pid_t pid;
+    int commands;                   /* Pipe to the instance. */
+    int records;                    /* Pipe from the instance. */
+} Instance;
+
+static bool read_all(int fd, void *data, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t count = read(fd, (byte *) data + done, size - done);
+        if (count <= 0) {
+            return false;
+        }
+        done += count;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t count = write(fd, (const byte *) data + done, size - done);
+        if (count <= 0) {
+            return false;
+        }
+        done += count;
+    }
+    return true;
+}
+
+static void set_input(const Movie *movie) {
+    unsigned long long frame = machine.ppu.frame;
+    if (movie != NULL && frame < movie->frames) {
+        for (int i = 0; i < 8; i++) {
+            nes_controller1_set(i, movie->inputs[frame][0] >> i & 1);
+            nes_controller2_set(i, movie->inputs[frame][1] >> i & 1);
+        }
+    }
+}
+
+/* Run the frame again from its start, with a record after every dispatch.
+ * Deferred rendering only changes how pixels are made, so it is switched
+ * off for good first. */
+static bool trace_frame(const struct Machine *start, const Movie *movie, int fd) {
+    rdr_disable();
+    nes_clone(&machine, start);
+    set_input(movie);
+
+    Record record;
+    unsigned long long frame = machine.ppu.frame;
+    while (machine.ppu.frame == frame) {
+        cpu_execute();
+        ppu_catch_up();
+        take_record(&record, false);
+        if (!write_all(fd, &record, sizeof(record))) {
+            return false;
+        }
+    }
+
+    record.end = true;
+    return write_all(fd, &record, sizeof(record));
+}
+
+static void serve(const Entry *entry, const bool *enabled, int commands, int records) {
+    if (!hrn_load_rom(entry->rom)) {
+        fprintf(stderr, "Failed to load ROM %s.\n", entry->rom);
+        return;
+    }
+
+    Movie *movie = NULL;
+    if (entry->movie[0] != '\0' && (movie = mov_load(entry->movie)) == NULL) {
+        fprintf(stderr, "Failed to load movie %s.\n", entry->movie);
+        return;
+    }
+
+    cpu_init();
+    nes_init();
+    crp_set_fast_paths(enabled);
+
+    /* The machine at the start of the last frame, to trace it. */
+    struct Machine *start = nes_alloc_machine();
+    byte command;
+    while (read_all(commands, &command, 1)) {
+        if (command == COMMAND_TRACE) {
+            trace_frame(start, movie, records);
+            break;
+        }
+
+        nes_clone(start, &machine);
+        set_input(movie);
+        unsigned long long frame = machine.ppu.frame;
+        while (machine.ppu.frame == frame) {
+            cpu_execute();
+            ppu_catch_up();
+        }
+
+        Record record;
+        take_record(&record, true);
+        if (!write_all(records, &record, sizeof(record))) {
+            break;
+        }
+    }
+
+    nes_free_machine(start);
+    mov_free(movie);
+}
+
+static bool start_instance(Instance *instance, const Entry *entry, const bool *enabled) {
+    int commands[2], records[2];
+    if (pipe(commands) != 0) {
+        return false;
+    }
+    if (pipe(records) != 0) {
+        close(commands[0]);
+        close(commands[1]);
+        return false;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        close(commands[1]);
+        close(records[0]);
+        serve(entry, enabled, commands[0], records[1]);
+        _exit(0);
+    }
+
+    close(commands[0]);
+    close(records[1]);
+    instance->pid = pid;
+    instance->commands = commands[1];
+    instance->records = records[0];
+    return true;
+}
+
+static void stop_instance(Instance *instance) {
+    close(instance->commands);
+    close(instance->records);
+    kill(instance->pid, SIGKILL);
+    waitpid(instance->pid, NULL, 0);
+}
+
+static bool request(Instance *instance, Command command, Record *record) {
+    byte data = command;
+    return write_all(instance->commands, &data, 1) &&
+        read_all(instance->records, record, sizeof(*record));
+}
+
+/* -----------------------------------------------------------------
+ * Comparison.
+ * -------------------------------------------------------------- */
+
+/* Print the components two records differ in; false if they agree. */
+static bool print_differences(const Record *reference, const Record *candidate) {
+    bool differ = reference->state_hash != candidate->state_hash;
+    const char *separator = "";
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        if (reference->components[i] != candidate->components[i]) {
+            printf("%s%s", separator, COMPONENT_NAMES[i]);
+            separator = ", ";
+            differ = true;
+        }
+    }
+    if (differ && separator[0] == '\0') {
+        printf("state hash");
+    }
+    return differ;
+}
+
+/* Trace the frame both ran last, and report the first cycle at which they
+ * differ. Only cycles at which both finished a dispatch can be compared. */
+static void trace(const Entry *entry, Instance *reference, Instance *candidate) {
+    Record a, b;
+    unsigned long long agreed = 0;
+    bool has_a = request(reference, COMMAND_TRACE, &a);
+    bool has_b = request(candidate, COMMAND_TRACE, &b);
+
+    while (has_a && has_b && !a.end && !b.end) {
+        if (a.cycles == b.cycles) {
+            if (a.state_hash != b.state_hash ||
+                    memcmp(a.components, b.components, sizeof(a.components)) != 0) {
+                printf("%-20s first differs at cycle %llu (scanline %d, dot %d; last agreed at cycle %llu): ",
+                    crp_base_name(entry->rom), a.cycles, a.scanline, a.dot, agreed);
+                print_differences(&a, &b);
+                printf("\n");
+                return;
+            }
+            agreed = a.cycles;
+        }
+        if (a.cycles <= b.cycles) {
+            has_a = read_all(reference->records, &a, sizeof(a));
+        }
+        else {
+            has_b = read_all(candidate->records, &b, sizeof(b));
+        }
+    }
+
+    printf("%-20s no common cycle differs; last agreed at cycle %llu\n",
+        crp_base_name(entry->rom), agreed);
+}
+
+/* Display hashes of the last two frames shown, by frame. */
+typedef struct {
+    long long frame[2];
+    unsigned long long hash[2];
+} Displays;
+
+static void add_display(Displays *displays, const Record *record) {
+    displays->frame[0] = displays->frame[1];
+    displays->hash[0] = displays->hash[1];
+    displays->frame[1] = record->display_frame;
+    displays->hash[1] = record->display_hash;
+}
+
+/* Compare the frames both have shown; returns the first that differs, or
+ * -1. */
+static long long compare_displays(const Displays *a, const Displays *b) {
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (a->frame[i] >= 0 && a->frame[i] == b->frame[j] && a->hash[i] != b->hash[j]) {
+                return a->frame[i];
+            }
+        }
+    }
+    return -1;
+}
+
+static bool check(const Entry *entry, const bool *enabled, int frames) {
+    bool reference_config[NUM_FAST_PATHS] = { false };
+    Instance reference, candidate;
+    if (!start_instance(&reference, entry, reference_config)) {
+        return false;
+    }
+    if (!start_instance(&candidate, entry, enabled)) {
+        stop_instance(&reference);
+        return false;
+    }
+
+    bool success = true;
+    Displays displays_a = { { -1, -1 } }, displays_b = { { -1, -1 } };
+    for (int i = 0; i < frames; i++) {
+        Record a, b;
+        if (!request(&reference, COMMAND_FRAME, &a) || !request(&candidate, COMMAND_FRAME, &b)) {
+            printf("%-20s failed at frame %d\n", crp_base_name(entry->rom), i);
+            success = false;
+            break;
+        }
+
+        if (a.cycles != b.cycles || a.state_hash != b.state_hash ||
+                memcmp(a.components, b.components, sizeof(a.components)) != 0) {
+            printf("%-20s differs after frame %d (cycle %llu, reference at cycle %llu): ",
+                crp_base_name(entry->rom), i, b.cycles, a.cycles);
+            print_differences(&a, &b);
+            printf("\n");
+            trace(entry, &reference, &candidate);
+            success = false;
+            break;
+        }
+
+        add_display(&displays_a, &a);
+        add_display(&displays_b, &b);
+        long long frame = compare_displays(&displays_a, &displays_b);
+        if (frame >= 0) {
+            printf("%-20s framebuffer of frame %lld differs\n", crp_base_name(entry->rom), frame);
+            success = false;
+            break;
+        }
+    }
+
+    if (success) {
+        printf("%-20s %d frames agree\n", crp_base_name(entry->rom), frames);
+    }
+    stop_instance(&reference);
+    stop_instance(&candidate);
+    return success;
+}
+
+/* -----------------------------------------------------------------
+ * Command line.
+ * -------------------------------------------------------------- */
+
+int main(int argc, char *argv[]) {
+    int frames = DEFAULT_FRAMES;
+    static Entry entries[MAX_ENTRIES];
+    int num_entries = 0;
+
+    /* The candidate runs all fast paths, unless told otherwise. */
+    bool enabled[NUM_FAST_PATHS];
+    for (int i = 0; i < NUM_FAST_PATHS; i++) {
+        enabled[i] = true;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--corpus") == 0 && has_value) {
+            if ((num_entries = crp_read(argv[++i], entries, num_entries)) < 0) {
+                return 1;
+            }
+        }
+        else if ((strcmp(argv[i], "--enable") == 0 || strcmp(argv[i], "--disable") == 0) && has_value) {
+            int fast_path = crp_find_fast_path(argv[i + 1]);
+            if (fast_path < 0) {
+                return 1;
+            }
+            enabled[fast_path] = strcmp(argv[i], "--enable") == 0;
+            i++;
+        }
+        else if (strcmp(argv[i], "--only") == 0 && has_value) {
+            int fast_path = crp_find_fast_path(argv[++i]);
+            if (fast_path < 0) {
+                return 1;
+            }
+            for (int j = 0; j < NUM_FAST_PATHS; j++) {
+                enabled[j] = j == fast_path;
+            }
+        }
+        else if (num_entries < MAX_ENTRIES) {
+            snprintf(entries[num_entries].rom, sizeof(entries[num_entries].rom), "%s", argv[i]);
+            entries[num_entries++].movie[0] = '\0';
+        }
+    }
+
+    if (num_entries == 0 || frames <= 0) {
+        printf("Usage: ./nes_lockstep [--frames <n>] [--enable <fast path>] [--disable <fast path>]\n"
+               "                      [--only <fast path>] [--corpus <file>] [<path-to-rom>...]\n");
+        printf("Fast paths:");
+        for (int i = 0; i < NUM_FAST_PATHS; i++) {
+            printf(" %s", crp_get_fast_path_name(i));
+        }
+        printf("\n");
+        return 1;
+    }
+
+    printf("Candidate:");
+    for (int i = 0; i < NUM_FAST_PATHS; i++) {
+        printf(" %c%s", enabled[i] ? '+' : '-', crp_get_fast_path_name(i));
+    }
+    printf("\n");
+
+    bool success = true;
+    for (int i = 0; i < num_entries; i++) {
+        success &= check(&entries[i], enabled, frames);
+    }
+    return success ? 0 : 1;
+}
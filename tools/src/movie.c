@@ -0,0 +1,144 @@
+/* -----------------------------------------------------------------
+ * nes_movie: plays input movies headless, as fast as the core runs.
+ *
+ * Playback checks the state hash at the end of every frame, so a movie is
+ * a check that the core still runs the same way as well as a workload.
+ * Movies can also be imported from FM2, which plays them once to record
+ * the hashes, or recorded with random input. Seeking starts from the last
+ * keyframe before the frame; a movie without keyframes is played once to
+ * take them, and saved with them.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../bench/include/harness.h"
+#include "../../include/common.h"
+#include "../../include/controller.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/movie.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/ppu_internal.h"
+
+/* Record a movie, changing a random button every few frames. */
+static bool record_random(const char *path, int frames) {
+    if (!mov_record(path)) {
+        return false;
+    }
+
+    srand(1);
+    unsigned long long input_frame = machine.ppu.frame;
+    while (machine.ppu.frame < frames) {
+        if (machine.ppu.frame % 8 == 0) {
+            nes_controller1_set(rand() % NUM_BUTTONS, rand() % 2);
+        }
+        while (machine.ppu.frame == input_frame) {
+            cpu_execute();
+            ppu_catch_up();
+        }
+        mov_record_frame();
+        input_frame = machine.ppu.frame;
+    }
+    mov_stop();
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: ./nes_movie [--import <fm2>] [--record-random <frames>] [--keyframes <interval>] [--seek <frame>] [--no-render] <movie> <path-to-rom>\n");
+        return 1;
+    }
+
+    char *import = NULL;
+    int random_frames = 0;
+    int keyframe_interval = -1;
+    int seek = -1;
+    for (int i = 1; i < argc - 2; i++) {
+        if (strcmp(argv[i], "--import") == 0 && i + 1 < argc - 2) {
+            import = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record-random") == 0 && i + 1 < argc - 2) {
+            random_frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--keyframes") == 0 && i + 1 < argc - 2) {
+            keyframe_interval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc - 2) {
+            seek = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-render") == 0) {
+            render_mode = RENDER_NONE;
+        }
+    }
+
+    const char *path = argv[argc - 2];
+    if (!hrn_load_rom(argv[argc - 1])) {
+        printf("Failed to load ROM %s.\n", argv[argc - 1]);
+        return 1;
+    }
+    cpu_init();
+    nes_init();
+
+    struct Machine *power_on = nes_alloc_machine();
+    nes_clone(power_on, &machine);
+
+    /* Record, and play back the recording from power-on. */
+    if (random_frames > 0) {
+        if (!record_random(path, random_frames)) {
+            printf("Failed to record movie %s.\n", path);
+            return 1;
+        }
+        nes_clone(&machine, power_on);
+    }
+
+    Movie *movie = mov_load(import != NULL ? import : path);
+    if (movie == NULL) {
+        printf("Failed to load movie %s.\n", import != NULL ? import : path);
+        return 1;
+    }
+
+    if (keyframe_interval >= 0 && keyframe_interval != movie->keyframe_interval) {
+        movie->keyframe_interval = keyframe_interval;
+        movie->keyframes = 0;
+    }
+
+    /* Seeking plays the whole movie first if it has no keyframes yet. */
+    int keyframes = movie->keyframes;
+    bool play = seek < 0 || keyframes == 0;
+    if (play) {
+        double start = hrn_now();
+        int frames = mov_play(movie);
+        double time = hrn_now() - start;
+
+        if (frames < movie->frames) {
+            printf("Playback went another way at frame %d of %d.\n", frames, movie->frames);
+            return 1;
+        }
+        printf("%d frames in %.3f s: %.0f frames/s, %.1f us/frame\n",
+            frames, time, frames / time, 1e6 * time / (frames > 0 ? frames : 1));
+    }
+
+    /* Keep the hashes and keyframes taken during the first playback. */
+    if ((import != NULL || movie->keyframes != keyframes) && !mov_save(movie, path)) {
+        return 1;
+    }
+
+    if (seek >= 0) {
+        if (movie->keyframes == 0) {
+            nes_clone(&machine, power_on);
+        }
+
+        double start = hrn_now();
+        if (!mov_seek(movie, seek)) {
+            printf("Failed to seek to frame %d.\n", seek);
+            return 1;
+        }
+        printf("Seek to frame %d in %.3f ms.\n", seek, 1e3 * (hrn_now() - start));
+    }
+
+    mov_free(movie);
+    nes_free_machine(power_on);
+    return 0;
+}
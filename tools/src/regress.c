@@ -0,0 +1,730 @@
+/* -----------------------------------------------------------------
+ * nes_regress: runs a corpus of test ROMs and movies against goldens.
+ *
+ * Every ROM (*.nes) under the corpus directory is an entry. With a movie
+ * next to it (<rom>.movie or <rom>.fm2) the movie is played, else the ROM
+ * runs without input. Test ROMs that report through 0x6000 (the blargg
+ * protocol: status at 0x6000, signature DE B0 61 at 0x6001 and text from
+ * 0x6004) run until they report a result, are reset when they ask for it,
+ * and stop at the timeout otherwise. Other ROMs run a fixed number of
+ * frames.
+ *
+ * The result, its text and the hash of the framebuffer after every frame
+ * are compared with the golden of the entry, and --update writes the
+ * goldens. Entries run on all cores: every thread runs a machine of its
+ * own, and takes entries from its own queue or, once that is empty, steals
+ * them from the others. Longer entries (by their golden) go first. Every
+ * entry runs in a child process: the emulator exits on an error (an invalid
+ * opcode, a ROM it cannot load), which then fails that entry only.
+ * -------------------------------------------------------------- */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../../bench/include/harness.h"
+#include "../../include/cartridge.h"
+#include "../../include/common.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/mmc.h"
+#include "../../include/movie.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/ppu_internal.h"
+
+#define DEFAULT_FRAMES  600
+#define DEFAULT_TIMEOUT 7200        /* Two minutes of a test ROM. */
+#define MAX_ENTRIES     4096
+#define MAX_TEXT        256
+#define GOLDEN_VERSION  1
+
+/* Test ROM protocol. */
+#define STATUS_RUNNING  0x80
+#define STATUS_RESET    0x81
+#define RESET_DELAY     6           /* Frames to wait before a reset (100 ms). */
+
+typedef enum { RESULT_OK, RESULT_NEW, RESULT_WRITTEN, RESULT_REGRESSED, RESULT_ERROR } Result;
+
+static const char *RESULT_NAMES[] = { "ok", "new", "written", "REGRESSED", "ERROR" };
+
+typedef struct {
+    int frames;
+    int status;                     /* Result code of a test ROM; -1: none. */
+    char text[MAX_TEXT];
+    unsigned long long *hashes;     /* Framebuffer hash after every frame. */
+} Run;
+
+typedef struct {
+    char name[512];                 /* ROM path relative to the corpus. */
+    char rom[1024];
+    char movie[1024];               /* Empty: no input. */
+    char golden[1024];
+    int estimate;                   /* Frames of the golden, to order by. */
+
+    Result result;
+    Run run;
+    char message[256];              /* What differs from the golden. */
+    double seconds;
+} Entry;
+
+static Entry entries[MAX_ENTRIES];
+static int num_entries = 0;
+
+static int frames_limit = DEFAULT_FRAMES;
+static int timeout = DEFAULT_TIMEOUT;
+static bool update = false;
+
+static pthread_mutex_t output = PTHREAD_MUTEX_INITIALIZER;
+
+/* -----------------------------------------------------------------
+ * Goldens.
+ *
+ *     nes_regress <version>
+ *     frames <n>
+ *     status <code>            (-1: not a test ROM)
+ *     text <text>              (newlines as \n)
+ *     <hash of frame 0>
+ *     ...
+ * -------------------------------------------------------------- */
+
+static void escape(char *dst, size_t size, const char *src) {
+    size_t length = 0;
+    for (; *src != '\0' && length + 2 < size; src++) {
+        if (*src == '\n') {
+            dst[length++] = '\\';
+            dst[length++] = 'n';
+        }
+        else if (*src == '\\') {
+            dst[length++] = '\\';
+            dst[length++] = '\\';
+        }
+        else if (*src >= 0x20 && *src < 0x7F) {
+            dst[length++] = *src;
+        }
+    }
+    dst[length] = '\0';
+}
+
+static void unescape(char *text) {
+    char *dst = text;
+    for (const char *src = text; *src != '\0'; src++) {
+        if (src[0] == '\\' && (src[1] == 'n' || src[1] == '\\')) {
+            *dst++ = *++src == 'n' ? '\n' : '\\';
+        }
+        else {
+            *dst++ = *src;
+        }
+    }
+    *dst = '\0';
+}
+
+/* Read a golden; with hashes false only the header. */
+static bool load_golden(const char *path, Run *run, bool hashes) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    char line[3 * MAX_TEXT];
+    int version = 0;
+    memset(run, 0, sizeof(*run));
+    bool success = fscanf(file, "nes_regress %d\n", &version) == 1 && version == GOLDEN_VERSION &&
+        fscanf(file, "frames %d\n", &run->frames) == 1 && run->frames >= 0 &&
+        fscanf(file, "status %d\n", &run->status) == 1 &&
+        fgets(line, sizeof(line), file) != NULL && strncmp(line, "text ", 5) == 0;
+
+    if (success) {
+        line[strcspn(line, "\n")] = '\0';
+        unescape(line + 5);
+        snprintf(run->text, sizeof(run->text), "%.*s", MAX_TEXT - 1, line + 5);
+    }
+
+    if (success && hashes) {
+        run->hashes = malloc((run->frames + 1) * sizeof(unsigned long long));
+        success = run->hashes != NULL;
+        for (int i = 0; success && i < run->frames; i++) {
+            success = fscanf(file, "%16llx\n", &run->hashes[i]) == 1;
+        }
+    }
+
+    fclose(file);
+    if (!success) {
+        free(run->hashes);
+        run->hashes = NULL;
+    }
+    return success;
+}
+
+static bool save_golden(const char *path, const Run *run) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    char text[3 * MAX_TEXT];
+    escape(text, sizeof(text), run->text);
+    fprintf(file, "nes_regress %d\nframes %d\nstatus %d\ntext %s\n",
+        GOLDEN_VERSION, run->frames, run->status, text);
+    for (int i = 0; i < run->frames; i++) {
+        fprintf(file, "%016llx\n", run->hashes[i]);
+    }
+    return fclose(file) == 0;
+}
+
+/* -----------------------------------------------------------------
+ * Running an entry.
+ * -------------------------------------------------------------- */
+
+static unsigned long long hash_display(void) {
+    unsigned long long hash = 0xCBF29CE484222325ull;
+    for (int y = 0; y < FRAME_HEIGHT; y++) {
+        for (int x = 0; x < FRAME_WIDTH; x++) {
+            hash = (hash ^ ppu_get_pixel(x, y)) * 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+/* A test ROM has written its signature to PRG RAM. */
+static bool is_test_rom(void) {
+    return machine.prg_ram[1] == 0xDE && machine.prg_ram[2] == 0xB0 && machine.prg_ram[3] == 0x61;
+}
+
+static void run_frames(const Movie *movie, Run *run) {
+    int capacity = movie != NULL ? movie->frames : frames_limit;
+    run->hashes = malloc((capacity + 1) * sizeof(unsigned long long));
+    run->status = -1;
+
+    int reset_frame = -1;
+    for (int frame = 0; ; frame++) {
+        bool test = is_test_rom();
+        if (movie != NULL ? frame >= movie->frames :
+                test ? frame >= timeout : frame >= frames_limit) {
+            break;
+        }
+
+        if (movie != NULL) {
+            for (int i = 0; i < 8; i++) {
+                nes_controller1_set(i, movie->inputs[frame][0] >> i & 1);
+                nes_controller2_set(i, movie->inputs[frame][1] >> i & 1);
+            }
+        }
+
+        unsigned long long current = machine.ppu.frame;
+        while (machine.ppu.frame == current) {
+            cpu_execute();
+            ppu_catch_up();
+        }
+
+        if (frame >= capacity) {
+            capacity *= 2;
+            run->hashes = realloc(run->hashes, (capacity + 1) * sizeof(unsigned long long));
+        }
+        run->hashes[frame] = hash_display();
+        run->frames = frame + 1;
+
+        /* A test ROM is done once its status is a result code. */
+        if (movie == NULL && is_test_rom()) {
+            byte status = machine.prg_ram[0];
+            if (status < STATUS_RUNNING) {
+                run->status = status;
+                break;
+            }
+            if (status == STATUS_RESET && reset_frame < 0) {
+                reset_frame = frame + RESET_DELAY;
+            }
+            if (frame == reset_frame) {
+                nes_reset();
+                reset_frame = -1;
+            }
+        }
+    }
+
+    if (is_test_rom()) {
+        int length = 0;
+        while (length + 1 < MAX_TEXT && 4 + length < PRG_RAM_SIZE && machine.prg_ram[4 + length] != 0) {
+            run->text[length] = machine.prg_ram[4 + length];
+            length++;
+        }
+        run->text[length] = '\0';
+    }
+}
+
+static void compare(Entry *entry) {
+    Run golden;
+    if (!load_golden(entry->golden, &golden, true)) {
+        entry->result = RESULT_NEW;
+        snprintf(entry->message, sizeof(entry->message), "no golden");
+        return;
+    }
+
+    const Run *run = &entry->run;
+    int frames = run->frames < golden.frames ? run->frames : golden.frames;
+    int differs = -1;
+    for (int i = 0; i < frames && differs < 0; i++) {
+        if (run->hashes[i] != golden.hashes[i]) {
+            differs = i;
+        }
+    }
+
+    entry->result = RESULT_REGRESSED;
+    if (run->status != golden.status) {
+        snprintf(entry->message, sizeof(entry->message), "status %d, golden %d", run->status, golden.status);
+    }
+    else if (differs >= 0) {
+        snprintf(entry->message, sizeof(entry->message), "frame %d differs", differs);
+    }
+    else if (run->frames != golden.frames) {
+        snprintf(entry->message, sizeof(entry->message), "ran %d frames, golden %d", run->frames, golden.frames);
+    }
+    else if (strcmp(run->text, golden.text) != 0) {
+        snprintf(entry->message, sizeof(entry->message), "text differs");
+    }
+    else {
+        entry->result = RESULT_OK;
+    }
+    free(golden.hashes);
+}
+
+/* The loader exits on a ROM it cannot run: check the iNES header first,
+ * to report what is wrong with it (NULL: the ROM loads). */
+static const char *check_rom(const byte *data, long length) {
+    static const byte MAGIC[4] = { 0x4E, 0x45, 0x53, 0x1A };
+    if (length < INES_HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        return "not an iNES ROM";
+    }
+
+    byte mapper = (data[7] & 0xF0) | ((data[6] & 0xF0) >> 4);
+    if (!mmc_is_supported(mapper)) {
+        return "unsupported mapper";
+    }
+
+    long size = INES_HEADER_SIZE + (data[6] & 0x04 ? INES_TRAINER_SIZE : 0) +
+        (long) data[4] * PRG_BANK_SIZE + (long) data[5] * CHR_BANK_SIZE;
+    return length < size ? "truncated ROM" : NULL;
+}
+
+static void run_entry(Entry *entry) {
+    double start = hrn_now();
+    entry->run.status = -1;
+
+    long length;
+    byte *data = hrn_read_file(entry->rom, &length);
+    const char *error = data == NULL ? "failed to read ROM" : check_rom(data, length);
+    if (error != NULL || !nes_insert_cartridge(data, length)) {
+        entry->result = RESULT_ERROR;
+        snprintf(entry->message, sizeof(entry->message), "%s", error ? error : "failed to load ROM");
+        free(data);
+        entry->seconds = hrn_now() - start;
+        return;
+    }
+    free(data);
+
+    Movie *movie = NULL;
+    if (entry->movie[0] != '\0' && (movie = mov_load(entry->movie)) == NULL) {
+        entry->result = RESULT_ERROR;
+        snprintf(entry->message, sizeof(entry->message), "failed to load movie");
+    }
+    else if (movie != NULL && movie->rom_hash != 0 && movie->rom_hash != nes_get_rom_hash()) {
+        entry->result = RESULT_ERROR;
+        snprintf(entry->message, sizeof(entry->message), "movie of another ROM");
+    }
+    else {
+        cpu_init();
+        nes_init();
+        run_frames(movie, &entry->run);
+        compare(entry);
+
+        if (update && entry->result != RESULT_OK) {
+            if (save_golden(entry->golden, &entry->run)) {
+                entry->result = RESULT_WRITTEN;
+            }
+            else {
+                entry->result = RESULT_ERROR;
+                snprintf(entry->message, sizeof(entry->message), "failed to write golden");
+            }
+        }
+    }
+
+    mov_free(movie);
+    nes_eject_cartridge();
+    entry->seconds = hrn_now() - start;
+}
+
+/* What a child reports of its entry. */
+typedef struct {
+    Result result;
+    int frames, status;
+    char text[MAX_TEXT];
+    char message[256];
+} Report;
+
+/* Read a pipe to its end, keeping the last error the emulator logged. */
+static void read_errors(int fd, char *error, size_t size) {
+    char buffer[4096], line[256];
+    size_t length = 0;
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            if (buffer[i] == '\n') {
+                line[length] = '\0';
+                if (strncmp(line, "ERROR: ", 7) == 0) {
+                    snprintf(error, size, "%s", line + 7);
+                }
+                length = 0;
+            }
+            else if (length + 1 < sizeof(line)) {
+                line[length++] = buffer[i];
+            }
+        }
+    }
+}
+
+static void run_child(Entry *entry) {
+    double start = hrn_now();
+    int report_pipe[2], output_pipe[2];
+    if (pipe(report_pipe) != 0 || pipe(output_pipe) != 0) {
+        entry->result = RESULT_ERROR;
+        snprintf(entry->message, sizeof(entry->message), "failed to create a pipe");
+        return;
+    }
+
+    /* The output lock keeps other workers from leaving half a line in the
+     * buffer of stdout, which the child would print again. */
+    pthread_mutex_lock(&output);
+    fflush(stdout);
+    pid_t pid = fork();
+    pthread_mutex_unlock(&output);
+
+    if (pid == 0) {
+        close(report_pipe[0]);
+        close(output_pipe[0]);
+        dup2(output_pipe[1], STDOUT_FILENO);
+        run_entry(entry);
+        fflush(stdout);
+
+        Report report = { entry->result, entry->run.frames, entry->run.status };
+        memcpy(report.text, entry->run.text, sizeof(report.text));
+        memcpy(report.message, entry->message, sizeof(report.message));
+        _exit(write(report_pipe[1], &report, sizeof(report)) == sizeof(report) ? 0 : 1);
+    }
+
+    close(report_pipe[1]);
+    close(output_pipe[1]);
+    char error[256] = "";
+    Report report;
+    bool reported = false;
+    if (pid > 0) {
+        read_errors(output_pipe[0], error, sizeof(error));
+        reported = read(report_pipe[0], &report, sizeof(report)) == sizeof(report);
+    }
+    close(report_pipe[0]);
+    close(output_pipe[0]);
+
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid) {
+        entry->result = RESULT_ERROR;
+        snprintf(entry->message, sizeof(entry->message), "failed to run a child");
+    }
+    else if (reported) {
+        entry->result = report.result;
+        entry->run.frames = report.frames;
+        entry->run.status = report.status;
+        memcpy(entry->run.text, report.text, sizeof(report.text));
+        memcpy(entry->message, report.message, sizeof(report.message));
+    }
+    else {
+        entry->result = RESULT_ERROR;
+        entry->run.status = -1;
+        if (WIFSIGNALED(status)) {
+            snprintf(entry->message, sizeof(entry->message), "crashed (signal %d)", WTERMSIG(status));
+        }
+        else if (error[0] != '\0') {
+            snprintf(entry->message, sizeof(entry->message), "%s", error);
+        }
+        else {
+            snprintf(entry->message, sizeof(entry->message), "exited (status %d)", WEXITSTATUS(status));
+        }
+    }
+    entry->seconds = hrn_now() - start;
+}
+
+static void print_entry(const Entry *entry) {
+    const Run *run = &entry->run;
+    char outcome[64] = "";
+    if (run->status == 0) {
+        snprintf(outcome, sizeof(outcome), "passed");
+    }
+    else if (run->status > 0) {
+        snprintf(outcome, sizeof(outcome), "failed (%d)", run->status);
+    }
+
+    pthread_mutex_lock(&output);
+    printf("%-9s %-48s %6d frames %7.2f s  %-12s %s\n", RESULT_NAMES[entry->result],
+        entry->name, run->frames, entry->seconds, outcome, entry->message);
+    fflush(stdout);
+    pthread_mutex_unlock(&output);
+}
+
+/* -----------------------------------------------------------------
+ * Work stealing. Every worker has a queue of entries: it takes them from
+ * the back of its own, and steals from the front of the others. Entries
+ * run for milliseconds to seconds, so a lock per queue is cheap enough.
+ * -------------------------------------------------------------- */
+
+typedef struct {
+    pthread_mutex_t lock;
+    int *items;
+    int head, tail;
+} Queue;
+
+static Queue *queues;
+static int num_workers;
+
+static bool take(int worker, int *item) {
+    Queue *queue = &queues[worker];
+    pthread_mutex_lock(&queue->lock);
+    bool success = queue->head < queue->tail;
+    if (success) {
+        *item = queue->items[--queue->tail];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return success;
+}
+
+static bool steal(int worker, int *item) {
+    for (int i = 1; i < num_workers; i++) {
+        Queue *queue = &queues[(worker + i) % num_workers];
+        pthread_mutex_lock(&queue->lock);
+        bool success = queue->head < queue->tail;
+        if (success) {
+            *item = queue->items[queue->head++];
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (success) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *run_worker(void *arg) {
+    int worker = (int) (size_t) arg;
+    int item;
+    while (take(worker, &item) || steal(worker, &item)) {
+        run_child(&entries[item]);
+        print_entry(&entries[item]);
+    }
+    return NULL;
+}
+
+/* Deal the entries out longest first, so that the last ones are short. */
+static void fill_queues(void) {
+    int *order = malloc(num_entries * sizeof(int));
+    for (int i = 0; i < num_entries; i++) {
+        order[i] = i;
+    }
+    for (int i = 1; i < num_entries; i++) {
+        int item = order[i], j = i;
+        for (; j > 0 && entries[order[j - 1]].estimate < entries[item].estimate; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = item;
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&queues[i].lock, NULL);
+        queues[i].items = malloc(num_entries * sizeof(int));
+        queues[i].head = queues[i].tail = 0;
+    }
+
+    /* The owner takes from the back: put its longest entries there. */
+    for (int i = num_entries - 1; i >= 0; i--) {
+        Queue *queue = &queues[i % num_workers];
+        queue->items[queue->tail++] = order[i];
+    }
+    free(order);
+}
+
+/* -----------------------------------------------------------------
+ * Corpus.
+ * -------------------------------------------------------------- */
+
+static bool has_suffix(const char *name, const char *suffix) {
+    size_t length = strlen(name), suffix_length = strlen(suffix);
+    return length > suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+static void add_entry(const char *directory, const char *relative, const char *goldens) {
+    if (num_entries == MAX_ENTRIES) {
+        return;
+    }
+
+    Entry *entry = &entries[num_entries++];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->name, sizeof(entry->name), "%s", relative);
+    snprintf(entry->rom, sizeof(entry->rom), "%s/%s", directory, relative);
+
+    /* The movie next to the ROM, if any. */
+    int stem = strlen(relative) - strlen(".nes");
+    const char *suffixes[] = { ".movie", ".fm2" };
+    for (int i = 0; i < 2 && entry->movie[0] == '\0'; i++) {
+        char movie[1024];
+        snprintf(movie, sizeof(movie), "%s/%.*s%s", directory, stem, relative, suffixes[i]);
+        if (access(movie, R_OK) == 0) {
+            snprintf(entry->movie, sizeof(entry->movie), "%s", movie);
+        }
+    }
+
+    /* Goldens are kept flat, named after the relative path. */
+    char flat[512];
+    snprintf(flat, sizeof(flat), "%s", relative);
+    for (char *c = flat; *c != '\0'; c++) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+    snprintf(entry->golden, sizeof(entry->golden), "%s/%s.golden", goldens, flat);
+
+    Run golden;
+    entry->estimate = load_golden(entry->golden, &golden, false) ? golden.frames : frames_limit;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const Entry *) a)->name, ((const Entry *) b)->name);
+}
+
+/* Add the ROMs under a directory, skipping the goldens. */
+static void scan(const char *directory, const char *relative, const char *goldens) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s%s", directory, relative[0] != '\0' ? "/" : "", relative);
+    if (strcmp(path, goldens) == 0) {
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *file;
+    while ((file = readdir(dir)) != NULL) {
+        if (file->d_name[0] == '.') {
+            continue;
+        }
+
+        char child[512], child_path[1024];
+        snprintf(child, sizeof(child), "%s%s%s", relative, relative[0] != '\0' ? "/" : "", file->d_name);
+        snprintf(child_path, sizeof(child_path), "%s/%s", directory, child);
+
+        struct stat info;
+        if (stat(child_path, &info) != 0) {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+            scan(directory, child, goldens);
+        }
+        else if (has_suffix(file->d_name, ".nes")) {
+            add_entry(directory, child, goldens);
+        }
+    }
+    closedir(dir);
+}
+
+int main(int argc, char *argv[]) {
+    char *directory = NULL;
+    char goldens[1024] = "";
+    num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames_limit = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--timeout") == 0 && has_value) {
+            timeout = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && has_value) {
+            num_workers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--goldens") == 0 && has_value) {
+            snprintf(goldens, sizeof(goldens), "%s", argv[++i]);
+        }
+        else if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        }
+        else if (directory == NULL && argv[i][0] != '-') {
+            directory = argv[i];
+        }
+        else {
+            directory = NULL;
+            break;
+        }
+    }
+
+    if (directory == NULL || frames_limit <= 0 || timeout <= 0) {
+        printf("Usage: ./nes_regress [--frames <n>] [--timeout <n>] [--jobs <n>] [--goldens <directory>]\n"
+               "                     [--update] <corpus directory>\n");
+        return 1;
+    }
+
+    size_t length = strlen(directory);
+    while (length > 1 && directory[length - 1] == '/') {
+        directory[--length] = '\0';
+    }
+    if (goldens[0] == '\0') {
+        snprintf(goldens, sizeof(goldens), "%s/goldens", directory);
+    }
+    if (update && mkdir(goldens, 0755) != 0 && errno != EEXIST) {
+        printf("Failed to create %s.\n", goldens);
+        return 1;
+    }
+
+    scan(directory, "", goldens);
+    if (num_entries == 0) {
+        printf("No ROMs found in %s.\n", directory);
+        return 1;
+    }
+    qsort(entries, num_entries, sizeof(Entry), compare_names);
+
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    if (num_workers > num_entries) {
+        num_workers = num_entries;
+    }
+
+    queues = malloc(num_workers * sizeof(Queue));
+    pthread_t *threads = malloc(num_workers * sizeof(pthread_t));
+    fill_queues();
+
+    double start = hrn_now();
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&threads[i], NULL, run_worker, (void *) (size_t) i) != 0) {
+            printf("Failed to start a worker.\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = hrn_now() - start;
+
+    int counts[RESULT_ERROR + 1] = { 0 };
+    long long frames = 0;
+    for (int i = 0; i < num_entries; i++) {
+        counts[entries[i].result]++;
+        frames += entries[i].run.frames;
+    }
+    printf("%d entries, %lld frames in %.2f s on %d threads: %d ok, %d new, %d written, %d regressed, %d errors\n",
+        num_entries, frames, seconds, num_workers, counts[RESULT_OK], counts[RESULT_NEW],
+        counts[RESULT_WRITTEN], counts[RESULT_REGRESSED], counts[RESULT_ERROR]);
+
+    return counts[RESULT_NEW] + counts[RESULT_REGRESSED] + counts[RESULT_ERROR] == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/* -----------------------------------------------------------------
+ * nes_zygote: serves warm machines of a ROM to worker clients.
+ *
+ * Loads the ROM, runs it to a given frame or loads a save state, and forks
+ * a worker for every client that connects to the socket. A worker runs its
+ * own copy of the machine on requests of the client:
+ *
+ *     request: dword frames, byte buttons (bit n: button n), 3 bytes padding
+ *     reply:   unsigned long long state hash after running the frames
+ *
+ * and exits when the client closes the connection.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../bench/include/harness.h"
+#include "../../include/common.h"
+#include "../../include/controller.h"
+#include "../../include/cpu.h"
+#include "../../include/machine.h"
+#include "../../include/nes.h"
+#include "../../include/ppu.h"
+#include "../../include/zygote.h"
+
+typedef struct {
+    dword frames;
+    byte buttons;
+    byte padding[3];
+} Request;
+
+static bool read_all(int connection, void *data, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t count = read(connection, (byte *) data + done, size - done);
+        if (count <= 0) {
+            return false;
+        }
+        done += count;
+    }
+    return true;
+}
+
+static int serve_client(int connection) {
+    Request request;
+    while (read_all(connection, &request, sizeof(request))) {
+        for (int i = 0; i < NUM_BUTTONS; i++) {
+            nes_controller1_set(i, request.buttons >> i & 1);
+        }
+        hrn_run_frames(request.frames);
+
+        unsigned long long hash = nes_state_hash();
+        if (write(connection, &hash, sizeof(hash)) != sizeof(hash)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: ./nes_zygote [--frames <n>] [--state <path>] <socket> <path-to-rom>\n");
+        return 1;
+    }
+
+    int frames = 0;
+    char *state = NULL;
+    for (int i = 1; i < argc - 2; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc - 2) {
+            frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc - 2) {
+            state = argv[++i];
+        }
+    }
+
+    if (!hrn_load_rom(argv[argc - 1])) {
+        printf("Failed to load ROM %s.\n", argv[argc - 1]);
+        return 1;
+    }
+
+    cpu_init();
+    nes_init();
+
+    /* Warm up: start from the save state, then run the frames. */
+    if (state != NULL) {
+        long length;
+        byte *data = hrn_read_file(state, &length);
+        if (data == NULL || !nes_load_state(data, length)) {
+            printf("Failed to load state %s.\n", state);
+            return 1;
+        }
+        free(data);
+    }
+    hrn_run_frames(frames);
+
+    printf("Serving frame %llu of %s on %s.\n", machine.ppu.frame, argv[argc - 1], argv[argc - 2]);
+    return zyg_serve(argv[argc - 2], serve_client) ? 0 : 1;
+}